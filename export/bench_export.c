@@ -0,0 +1,194 @@
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "reader.h"
+
+/*
+ * Compares the latency of reading a whole table from the export file with
+ * a GETBULK walk of the same table through the agent.
+ *
+ *	bench_export [-n PASSES] [-r REPETITIONS] [-c COMMUNITY] [-p PEER] FILE TABLE
+ *
+ * TABLE is the name of the table in the export file, e.g. ves. Without -p
+ * only the export file is read.
+ */
+#define PASSES 1000
+#define REPETITIONS 50
+
+static unsigned long long nanoseconds(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static int compare(const void* a, const void* b){
+	unsigned long long x = *(const unsigned long long*)a;
+	unsigned long long y = *(const unsigned long long*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char* what, unsigned long long* samples, int n,
+		long items, const char* unit){
+	qsort(samples, n, sizeof(*samples), compare);
+	printf("%s: %ld %s, p50 %llu ns, p99 %llu ns, max %llu ns a pass\n",
+		what, items, unit, samples[n / 2], samples[n * 99 / 100], samples[n - 1]);
+}
+
+/* NB. returns the number of the live rows. */
+static long export_pass(const struct export_reader* r, const struct export_table* t,
+		uint64_t* values){
+	struct export_record x;
+	long rows = 0;
+	uint32_t i;
+	for (i = 0; i < t->capacity; i++){
+		if (export_read(r, t, i, &x, values) == 1)
+			rows++;
+	}
+	return rows;
+}
+
+/* NB. returns the number of the cells of the table or -1. */
+static long getbulk_pass(netsnmp_session* s, const oid* root, size_t root_size,
+		int repetitions){
+	oid name[MAX_OID_LEN];
+	size_t size = root_size;
+	long cells = 0;
+	int done = 0;
+	memcpy(name, root, root_size * sizeof(oid));
+	while (!done){
+		netsnmp_pdu* q = snmp_pdu_create(SNMP_MSG_GETBULK);
+		netsnmp_pdu* a = NULL;
+		netsnmp_variable_list* v;
+		q->non_repeaters = 0;
+		q->max_repetitions = repetitions;
+		snmp_add_null_var(q, name, size);
+		if (snmp_synch_response(s, q, &a) != STAT_SUCCESS ||
+			a->errstat != SNMP_ERR_NOERROR){
+			if (a != NULL)
+				snmp_free_pdu(a);
+			return -1;
+		}
+		for (v = a->variables; v != NULL; v = v->next_variable){
+			if (v->type == SNMP_ENDOFMIBVIEW || v->name_length <= root_size ||
+				snmp_oid_compare(v->name, root_size, root, root_size) != 0){
+				done = 1;
+				break;
+			}
+			cells++;
+			size = v->name_length;
+			memcpy(name, v->name, size * sizeof(oid));
+		}
+		if (a->variables == NULL)
+			done = 1;
+		snmp_free_pdu(a);
+	}
+	return cells;
+}
+
+static int bench_getbulk(const char* peer, const char* community,
+		const struct export_table* t, int passes, int repetitions,
+		unsigned long long* samples){
+	netsnmp_session x, *s;
+	oid root[EXPORT_OID_MAX];
+	long cells = 0;
+	uint32_t i;
+	int k;
+	for (i = 0; i < t->oid_size; i++)
+		root[i] = t->oid[i];
+	init_snmp("bench_export");
+	snmp_sess_init(&x);
+	x.peername = (char*)peer;
+	x.version = SNMP_VERSION_2c;
+	x.community = (u_char*)community;
+	x.community_len = strlen(community);
+	s = snmp_open(&x);
+	if (s == NULL){
+		snmp_perror(peer);
+		return 1;
+	}
+	for (k = 0; k < passes; k++){
+		unsigned long long b = nanoseconds();
+		cells = getbulk_pass(s, root, t->oid_size, repetitions);
+		samples[k] = nanoseconds() - b;
+		if (cells < 0){
+			fprintf(stderr, "GETBULK of %s failed\n", t->name);
+			snmp_close(s);
+			return 1;
+		}
+	}
+	snmp_close(s);
+	report("getbulk", samples, passes, cells, "cells");
+	return 0;
+}
+
+int main(int argc, char* argv[]){
+	const char* peer = NULL;
+	const char* community = "public";
+	int passes = PASSES, repetitions = REPETITIONS, k, c;
+	struct export_reader r;
+	const struct export_table* t = NULL;
+	unsigned long long* samples;
+	uint64_t* values;
+	long rows = 0;
+	uint32_t i;
+	while ((c = getopt(argc, argv, "n:r:c:p:")) != -1){
+		switch (c){
+		case 'n':
+			passes = atoi(optarg);
+			break;
+		case 'r':
+			repetitions = atoi(optarg);
+			break;
+		case 'c':
+			community = optarg;
+			break;
+		case 'p':
+			peer = optarg;
+			break;
+		default:
+			passes = 0;
+		}
+	}
+	if (passes <= 0 || repetitions <= 0 || argc - optind != 2){
+		fprintf(stderr, "usage: %s [-n PASSES] [-r REPETITIONS] [-c COMMUNITY] "
+			"[-p PEER] FILE TABLE\n", argv[0]);
+		return 2;
+	}
+	if (export_open(&r, argv[optind]) != 0){
+		perror(argv[optind]);
+		return 1;
+	}
+	for (i = 0; i < r.header->tables; i++){
+		if (strncmp(r.tables[i].name, argv[optind + 1], EXPORT_NAME_MAX) == 0)
+			t = r.tables + i;
+	}
+	if (t == NULL){
+		fprintf(stderr, "no table %s in %s\n", argv[optind + 1], argv[optind]);
+		export_close(&r);
+		return 1;
+	}
+	samples = calloc(passes, sizeof(*samples));
+	values = calloc(t->columns + 1, sizeof(*values));
+	if (samples == NULL || values == NULL){
+		export_close(&r);
+		return 1;
+	}
+	for (k = 0; k < passes; k++){
+		unsigned long long b = nanoseconds();
+		rows = export_pass(&r, t, values);
+		samples[k] = nanoseconds() - b;
+	}
+	report("export", samples, passes, rows, "rows");
+	c = 0;
+	if (peer != NULL)
+		c = bench_getbulk(peer, community, t, passes, repetitions, samples);
+
+	free(values);
+	free(samples);
+	export_close(&r);
+	return c;
+}
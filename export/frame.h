@@ -0,0 +1,43 @@
+#ifndef FRAME_H
+#define FRAME_H
+#include "layout.h"
+/*
+ * Binary framing of the streaming sinks. A sink with the tcp transport
+ * connects to its host and port, one with the unix transport connects to
+ * the stream socket named by its host. The agent writes FRAME_MAGIC
+ * followed by the FRAME_VERSION byte once per connection, then frames
+ * follow. Every frame is a 32-bit length of the rest of the frame, one
+ * byte of the frame type and the payload. All the integers are
+ * little-endian.
+ *
+ * FRAME_SCHEMA: 16-bit count, then count entries of the 16-bit schema id,
+ * the OID length byte, the OID as 32-bit sub-identifiers, the column count
+ * byte and per column its 32-bit sub-identifier and its ASN type byte. The
+ * columns are the numeric ones of the table as in layout.h. It is sent
+ * once before the first row.
+ *
+ * FRAME_ROW: 64-bit CLOCK_REALTIME timestamp in nanoseconds, 16-bit schema
+ * id, the key length byte, the key as 32-bit sub-identifiers, a 64-bit mask
+ * with bit i set for every column i that follows, then one 8-byte value
+ * per set bit in the column order. The key is the index of the row as in
+ * the MIB, the host scalars have none.
+ *
+ * FRAME_GONE: the timestamp, the schema id and the key of a row that does
+ * not exist anymore.
+ *
+ * A reconnected sink starts over with the magic and the schema and sends
+ * all the columns again.
+ */
+#define FRAME_MAGIC "\0DRF"
+#define FRAME_MAGIC_SIZE 4
+#define FRAME_VERSION 1
+#define FRAME_HEADER_SIZE 5
+#define FRAME_COLUMNS_MAX 64
+
+enum frame_kind{
+	FRAME_SCHEMA = 1,
+	FRAME_ROW,
+	FRAME_GONE
+};
+
+#endif
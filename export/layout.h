@@ -0,0 +1,85 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+#include <stdint.h>
+/*
+ * Layout of the metrics export file. The agent writes it when RMOND_EXPORT
+ * names the file, local readers map it read-only.
+ *
+ * The file starts with struct export_header, then header.tables entries of
+ * struct export_table and header.columns entries of struct export_column
+ * follow. The columns of a table are the entries from table.column to
+ * table.column + table.columns - 1. Then the records of every table start
+ * at table.offset from the beginning of the file, table.capacity records of
+ * table.record_size bytes each. Every record is struct export_record
+ * followed by one 8-byte value per column in the column order. An
+ * ASN_COUNTER64 value is an unsigned 64-bit integer, any other value is a
+ * signed 64-bit integer. The integers are in the host byte order.
+ *
+ * A record is guarded by its own sequence number. The agent makes it odd
+ * before it changes the record and even again after that, thus a reader
+ * copies the record when the sequence is even and retries if the sequence
+ * changed meanwhile. A record without EXPORT_RECORD_LIVE is free. The
+ * host scalars are a table of one record with no key.
+ *
+ * The layout of a file never changes. When a table outgrows its capacity
+ * the agent writes a bigger file under the same name and sets the retired
+ * flag of the old one, the readers should reopen the file then.
+ */
+#define EXPORT_MAGIC "\0DRX"
+#define EXPORT_MAGIC_SIZE 4
+#define EXPORT_VERSION 1
+#define EXPORT_NAME_MAX 32
+#define EXPORT_OID_MAX 16
+#define EXPORT_KEY_MAX 48
+#define EXPORT_VALUE_SIZE 8
+
+enum export_record_flag{
+	EXPORT_RECORD_LIVE = 1
+};
+
+struct export_header{
+	char magic[EXPORT_MAGIC_SIZE];
+	uint32_t version;
+	uint64_t size;
+	/* bumped by the agent after every pass over the tables. */
+	uint64_t generation;
+	/* CLOCK_MONOTONIC nanoseconds of the last pass. */
+	uint64_t stamp;
+	uint32_t retired;
+	uint32_t tables;
+	uint32_t columns;
+	uint32_t reserved;
+};
+
+struct export_table{
+	char name[EXPORT_NAME_MAX];
+	/* the OID of the table, the host scalars use their group OID. */
+	uint32_t oid[EXPORT_OID_MAX];
+	uint32_t oid_size;
+	uint32_t column;
+	uint32_t columns;
+	uint32_t capacity;
+	uint32_t record_size;
+	uint32_t reserved;
+	uint64_t offset;
+};
+
+struct export_column{
+	/* the sub-identifier of the column in the table OID. */
+	uint32_t name;
+	/* the ASN type of the column. */
+	uint32_t type;
+};
+
+struct export_record{
+	uint32_t sequence;
+	uint32_t flags;
+	/* CLOCK_MONOTONIC nanoseconds of the last change. */
+	uint64_t stamp;
+	/* the index of the row as in the MIB. */
+	uint32_t key_size;
+	uint32_t key[EXPORT_KEY_MAX];
+	uint32_t reserved;
+};
+
+#endif
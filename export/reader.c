@@ -0,0 +1,124 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "reader.h"
+
+static int check(const struct export_reader* src){
+	const struct export_header* h = src->header;
+	uint64_t x = sizeof(*h) + (uint64_t)h->tables * sizeof(struct export_table) +
+			(uint64_t)h->columns * sizeof(struct export_column);
+	uint32_t i;
+	if (memcmp(h->magic, EXPORT_MAGIC, EXPORT_MAGIC_SIZE) != 0 ||
+		h->version != EXPORT_VERSION || h->size != src->size || x > src->size)
+		return -1;
+	for (i = 0; i < h->tables; i++){
+		const struct export_table* t = src->tables + i;
+		if (t->column + (uint64_t)t->columns > h->columns ||
+			t->oid_size > EXPORT_OID_MAX ||
+			t->record_size < sizeof(struct export_record) +
+				(uint64_t)t->columns * EXPORT_VALUE_SIZE ||
+			t->offset + (uint64_t)t->capacity * t->record_size > src->size)
+			return -1;
+	}
+	return 0;
+}
+
+int export_open(struct export_reader* dst, const char* path){
+	struct stat s;
+	void* m;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &s) != 0){
+		close(fd);
+		return -1;
+	}
+	if ((uint64_t)s.st_size < sizeof(struct export_header)){
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	m = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED)
+		return -1;
+
+	dst->data = m;
+	dst->size = s.st_size;
+	dst->header = m;
+	dst->tables = (const struct export_table*)(dst->header + 1);
+	dst->columns = (const struct export_column*)(dst->tables + dst->header->tables);
+	if (check(dst) != 0){
+		export_close(dst);
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
+void export_close(struct export_reader* src){
+	if (src->data != NULL)
+		munmap((void*)src->data, src->size);
+	memset(src, 0, sizeof(*src));
+}
+
+int export_retired(const struct export_reader* src){
+	return __atomic_load_n(&src->header->retired, __ATOMIC_ACQUIRE) != 0;
+}
+
+uint64_t export_generation(const struct export_reader* src){
+	return __atomic_load_n(&src->header->generation, __ATOMIC_ACQUIRE);
+}
+
+const struct export_table* export_find(const struct export_reader* src,
+		const uint32_t* oid, uint32_t size){
+	uint32_t i;
+	for (i = 0; i < src->header->tables; i++){
+		const struct export_table* t = src->tables + i;
+		if (t->oid_size == size && memcmp(t->oid, oid, size * sizeof(*oid)) == 0)
+			return t;
+	}
+	return NULL;
+}
+
+int export_read(const struct export_reader* src, const struct export_table* table,
+		uint32_t slot, struct export_record* record, uint64_t* values){
+	const struct export_record* r;
+	const uint64_t* v;
+	uint32_t s, i, n, k;
+	if (slot >= table->capacity){
+		errno = ERANGE;
+		return -1;
+	}
+
+	r = (const struct export_record*)(src->data + table->offset +
+			(uint64_t)slot * table->record_size);
+	v = (const uint64_t*)(r + 1);
+	for (k = 0;; k++){
+		if (k == EXPORT_RETRIES){
+			errno = EAGAIN;
+			return -1;
+		}
+		s = __atomic_load_n(&r->sequence, __ATOMIC_ACQUIRE);
+		if (s & 1)
+			continue;
+
+		record->sequence = s;
+		record->flags = __atomic_load_n(&r->flags, __ATOMIC_RELAXED);
+		record->stamp = __atomic_load_n(&r->stamp, __ATOMIC_RELAXED);
+		n = __atomic_load_n(&r->key_size, __ATOMIC_RELAXED);
+		record->key_size = n < EXPORT_KEY_MAX ? n : EXPORT_KEY_MAX;
+		for (i = 0; i < record->key_size; i++)
+			record->key[i] = __atomic_load_n(r->key + i, __ATOMIC_RELAXED);
+		for (i = 0; i < table->columns; i++)
+			values[i] = __atomic_load_n(v + i, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&r->sequence, __ATOMIC_RELAXED) == s)
+			break;
+	}
+	return (record->flags & EXPORT_RECORD_LIVE) ? 1 : 0;
+}
@@ -0,0 +1,45 @@
+#ifndef READER_H
+#define READER_H
+#include <stddef.h>
+#include "layout.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A read-only mapping of the export file. The reads take no lock and make
+ * no system call, export_open and export_close are the only ones that do.
+ */
+struct export_reader{
+	const unsigned char* data;
+	uint64_t size;
+	const struct export_header* header;
+	const struct export_table* tables;
+	const struct export_column* columns;
+};
+
+/* returns 0 or -1 with errno set. EPROTO stands for a malformed file. */
+int export_open(struct export_reader* dst, const char* path);
+void export_close(struct export_reader* src);
+/* non-zero when the agent has replaced the file and it should be reopened. */
+int export_retired(const struct export_reader* src);
+uint64_t export_generation(const struct export_reader* src);
+const struct export_table* export_find(const struct export_reader* src,
+		const uint32_t* oid, uint32_t size);
+/*
+ * copies a consistent record and its table->columns values. returns 1 for
+ * a live row, 0 for a free record and -1 with errno set: ERANGE if the slot
+ * is out of range, EAGAIN if the record kept changing for EXPORT_RETRIES
+ * tries, e.g. the agent died in the middle of a write. the caller may try
+ * again later.
+ */
+#define EXPORT_RETRIES 1024
+int export_read(const struct export_reader* src, const struct export_table* table,
+		uint32_t slot, struct export_record* record, uint64_t* values);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
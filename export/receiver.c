@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "frame.h"
+
+/*
+ * A local receiver of the streaming sinks. It listens on the unix socket
+ * or on the TCP port given, takes one connection at a time and prints
+ * every frame, or only the counts of them with -q.
+ *
+ *	rmond-feed [-q] unix:/run/drs.sock | tcp:PORT
+ */
+#define RECEIVER_BUFFER_SIZE 65536
+
+static int quiet = 0;
+
+static uint64_t get(const unsigned char** src, unsigned size){
+	uint64_t x = 0;
+	unsigned i;
+	for (i = 0; i < size; i++)
+		x |= (uint64_t)(*src)[i] << (8 * i);
+	*src += size;
+	return x;
+}
+
+static void print_key(const unsigned char** src){
+	unsigned n = get(src, 1), i;
+	for (i = 0; i < n; i++)
+		printf(".%u", (unsigned)get(src, 4));
+}
+
+static void print(const unsigned char* src, unsigned kind){
+	uint64_t mask, stamp;
+	unsigned i, n;
+	switch (kind){
+	case FRAME_SCHEMA:
+		n = get(&src, 2);
+		printf("schema of %u tables\n", n);
+		return;
+	case FRAME_ROW:
+	case FRAME_GONE:
+		stamp = get(&src, 8);
+		n = get(&src, 2);
+		printf("%s %llu schema %u key ", kind == FRAME_ROW ? "row" : "gone",
+			(unsigned long long)stamp, n);
+		print_key(&src);
+		if (kind == FRAME_ROW){
+			mask = get(&src, 8);
+			for (i = 0; i < FRAME_COLUMNS_MAX; i++){
+				if (mask & (1ULL << i))
+					printf(" %u=%lld", i, (long long)get(&src, 8));
+			}
+		}
+		printf("\n");
+		return;
+	default:
+		printf("unknown frame %u\n", kind);
+	}
+}
+
+static int listen_on(const char* address){
+	int s = -1;
+	if (strncmp(address, "unix:", 5) == 0){
+		struct sockaddr_un a;
+		memset(&a, 0, sizeof(a));
+		a.sun_family = AF_UNIX;
+		strncpy(a.sun_path, address + 5, sizeof(a.sun_path) - 1);
+		unlink(a.sun_path);
+		s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (s < 0 || bind(s, (struct sockaddr*)&a, sizeof(a)) != 0)
+			return -1;
+	}
+	else if (strncmp(address, "tcp:", 4) == 0){
+		struct sockaddr_in a;
+		int y = 1;
+		memset(&a, 0, sizeof(a));
+		a.sin_family = AF_INET;
+		a.sin_port = htons(atoi(address + 4));
+		s = socket(AF_INET, SOCK_STREAM, 0);
+		if (s < 0)
+			return -1;
+		setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &y, sizeof(y));
+		if (bind(s, (struct sockaddr*)&a, sizeof(a)) != 0)
+			return -1;
+	}
+	else{
+		errno = EINVAL;
+		return -1;
+	}
+	return listen(s, 1) == 0 ? s : -1;
+}
+
+static void receive(int fd){
+	static unsigned char buf[RECEIVER_BUFFER_SIZE];
+	unsigned long long frames = 0, bytes = 0;
+	size_t size = 0, head = FRAME_MAGIC_SIZE + 1;
+	ssize_t n;
+	while ((n = read(fd, buf + size, sizeof(buf) - size)) > 0){
+		const unsigned char* p = buf;
+		size += n;
+		bytes += n;
+		if (head != 0){
+			if (size < head)
+				continue;
+			if (memcmp(buf, FRAME_MAGIC, FRAME_MAGIC_SIZE) != 0 ||
+				buf[FRAME_MAGIC_SIZE] != FRAME_VERSION){
+				fprintf(stderr, "not a feed of version %d\n", FRAME_VERSION);
+				return;
+			}
+			p += head;
+			head = 0;
+		}
+		while (buf + size - p >= FRAME_HEADER_SIZE){
+			const unsigned char* q = p;
+			uint32_t length = get(&q, 4);
+			if (length + 4 > sizeof(buf)){
+				fprintf(stderr, "a frame of %u bytes is too long\n", length);
+				return;
+			}
+			if ((size_t)(buf + size - p) < length + 4)
+				break;
+			if (!quiet)
+				print(q + 1, *q);
+			frames++;
+			p += length + 4;
+		}
+		size = buf + size - p;
+		memmove(buf, p, size);
+		if (!quiet)
+			fflush(stdout);
+	}
+	printf("%llu frames, %llu bytes\n", frames, bytes);
+	fflush(stdout);
+}
+
+int main(int argc, char** argv){
+	int s, c;
+	if (argc > 1 && strcmp(argv[1], "-q") == 0){
+		quiet = 1;
+		argc--;
+		argv++;
+	}
+	if (argc != 2){
+		fprintf(stderr, "usage: %s [-q] unix:PATH | tcp:PORT\n", argv[0]);
+		return 2;
+	}
+	s = listen_on(argv[1]);
+	if (s < 0){
+		perror(argv[1]);
+		return 1;
+	}
+	for (;;){
+		c = accept(s, NULL, NULL);
+		if (c < 0){
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			return 1;
+		}
+		receive(c);
+		close(c);
+	}
+	return 0;
+}
@@ -0,0 +1,254 @@
+#include <poll.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include "frame.h"
+
+/*
+ * Runs rmond-feed on a unix socket, writes it the frames a streaming sink
+ * sends and checks what it prints: a whole feed, a feed cut into single
+ * bytes and a feed of the wrong magic followed by a good one.
+ *
+ *	test_feed [PATH_TO_RMOND_FEED]
+ */
+#define READ_TIMEOUT 5000
+#define CONNECT_TRIES 500
+#define PIECE_DELAY 1000
+
+static const char* feed = "./rmond-feed";
+static char path[] = "/tmp/test_feed.XXXXXX";
+static int failures = 0;
+
+#define CHECK(x) do{ \
+	if (!(x)){ \
+		fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #x); \
+		failures++; \
+	} \
+}while (0)
+
+static const char* expected[] = {
+	"schema of 1 tables",
+	"row 1234 schema 0 key .7.1 0=42 2=-1",
+	"gone 1235 schema 0 key .7.1",
+};
+#define EXPECTED (sizeof(expected)/sizeof(expected[0]))
+
+static unsigned char* put(unsigned char* dst, uint64_t x, unsigned size){
+	unsigned i;
+	for (i = 0; i < size; i++)
+		dst[i] = (unsigned char)(x >> (8 * i));
+	return dst + size;
+}
+
+/* NB. the length and the type go first, returns the end of the frame. */
+static unsigned char* frame(unsigned char* dst, unsigned char* end, int kind){
+	put(dst, end - dst - 4, 4);
+	dst[4] = kind;
+	return end;
+}
+
+/* NB. the magic and a schema, a row and a gone frame of a table of 3 columns. */
+static size_t make_feed(unsigned char* dst){
+	static const uint32_t oid[] = {1, 3, 6, 1, 4, 1, 26171, 1, 1, 55};
+	unsigned char* p = dst + FRAME_MAGIC_SIZE + 1;
+	unsigned char* b;
+	unsigned i;
+	memcpy(dst, FRAME_MAGIC, FRAME_MAGIC_SIZE);
+	dst[FRAME_MAGIC_SIZE] = FRAME_VERSION;
+
+	b = p;
+	p += FRAME_HEADER_SIZE;
+	p = put(p, 1, 2);
+	p = put(p, 0, 2);
+	p = put(p, sizeof(oid) / sizeof(oid[0]), 1);
+	for (i = 0; i < sizeof(oid) / sizeof(oid[0]); i++)
+		p = put(p, oid[i], 4);
+	p = put(p, 3, 1);
+	for (i = 0; i < 3; i++){
+		p = put(p, i + 1, 4);
+		p = put(p, 0x46, 1);
+	}
+	p = frame(b, p, FRAME_SCHEMA);
+
+	b = p;
+	p += FRAME_HEADER_SIZE;
+	p = put(p, 1234, 8);
+	p = put(p, 0, 2);
+	p = put(p, 2, 1);
+	p = put(p, 7, 4);
+	p = put(p, 1, 4);
+	p = put(p, 5, 8);
+	p = put(p, 42, 8);
+	p = put(p, (uint64_t)-1, 8);
+	p = frame(b, p, FRAME_ROW);
+
+	b = p;
+	p += FRAME_HEADER_SIZE;
+	p = put(p, 1235, 8);
+	p = put(p, 0, 2);
+	p = put(p, 2, 1);
+	p = put(p, 7, 4);
+	p = put(p, 1, 4);
+	p = frame(b, p, FRAME_GONE);
+	return p - dst;
+}
+
+static pid_t spawn(int* fd){
+	char address[sizeof("unix:") + sizeof(path)];
+	int p[2];
+	pid_t pid;
+	snprintf(address, sizeof(address), "unix:%s", path);
+	if (pipe(p) != 0)
+		return -1;
+	pid = fork();
+	if (pid == 0){
+		dup2(p[1], 1);
+		close(p[0]);
+		close(p[1]);
+		close(2);
+		open("/dev/null", O_WRONLY);
+		execl(feed, feed, address, (char*)NULL);
+		_exit(127);
+	}
+	close(p[1]);
+	*fd = p[0];
+	return pid;
+}
+
+/* NB. the receiver binds its socket after the start, retries till then. */
+static int connect_to(void){
+	struct sockaddr_un a;
+	int i, s;
+	memset(&a, 0, sizeof(a));
+	a.sun_family = AF_UNIX;
+	strncpy(a.sun_path, path, sizeof(a.sun_path) - 1);
+	for (i = 0; i < CONNECT_TRIES; i++){
+		s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (s < 0)
+			return -1;
+		if (connect(s, (struct sockaddr*)&a, sizeof(a)) == 0)
+			return s;
+		close(s);
+		usleep(10000);
+	}
+	return -1;
+}
+
+/* NB. reads a line without the newline or fails after READ_TIMEOUT */
+static int read_line(int fd, char* dst, size_t size){
+	struct pollfd p;
+	size_t n = 0;
+	while (n < size - 1){
+		p.fd = fd;
+		p.events = POLLIN;
+		if (poll(&p, 1, READ_TIMEOUT) != 1 || read(fd, dst + n, 1) != 1)
+			return -1;
+		if (dst[n] == '\n')
+			break;
+		n++;
+	}
+	dst[n] = '\0';
+	return 0;
+}
+
+/*
+ * NB. writes the data in pieces of step bytes, then closes the connection.
+ * the pause keeps the pieces from coalescing into one read.
+ */
+static int send_feed(const unsigned char* data, size_t size, size_t step){
+	size_t i, n;
+	int s = connect_to();
+	if (s < 0)
+		return -1;
+	for (i = 0; i < size; i += n){
+		n = size - i < step ? size - i : step;
+		if (write(s, data + i, n) != (ssize_t)n){
+			close(s);
+			return -1;
+		}
+		if (n < size)
+			usleep(PIECE_DELAY);
+	}
+	close(s);
+	return 0;
+}
+
+static void check_output(int fd, size_t size){
+	char line[256], total[64];
+	size_t i;
+	for (i = 0; i < EXPECTED; i++){
+		CHECK(read_line(fd, line, sizeof(line)) == 0);
+		if (strcmp(line, expected[i]) != 0){
+			fprintf(stderr, "\"%s\" instead of \"%s\"\n", line, expected[i]);
+			failures++;
+		}
+	}
+	snprintf(total, sizeof(total), "%u frames, %zu bytes", (unsigned)EXPECTED, size);
+	CHECK(read_line(fd, line, sizeof(line)) == 0);
+	if (strcmp(line, total) != 0){
+		fprintf(stderr, "\"%s\" instead of \"%s\"\n", line, total);
+		failures++;
+	}
+}
+
+static void test_feed(int fd, const unsigned char* data, size_t size){
+	CHECK(send_feed(data, size, size) == 0);
+	check_output(fd, size);
+}
+
+static void test_pieces(int fd, const unsigned char* data, size_t size){
+	CHECK(send_feed(data, size, 1) == 0);
+	check_output(fd, size);
+}
+
+/* NB. a feed of the wrong magic is dropped, the next one is served. */
+static void test_magic(int fd, const unsigned char* data, size_t size){
+	unsigned char bad[FRAME_MAGIC_SIZE + 1];
+	memcpy(bad, data, sizeof(bad));
+	bad[FRAME_MAGIC_SIZE] = FRAME_VERSION + 1;
+	CHECK(send_feed(bad, sizeof(bad), sizeof(bad)) == 0);
+	CHECK(send_feed(data, size, size) == 0);
+	check_output(fd, size);
+}
+
+int main(int argc, char* argv[]){
+	unsigned char data[512];
+	size_t size;
+	int fd, status = 0, t;
+	pid_t pid;
+	if (argc > 1)
+		feed = argv[1];
+	signal(SIGPIPE, SIG_IGN);
+	t = mkstemp(path);
+	if (t < 0){
+		perror(path);
+		return 1;
+	}
+	close(t);
+	unlink(path);
+	pid = spawn(&fd);
+	if (pid < 0){
+		perror(feed);
+		return 1;
+	}
+	size = make_feed(data);
+	test_feed(fd, data, size);
+	test_pieces(fd, data, size);
+	test_magic(fd, data, size);
+	close(fd);
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+	unlink(path);
+	if (failures){
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("rmond-feed: ok\n");
+	return 0;
+}
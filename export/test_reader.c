@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "reader.h"
+
+/*
+ * Writes an export file the way the agent lays it out and reads it back
+ * through the reader: the lookups, the records, a record stuck in a write,
+ * the malformed files and a writer racing the readers.
+ *
+ *	test_reader [WRITES]
+ */
+#define COLUMNS 3
+#define CAPACITY 4
+#define READERS 3
+#define WRITES 1000000
+
+static const uint32_t table_oid[] = {1, 3, 6, 1, 4, 1, 26171, 1, 1, 55};
+#define TABLE_OID_SIZE (sizeof(table_oid)/sizeof(table_oid[0]))
+
+static char path[] = "/tmp/test_reader.XXXXXX";
+static unsigned char* data;
+static size_t size;
+static int failures = 0;
+static int stop = 0;
+
+#define CHECK(x) do{ \
+	if (!(x)){ \
+		fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #x); \
+		failures++; \
+	} \
+}while (0)
+
+static struct export_table* table(void){
+	return (struct export_table*)((struct export_header*)data + 1);
+}
+
+static struct export_record* record(uint32_t slot){
+	struct export_table* t = table();
+	return (struct export_record*)(data + t->offset + (uint64_t)slot * t->record_size);
+}
+
+/* NB. the same protocol as the agent follows, see layout.h. */
+static void write_record(uint32_t slot, uint32_t key, uint64_t value){
+	struct export_record* r = record(slot);
+	uint64_t* v = (uint64_t*)(r + 1);
+	uint32_t s = r->sequence, i;
+	__atomic_store_n(&r->sequence, s + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&r->flags, EXPORT_RECORD_LIVE, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->stamp, value, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->key_size, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(r->key, key, __ATOMIC_RELAXED);
+	for (i = 0; i < COLUMNS; i++)
+		__atomic_store_n(v + i, value, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->sequence, s + 2, __ATOMIC_RELEASE);
+}
+
+static int make_file(void){
+	struct export_header* h;
+	struct export_table* t;
+	struct export_column* c;
+	uint32_t i;
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return -1;
+	size = sizeof(*h) + sizeof(*t) + COLUMNS * sizeof(*c);
+	size = (size + 63) & ~(size_t)63;
+	size += CAPACITY * (sizeof(struct export_record) + COLUMNS * EXPORT_VALUE_SIZE);
+	if (ftruncate(fd, size) != 0){
+		close(fd);
+		return -1;
+	}
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return -1;
+
+	h = (struct export_header*)data;
+	memcpy(h->magic, EXPORT_MAGIC, EXPORT_MAGIC_SIZE);
+	h->version = EXPORT_VERSION;
+	h->size = size;
+	h->generation = 1;
+	h->tables = 1;
+	h->columns = COLUMNS;
+	t = table();
+	strcpy(t->name, "ves");
+	memcpy(t->oid, table_oid, sizeof(table_oid));
+	t->oid_size = TABLE_OID_SIZE;
+	t->column = 0;
+	t->columns = COLUMNS;
+	t->capacity = CAPACITY;
+	t->record_size = sizeof(struct export_record) + COLUMNS * EXPORT_VALUE_SIZE;
+	t->offset = (sizeof(*h) + sizeof(*t) + COLUMNS * sizeof(*c) + 63) & ~(size_t)63;
+	c = (struct export_column*)(t + 1);
+	for (i = 0; i < COLUMNS; i++){
+		c[i].name = i + 1;
+		c[i].type = 0x46;
+	}
+	return 0;
+}
+
+static void test_lookup(struct export_reader* r){
+	uint32_t other[TABLE_OID_SIZE];
+	CHECK(export_generation(r) == 1);
+	CHECK(export_retired(r) == 0);
+	CHECK(export_find(r, table_oid, TABLE_OID_SIZE) == r->tables);
+	CHECK(export_find(r, table_oid, TABLE_OID_SIZE - 1) == NULL);
+	memcpy(other, table_oid, sizeof(other));
+	other[TABLE_OID_SIZE - 1]++;
+	CHECK(export_find(r, other, TABLE_OID_SIZE) == NULL);
+}
+
+static void test_records(struct export_reader* r){
+	const struct export_table* t = r->tables;
+	struct export_record x;
+	uint64_t v[COLUMNS];
+	CHECK(export_read(r, t, 0, &x, v) == 0);
+	write_record(1, 7, 42);
+	CHECK(export_read(r, t, 1, &x, v) == 1);
+	CHECK(x.key_size == 1 && x.key[0] == 7 && x.stamp == 42 && x.sequence == 2);
+	CHECK(v[0] == 42 && v[COLUMNS - 1] == 42);
+
+	errno = 0;
+	CHECK(export_read(r, t, CAPACITY, &x, v) == -1 && errno == ERANGE);
+
+	/* NB. a writer that never finishes: the read gives up. */
+	__atomic_store_n(&record(2)->sequence, 1, __ATOMIC_RELEASE);
+	errno = 0;
+	CHECK(export_read(r, t, 2, &x, v) == -1 && errno == EAGAIN);
+	__atomic_store_n(&record(2)->sequence, 2, __ATOMIC_RELEASE);
+	CHECK(export_read(r, t, 2, &x, v) == 0);
+
+	((struct export_header*)data)->retired = 1;
+	CHECK(export_retired(r) != 0);
+	((struct export_header*)data)->retired = 0;
+}
+
+static void test_malformed(void){
+	struct export_reader r;
+	memset(&r, 0, sizeof(r));
+	data[0] = 'X';
+	errno = 0;
+	CHECK(export_open(&r, path) == -1 && errno == EPROTO);
+	data[0] = EXPORT_MAGIC[0];
+
+	table()->capacity = CAPACITY * 2;
+	errno = 0;
+	CHECK(export_open(&r, path) == -1 && errno == EPROTO);
+	table()->capacity = CAPACITY;
+
+	errno = 0;
+	CHECK(export_open(&r, "/nonexistent/export") == -1 && errno == ENOENT);
+	CHECK(export_open(&r, path) == 0);
+	export_close(&r);
+}
+
+static void* write_loop(void* arg){
+	long i, n = *(long*)arg;
+	for (i = 1; i <= n; i++)
+		write_record(3, (uint32_t)i, (uint64_t)i);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static void* read_loop(void* arg){
+	const struct export_reader* r = arg;
+	struct export_record x;
+	uint64_t v[COLUMNS];
+	long torn = 0;
+	int i;
+	while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)){
+		if (export_read(r, r->tables, 3, &x, v) != 1)
+			continue;
+		for (i = 0; i < COLUMNS; i++){
+			if (v[i] != x.stamp)
+				break;
+		}
+		if (i != COLUMNS || x.key[0] != (uint32_t)x.stamp)
+			torn++;
+	}
+	return (void*)torn;
+}
+
+static void test_race(struct export_reader* r, long writes){
+	pthread_t w, q[READERS];
+	void* torn;
+	int i;
+	write_record(3, 0, 0);
+	for (i = 0; i < READERS; i++)
+		pthread_create(&q[i], NULL, read_loop, r);
+	pthread_create(&w, NULL, write_loop, &writes);
+	pthread_join(w, NULL);
+	for (i = 0; i < READERS; i++){
+		pthread_join(q[i], &torn);
+		if (torn != NULL){
+			fprintf(stderr, "%ld torn reads\n", (long)torn);
+			failures++;
+		}
+	}
+}
+
+int main(int argc, char* argv[]){
+	struct export_reader r;
+	long writes = WRITES;
+	if (argc > 1)
+		writes = atol(argv[1]);
+	if (writes <= 0){
+		fprintf(stderr, "usage: %s [WRITES]\n", argv[0]);
+		return 2;
+	}
+	if (make_file() != 0){
+		perror(path);
+		return 1;
+	}
+	if (export_open(&r, path) != 0){
+		perror(path);
+		unlink(path);
+		return 1;
+	}
+	test_lookup(&r);
+	test_records(&r);
+	test_malformed();
+	test_race(&r, writes);
+	export_close(&r);
+	unlink(path);
+	if (failures){
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("export reader: ok\n");
+	return 0;
+}
@@ -0,0 +1,48 @@
+#include <time.h>
+#include <string.h>
+#include "lin_transport.h"
+
+/*
+ * Times one pass of the Linux sampler over the fixture /proc files, or
+ * over the real ones with DRS_PROC_ROOT set to an empty string.
+ *
+ *	bench_sampler [ITERATIONS]
+ */
+#define FIXTURES "fixtures"
+#define ITERATIONS 100000
+
+static unsigned long long nanoseconds(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int main(int argc, char* argv[]){
+	statistics* stats = NULL;
+	unsigned long long start, cpu;
+	struct timespec c0, c1;
+	long i, n = ITERATIONS;
+	if (argc > 1){
+		n = atol(argv[1]);
+	}
+	if (n <= 0){
+		fprintf(stderr, "usage: %s [ITERATIONS]\n", argv[0]);
+		return 2;
+	}
+	setenv("DRS_PROC_ROOT", FIXTURES, 0);
+	if (read_stats(&stats) < 0){
+		return 1;
+	}
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c0);
+	start = nanoseconds();
+	for (i = 0; i < n; i++){
+		if (read_stats(&stats) < 0){
+			return 1;
+		}
+	}
+	start = nanoseconds() - start;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &c1);
+	cpu = (c1.tv_sec - c0.tv_sec) * 1000000000ULL + c1.tv_nsec - c0.tv_nsec;
+	printf("%ld samples, %llu ns/sample, %llu ns cpu/sample\n", n, start / n, cpu / n);
+	return 0;
+}
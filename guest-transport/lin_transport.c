@@ -1,6 +1,20 @@
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
-#include "transport.h"
+#include <limits.h>
+#include <sys/timerfd.h>
+#include "lin_transport.h"
+
+/*
+ * The /proc files are opened once and re-read with pread every cycle. Set
+ * PROC_ROOT_ENV to a directory with proc/loadavg, proc/diskstats and
+ * proc/meminfo fixtures to run the sampler outside of a guest.
+ */
+#define PROC_ROOT_ENV "DRS_PROC_ROOT"
+#define PROC_BUFFER_SIZE 65536
 
 enum LINUX_STATS{
 	loadavg_currExisting = 0,
@@ -15,6 +29,13 @@ enum LINUX_STATS{
 	TOTAL_LINUX_STATS
 };
 
+enum LINUX_FILES{
+	proc_loadavg = 0,
+	proc_diskstats,
+	proc_meminfo,
+	TOTAL_LINUX_FILES
+};
+
 statistics stats[TOTAL_LINUX_STATS] = {
 		{"loadavg_currExisting", INTEGER_TYPE, .value_int = -1},
 		{"loadavg_runQJobs01", DOUBLE_TYPE, .value_double = -1},
@@ -27,56 +48,186 @@ statistics stats[TOTAL_LINUX_STATS] = {
 		{"meminfo_Dirty",INTEGER_TYPE, .value_int = -1},
 		};
 
-int get_stats(statistics** pstats, int period){
-	FILE* proc_loadavg;
-	FILE* proc_diskstats;
-	FILE* proc_meminfo;
-	long temp_diskstats_write_ms = 0, temp_diskstats_IOs_in_process = 0;
-	char buf[1024], *tok;
-	usleep (period * 1000000);
-	proc_loadavg = fopen("/proc/loadavg","r");
-//start parse loadavg
-	fscanf(proc_loadavg,"%lf %*f %*f %*i/%li %*i",
-		&(stats[loadavg_runQJobs01].value_double),
-		&(stats[loadavg_currExisting].value_int)
-		);
-	fclose(proc_loadavg);
-//end parse loadavg
-//start parse diskstat
-	proc_diskstats = fopen("/proc/diskstats","r");
-	stats[diskstats_ms_writing].value_int = 0;
-	stats[diskstats_IOs_in_process].value_int = 0;
-	while(!feof(proc_diskstats)){
-		fscanf(proc_diskstats,"%*i%*i%*s%*[ ]%*i%*i%*i%*i%*i%*i%*i%li%li%*i%*i",
-		&temp_diskstats_write_ms, &temp_diskstats_IOs_in_process);
-		stats[diskstats_ms_writing].value_int += temp_diskstats_write_ms;
-		stats[diskstats_IOs_in_process].value_int += temp_diskstats_IOs_in_process;
-	}
-	fclose(proc_diskstats);
-//end parse diskstat
-//start parse meminfo
-	proc_meminfo = fopen("/proc/meminfo","r");
-	while(!feof(proc_meminfo)){
-		fgets(buf, 1024, proc_meminfo);
-		tok = strtok(buf, " ");
-		if(strcmp("Writeback:", tok) == 0){
-			tok = strtok(NULL, " ");
-			stats[meminfo_Writeback].value_int = strtol(tok, NULL, 10);
-		}else if(strcmp("SUnreclaim:", tok) == 0){
-			tok = strtok(NULL, " ");
-			stats[meminfo_SUnreclaim].value_int = strtol(tok, NULL, 10);
-		}else if(strcmp("PageTables:", tok) == 0){
-			tok = strtok(NULL, " ");
-			stats[meminfo_PageTables].value_int = strtol(tok, NULL, 10);
-		}else if(strcmp("Mapped:", tok) == 0){
-			tok = strtok(NULL, " ");
-			stats[meminfo_Mapped].value_int = strtol(tok, NULL, 10);
-		}else if(strcmp("Dirty:", tok) == 0){
-			tok = strtok(NULL, " ");
-			stats[meminfo_Dirty].value_int = strtol(tok, NULL, 10);
+static const struct {
+	const char* key;
+	size_t len;
+	enum LINUX_STATS stat;
+} meminfo_keys[] = {
+		{"Writeback", sizeof("Writeback") - 1, meminfo_Writeback},
+		{"SUnreclaim", sizeof("SUnreclaim") - 1, meminfo_SUnreclaim},
+		{"PageTables", sizeof("PageTables") - 1, meminfo_PageTables},
+		{"Mapped", sizeof("Mapped") - 1, meminfo_Mapped},
+		{"Dirty", sizeof("Dirty") - 1, meminfo_Dirty},
+		};
+
+static const char* proc_files[TOTAL_LINUX_FILES] = {
+		"/proc/loadavg",
+		"/proc/diskstats",
+		"/proc/meminfo",
+		};
+
+static int fds[TOTAL_LINUX_FILES] = {-1, -1, -1};
+static int timer = -1;
+static struct timespec deadline;
+static char buf[PROC_BUFFER_SIZE];
+
+static int open_files(void){
+	const char* root = getenv(PROC_ROOT_ENV);
+	char path[PATH_MAX];
+	int i;
+	for (i = 0; i < TOTAL_LINUX_FILES; i++){
+		snprintf(path, sizeof(path), "%s%s", root ? root : "", proc_files[i]);
+		fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+		if (fds[i] == -1){
+			fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+			return -1;
 		}
 	}
-//end parse meminfo
+	return 0;
+}
+
+/* the first tick is aligned to a multiple of the period */
+static void start_timer(int period){
+	struct itimerspec its;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec = (deadline.tv_sec / period + 1) * period;
+	deadline.tv_nsec = 0;
+	timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer == -1){
+		return;
+	}
+	its.it_value = deadline;
+	its.it_interval.tv_sec = period;
+	its.it_interval.tv_nsec = 0;
+	if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &its, NULL) == -1){
+		close(timer);
+		timer = -1;
+	}
+}
+
+/* missed ticks are skipped rather than sampled in a burst */
+static void wait_tick(int period){
+	uint64_t expirations;
+	if (timer != -1){
+		while (read(timer, &expirations, sizeof(expirations)) == -1 && errno == EINTR);
+		return;
+	}
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+	deadline.tv_sec += period;
+}
+
+static const char* read_file(enum LINUX_FILES file){
+	ssize_t n = pread(fds[file], buf, sizeof(buf) - 1, 0);
+	if (n < 0){
+		return NULL;
+	}
+	buf[n] = '\0';
+	return buf;
+}
+
+static const char* next_field(const char* p){
+	while (*p && *p != ' ' && *p != '\n'){
+		p++;
+	}
+	while (*p == ' '){
+		p++;
+	}
+	return p;
+}
+
+static const char* next_line(const char* p){
+	p = strchr(p, '\n');
+	return p ? p + 1 : NULL;
+}
+
+/* "0.07 0.16 0.09 2/69 2037" */
+static void parse_loadavg(const char* p){
+	int i;
+	stats[loadavg_runQJobs01].value_double = strtod(p, NULL);
+	for (i = 0; i < 3; i++){
+		p = next_field(p);
+	}
+	p = strchr(p, '/');
+	if (p){
+		stats[loadavg_currExisting].value_int = strtol(p + 1, NULL, 10);
+	}
+}
+
+/* "major minor name" and 7 fields before the write ms and the IOs in process */
+static void parse_diskstats(const char* p){
+	long ms_writing = 0, IOs_in_process = 0;
+	int i;
+	for (; p && *p; p = next_line(p)){
+		while (*p == ' '){
+			p++;
+		}
+		for (i = 0; i < 10 && *p && *p != '\n'; i++){
+			p = next_field(p);
+		}
+		if (i < 10 || *p == '\n'){
+			continue;
+		}
+		ms_writing += strtol(p, NULL, 10);
+		p = next_field(p);
+		IOs_in_process += strtol(p, NULL, 10);
+	}
+	stats[diskstats_ms_writing].value_int = ms_writing;
+	stats[diskstats_IOs_in_process].value_int = IOs_in_process;
+}
+
+/* "Dirty:               123 kB" */
+static void parse_meminfo(const char* p){
+	const char* colon;
+	size_t i, len;
+	for (; p && *p; p = next_line(p)){
+		colon = strchr(p, ':');
+		if (!colon){
+			break;
+		}
+		len = colon - p;
+		for (i = 0; i < sizeof(meminfo_keys)/sizeof(meminfo_keys[0]); i++){
+			if (len == meminfo_keys[i].len && memcmp(p, meminfo_keys[i].key, len) == 0){
+				stats[meminfo_keys[i].stat].value_int = strtol(colon + 1, NULL, 10);
+				break;
+			}
+		}
+	}
+}
+
+int read_stats(statistics** pstats){
+	const char* p;
+	if (fds[proc_loadavg] == -1 && open_files()){
+		return -1;
+	}
+	if ((p = read_file(proc_loadavg))){
+		parse_loadavg(p);
+	}
+	if ((p = read_file(proc_diskstats))){
+		parse_diskstats(p);
+	}
+	if ((p = read_file(proc_meminfo))){
+		parse_meminfo(p);
+	}
 	*pstats = stats;
 	return TOTAL_LINUX_STATS;
 }
+
+int get_stats(statistics** pstats, int period){
+	if (fds[proc_loadavg] == -1){
+		if (open_files()){
+			return -1;
+		}
+		start_timer(period);
+	}
+	wait_tick(period);
+	return read_stats(pstats);
+}
+
+unsigned long long get_timestamp(void){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void set_binary_output(void){
+}
@@ -0,0 +1,7 @@
+#ifndef LIN_TRANSPORT_H
+#define LIN_TRANSPORT_H
+#include "transport.h"
+
+/* NB. samples the /proc files at once, without waiting for a tick */
+int read_stats(statistics**);
+#endif
@@ -0,0 +1,42 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+/*
+ * Binary framing of the drs-transport output. It is used only when the host
+ * asks for it with PROTOCOL_OPTION, otherwise the text lines are written.
+ *
+ * The stream starts with PROTOCOL_MAGIC followed by PROTOCOL_VERSION, then
+ * frames follow. Every frame is a 32-bit length of the rest of the frame,
+ * one byte of the frame type and the payload. All the integers are
+ * little-endian.
+ *
+ * FRAME_DICTIONARY: 16-bit count, then count entries of the value type
+ * byte (enum stat_type), the name length byte and the name. The position
+ * of an entry is the counter id. It is sent once before the first sample.
+ *
+ * FRAME_SAMPLE: 64-bit monotonic timestamp in nanoseconds, 16-bit count,
+ * then count 8-byte values in the dictionary order. An INTEGER_TYPE value
+ * is a signed 64-bit integer, a DOUBLE_TYPE one is an IEEE 754 double.
+ * A sample equal to the previous one is not sent, but at least one sample
+ * is sent every PROTOCOL_KEEPALIVE periods.
+ */
+#define PROTOCOL_OPTION "--binary"
+#define PROTOCOL_MAGIC "\0DRS"
+#define PROTOCOL_MAGIC_SIZE 4
+#define PROTOCOL_VERSION 1
+#define PROTOCOL_HEADER_SIZE 5
+#define PROTOCOL_VALUE_SIZE 8
+#define PROTOCOL_NAME_MAX 255
+#define PROTOCOL_COUNTERS_MAX 256
+#define PROTOCOL_KEEPALIVE 10
+
+enum stat_type{
+	INTEGER_TYPE = 0,
+	DOUBLE_TYPE
+};
+
+enum frame_type{
+	FRAME_DICTIONARY = 1,
+	FRAME_SAMPLE
+};
+
+#endif
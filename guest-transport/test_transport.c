@@ -0,0 +1,239 @@
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "transport.h"
+
+/*
+ * Runs drs-transport over the fixture /proc files and checks both the
+ * text lines and the binary frames against the values of the fixtures.
+ *
+ *	test_transport [PATH_TO_DRS_TRANSPORT]
+ */
+#define FIXTURES "fixtures"
+#define READ_TIMEOUT 5000
+
+static const struct {
+	const char* name;
+	enum stat_type type;
+	long value_int;
+	double value_double;
+	const char* text;
+} expected[] = {
+		{"loadavg_currExisting", INTEGER_TYPE, 187, 0, "loadavg_currExisting:187 "},
+		{"loadavg_runQJobs01", DOUBLE_TYPE, 0, 0.52, "loadavg_runQJobs01:0.520000 "},
+		{"diskstats_ms_writing", INTEGER_TYPE, 1650, 0, "diskstats_ms_writing:1650 "},
+		{"diskstats_IOs_in_process", INTEGER_TYPE, 3, 0, "diskstats_IOs_in_process:3 "},
+		{"meminfo_Writeback", INTEGER_TYPE, 12, 0, "meminfo_Writeback:12 "},
+		{"meminfo_SUnreclaim", INTEGER_TYPE, 34567, 0, "meminfo_SUnreclaim:34567 "},
+		{"meminfo_PageTables", INTEGER_TYPE, 4096, 0, "meminfo_PageTables:4096 "},
+		{"meminfo_Mapped", INTEGER_TYPE, 123456, 0, "meminfo_Mapped:123456 "},
+		{"meminfo_Dirty", INTEGER_TYPE, 88, 0, "meminfo_Dirty:88 "},
+		};
+#define EXPECTED (sizeof(expected)/sizeof(expected[0]))
+
+static const char* transport = "./drs-transport";
+static int failures = 0;
+
+#define CHECK(x) do{ \
+	if (!(x)){ \
+		fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #x); \
+		failures++; \
+	} \
+}while (0)
+
+static pid_t spawn(char* const argv[], int* fd){
+	int p[2];
+	pid_t pid;
+	if (pipe(p) != 0){
+		return -1;
+	}
+	pid = fork();
+	if (pid == 0){
+		dup2(p[1], 1);
+		close(p[0]);
+		close(p[1]);
+		close(2);
+		open("/dev/null", O_WRONLY);
+		setenv("DRS_PROC_ROOT", FIXTURES, 1);
+		execv(transport, argv);
+		_exit(127);
+	}
+	close(p[1]);
+	*fd = p[0];
+	return pid;
+}
+
+static int finish(pid_t pid, int fd){
+	int status = 0;
+	close(fd);
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+	return status;
+}
+
+static int exit_code(char* const argv[]){
+	int fd, status = 0;
+	pid_t pid = spawn(argv, &fd);
+	if (pid < 0){
+		return -1;
+	}
+	waitpid(pid, &status, 0);
+	close(fd);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* NB. reads exactly size bytes or fails after READ_TIMEOUT */
+static int read_all(int fd, unsigned char* dst, size_t size){
+	struct pollfd p;
+	ssize_t n;
+	while (size > 0){
+		p.fd = fd;
+		p.events = POLLIN;
+		if (poll(&p, 1, READ_TIMEOUT) != 1){
+			return -1;
+		}
+		n = read(fd, dst, size);
+		if (n <= 0){
+			return -1;
+		}
+		dst += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static uint64_t get(const unsigned char** src, unsigned size){
+	uint64_t x = 0;
+	unsigned i;
+	for (i = 0; i < size; i++)
+		x |= (uint64_t)(*src)[i] << (8 * i);
+	*src += size;
+	return x;
+}
+
+/* NB. returns the frame type, the payload is left in dst */
+static int read_frame(int fd, unsigned char* dst, size_t size, size_t* length){
+	unsigned char h[PROTOCOL_HEADER_SIZE];
+	const unsigned char* p = h;
+	if (read_all(fd, h, sizeof(h)) != 0){
+		return -1;
+	}
+	*length = get(&p, 4) - 1;
+	if (*length > size || read_all(fd, dst, *length) != 0){
+		return -1;
+	}
+	return h[4];
+}
+
+static void test_arguments(void){
+	char* bad_option[] = {"drs-transport", "--bianry", NULL};
+	char* two_periods[] = {"drs-transport", "1", "2", NULL};
+	char* zero_period[] = {"drs-transport", "0", NULL};
+	char* junk_period[] = {"drs-transport", "1s", NULL};
+	CHECK(exit_code(bad_option) == 1);
+	CHECK(exit_code(two_periods) == 1);
+	CHECK(exit_code(zero_period) == 1);
+	CHECK(exit_code(junk_period) == 1);
+}
+
+static void test_text(void){
+	char* argv[] = {"drs-transport", "1", NULL};
+	char line[1024];
+	size_t i, n = 0;
+	int fd;
+	pid_t pid = spawn(argv, &fd);
+	CHECK(pid > 0);
+	if (pid <= 0){
+		return;
+	}
+	while (n < sizeof(line) - 1 && read_all(fd, (unsigned char*)line + n, 1) == 0 && line[n] != '\n'){
+		n++;
+	}
+	line[n] = '\0';
+	CHECK(n > 0 && n < sizeof(line) - 1);
+	for (i = 0; i < EXPECTED; i++){
+		if (strstr(line, expected[i].text) == NULL){
+			fprintf(stderr, "no %s in \"%s\"\n", expected[i].text, line);
+			failures++;
+		}
+	}
+	finish(pid, fd);
+}
+
+static void test_binary(void){
+	char* argv[] = {"drs-transport", PROTOCOL_OPTION, "1", NULL};
+	static unsigned char frame[65536];
+	const unsigned char* p;
+	unsigned char head[PROTOCOL_MAGIC_SIZE + 1];
+	int types[PROTOCOL_COUNTERS_MAX];
+	int order[PROTOCOL_COUNTERS_MAX];
+	size_t length, i, j, count;
+	uint64_t v;
+	double d;
+	int fd;
+	pid_t pid = spawn(argv, &fd);
+	CHECK(pid > 0);
+	if (pid <= 0){
+		return;
+	}
+	CHECK(read_all(fd, head, sizeof(head)) == 0);
+	CHECK(memcmp(head, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE) == 0);
+	CHECK(head[PROTOCOL_MAGIC_SIZE] == PROTOCOL_VERSION);
+
+	CHECK(read_frame(fd, frame, sizeof(frame), &length) == FRAME_DICTIONARY);
+	p = frame;
+	count = get(&p, 2);
+	CHECK(count == EXPECTED);
+	for (i = 0; i < count && i < PROTOCOL_COUNTERS_MAX; i++){
+		types[i] = *p++;
+		length = *p++;
+		order[i] = -1;
+		for (j = 0; j < EXPECTED; j++){
+			if (strlen(expected[j].name) == length && memcmp(p, expected[j].name, length) == 0){
+				order[i] = j;
+			}
+		}
+		CHECK(order[i] != -1 && (int)expected[order[i]].type == types[i]);
+		p += length;
+	}
+
+	CHECK(read_frame(fd, frame, sizeof(frame), &length) == FRAME_SAMPLE);
+	CHECK(length == 8 + 2 + count * PROTOCOL_VALUE_SIZE);
+	p = frame;
+	CHECK(get(&p, 8) != 0);
+	CHECK(get(&p, 2) == count);
+	for (i = 0; i < count && i < PROTOCOL_COUNTERS_MAX; i++){
+		v = get(&p, PROTOCOL_VALUE_SIZE);
+		if (order[i] == -1){
+			continue;
+		}
+		if (types[i] == DOUBLE_TYPE){
+			memcpy(&d, &v, sizeof(d));
+			CHECK(d == expected[order[i]].value_double);
+		}else{
+			CHECK((int64_t)v == expected[order[i]].value_int);
+		}
+	}
+	finish(pid, fd);
+}
+
+int main(int argc, char* argv[]){
+	if (argc > 1){
+		transport = argv[1];
+	}
+	signal(SIGPIPE, SIG_IGN);
+	test_arguments();
+	test_text();
+	test_binary();
+	if (failures){
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("drs-transport: ok\n");
+	return 0;
+}
@@ -1,24 +1,142 @@
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include "transport.h"
 
+static unsigned char frame[PROTOCOL_HEADER_SIZE + 2 + 8 + PROTOCOL_COUNTERS_MAX*(2 + PROTOCOL_NAME_MAX)];
+
+static unsigned char* put_le(unsigned char* dst, uint64_t value, int size){
+	int i;
+	for (i = 0; i < size; i++){
+		*dst++ = (unsigned char)(value >> (8*i));
+	}
+	return dst;
+}
+
+static void write_frame(enum frame_type type, unsigned char* end){
+	put_le(frame, end - frame - 4, 4);
+	frame[4] = type;
+	fwrite(frame, 1, end - frame, stdout);
+}
+
+static void write_dictionary(statistics* stats, int count){
+	unsigned char* p = frame + PROTOCOL_HEADER_SIZE;
+	int i;
+	size_t len;
+	p = put_le(p, count, 2);
+	for (i = 0; i < count; i++){
+		len = strnlen(stats[i].name, sizeof(stats[i].name));
+		*p++ = stats[i].type;
+		*p++ = (unsigned char)len;
+		memcpy(p, stats[i].name, len);
+		p += len;
+	}
+	write_frame(FRAME_DICTIONARY, p);
+}
+
+static void write_sample(statistics* stats, int count){
+	unsigned char* p = frame + PROTOCOL_HEADER_SIZE;
+	uint64_t v;
+	int64_t n;
+	int i;
+	p = put_le(p, get_timestamp(), 8);
+	p = put_le(p, count, 2);
+	for (i = 0; i < count; i++){
+		if (stats[i].type == DOUBLE_TYPE){
+			memcpy(&v, &stats[i].value_double, sizeof(v));
+		}else{
+			n = stats[i].value_int;
+			v = (uint64_t)n;
+		}
+		p = put_le(p, v, PROTOCOL_VALUE_SIZE);
+	}
+	write_frame(FRAME_SAMPLE, p);
+}
+
+/* NB. remembers the values and reports whether any of them changed */
+static int changed(statistics* stats, int count){
+	static statistics last[PROTOCOL_COUNTERS_MAX];
+	static int last_count = -1;
+	int i, output = count != last_count;
+	for (i = 0; i < count; i++){
+		if (stats[i].type == DOUBLE_TYPE){
+			output |= memcmp(&last[i].value_double, &stats[i].value_double, sizeof(double)) != 0;
+		}else{
+			output |= last[i].value_int != stats[i].value_int;
+		}
+		last[i] = stats[i];
+	}
+	last_count = count;
+	return output;
+}
+
+static void write_text(statistics* stats, int count){
+	int i;
+	for (i = 0; i < count; i++){
+		if (stats[i].type == INTEGER_TYPE){
+			printf("%s:%li ",stats[i].name,stats[i].value_int);
+		}else if (stats[i].type == DOUBLE_TYPE){
+			printf("%s:%lf ",stats[i].name,stats[i].value_double);
+		}
+	}
+	printf("\n");
+}
+
+/* NB. the only arguments are PROTOCOL_OPTION and the period in seconds,
+ * anything else is rejected rather than taken for the period */
+static int parse(int argc, char* argv[], int* period, int* binary){
+	char* end;
+	long x;
+	int i, seen = 0;
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], PROTOCOL_OPTION) == 0){
+			*binary = 1;
+			continue;
+		}
+		x = strtol(argv[i], &end, 10);
+		if (seen || end == argv[i] || *end != '\0' || x <= 0 || x > INT_MAX){
+			fprintf(stderr, "usage: %s [%s] [PERIOD]\n", argv[0], PROTOCOL_OPTION);
+			return 1;
+		}
+		*period = (int)x;
+		seen = 1;
+	}
+	return 0;
+}
+
 int main(int argc, char* argv[]){
 	statistics *stats = NULL;
-	int period;
-	int stats_count, i;
-	if (argc == 22){
-		period = atoi(argv[1]);
-	}else{
+	int period = 1, binary = 0;
+	int stats_count, idle = 0;
+	if (parse(argc, argv, &period, &binary) != 0){
 		return 1;
 	}
+	if (binary){
+		set_binary_output();
+		fwrite(PROTOCOL_MAGIC, 1, PROTOCOL_MAGIC_SIZE, stdout);
+		fputc(PROTOCOL_VERSION, stdout);
+	}
 	while (1){
 		stats_count = get_stats(&stats, period);
-		for (i = 0; i < stats_count; i++){
-			if (stats[i].type == INTEGER_TYPE){
-				printf("%s:%li ",stats[i].name,stats[i].value_int);
-			}else if (stats[i].type == DOUBLE_TYPE){
-				printf("%s:%lf ",stats[i].name,stats[i].value_double);
+		if (stats_count < 0){
+			return 1;
+		}
+		if (stats_count > PROTOCOL_COUNTERS_MAX){
+			stats_count = PROTOCOL_COUNTERS_MAX;
+		}
+		if (binary){
+			if (binary == 1){
+				write_dictionary(stats, stats_count);
+				binary = 2;
+			}
+			if (!changed(stats, stats_count) && ++idle < PROTOCOL_KEEPALIVE){
+				continue;
 			}
+			idle = 0;
+			write_sample(stats, stats_count);
+		}else{
+			write_text(stats, stats_count);
 		}
-		printf("\n");
 		fflush(stdout);
 	}
 	return 1;
@@ -3,10 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
-enum stat_type{
-	INTEGER_TYPE = 0,
-	DOUBLE_TYPE
-};
+#include "protocol.h"
 
 typedef struct {
 	char name[50];
@@ -18,4 +15,6 @@ typedef struct {
 } statistics;
 
 int get_stats(statistics**, int);
+unsigned long long get_timestamp(void);
+void set_binary_output(void);
 #endif
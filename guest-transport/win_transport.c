@@ -211,6 +211,20 @@ else
 }
 }
 
+unsigned long long get_timestamp(void)
+{
+	LARGE_INTEGER now, frequency;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&frequency);
+	return (unsigned long long)(now.QuadPart / frequency.QuadPart) * 1000000000ULL +
+		(unsigned long long)(now.QuadPart % frequency.QuadPart) * 1000000000ULL / frequency.QuadPart;
+}
+
+void set_binary_output(void)
+{
+	_setmode(_fileno(stdout), _O_BINARY);
+}
+
 void ErrorExit(PTSTR message)
 {
 	fprintf(stderr,"error: %s", message);
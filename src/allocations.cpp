@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "allocations.h"
+#include <cstddef>
+
+// NB. the glibc entry points behind the public ones.
+extern "C" void* __libc_malloc(size_t );
+extern "C" void* __libc_calloc(size_t , size_t );
+extern "C" void* __libc_realloc(void* , size_t );
+
+namespace
+{
+unsigned long long g_allocations;
+
+void count()
+{
+	__atomic_add_fetch(&g_allocations, 1, __ATOMIC_RELAXED);
+}
+
+} // anonymous namespace
+
+extern "C" void* malloc(size_t size_)
+{
+	count();
+	return __libc_malloc(size_);
+}
+
+extern "C" void* calloc(size_t number_, size_t size_)
+{
+	count();
+	return __libc_calloc(number_, size_);
+}
+
+extern "C" void* realloc(void* data_, size_t size_)
+{
+	if (NULL == data_)
+		count();
+
+	return __libc_realloc(data_, size_);
+}
+
+namespace Rmond
+{
+namespace Bench
+{
+unsigned long long allocations()
+{
+	return __atomic_load_n(&g_allocations, __ATOMIC_RELAXED);
+}
+
+} // namespace Bench
+} // namespace Rmond
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+namespace Rmond
+{
+namespace Bench
+{
+// NB. the number of the heap allocations the process made so far, those of
+// malloc, calloc, realloc of NULL and operator new alike. only the programs
+// that link allocations.lo count, the agent does not.
+unsigned long long allocations();
+
+} // namespace Bench
+} // namespace Rmond
+
+#endif // ALLOCATIONS_H
@@ -22,6 +22,7 @@
  */
 
 #include "asn.h"
+#include <algorithm>
 
 namespace Rmond
 {
@@ -29,6 +30,19 @@ namespace Asn
 {
 namespace Policy
 {
+bool varbind(u_char type_, const void* value_, size_t size_, const oid* name_,
+	size_t length_, u_char*& dst_, size_t& left_)
+{
+	size_t n = length_;
+	u_char* x = snmp_build_var_op(dst_, (oid* )name_, &n, type_, size_,
+				(u_char* )value_, &left_);
+	if (NULL == x)
+		return true;
+
+	dst_ = x;
+	return false;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct IP
 
@@ -43,6 +57,26 @@ void IP::put(const netsnmp_variable_list& src_, in_addr_t& dst_)
 	dst_ = ntohl(*src_.val.integer);
 }
 
+bool IP::build(in_addr_t src_, const oid* name_, size_t length_,
+	u_char*& dst_, size_t& left_)
+{
+	u_int32_t n = htonl(src_);
+	return varbind(ASN_IPADDRESS, &n, sizeof(n), name_, length_, dst_, left_);
+}
+
+bool IP::encode(in_addr_t src_, oid*& dst_, const oid* end_)
+{
+	if (end_ - dst_ < 4)
+		return true;
+
+	u_int32_t n = htonl(src_);
+	const u_char* b = (const u_char* )&n;
+	for (int i = 0; i < 4; ++i)
+		*dst_++ = b[i];
+
+	return false;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Counter
 
@@ -60,6 +94,21 @@ void Counter::put(const netsnmp_variable_list& src_, unsigned long long& dst_)
 	dst_ =(dst_ << 32) + src_.val.counter64->low;
 }
 
+bool Counter::build(unsigned long long src_, const oid* name_, size_t length_,
+	u_char*& dst_, size_t& left_)
+{
+	counter64 x;
+	x.low = src_ & 0xffffffff;
+	x.high = src_ >> 32;
+	return varbind(ASN_COUNTER64, &x, sizeof(x), name_, length_, dst_, left_);
+}
+
+bool Counter::encode(unsigned long long src_, oid*& dst_, const oid* end_)
+{
+	// NB. counter64 cannot be an index.
+	return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct String
 
@@ -74,6 +123,25 @@ void String::put(const netsnmp_variable_list& src_, std::string& dst_)
 	dst_.assign((const char* )src_.val.string, src_.val_len);
 }
 
+bool String::build(const std::string& src_, const oid* name_, size_t length_,
+	u_char*& dst_, size_t& left_)
+{
+	return varbind(ASN_OCTET_STR, src_.data(), src_.size(), name_, length_,
+			dst_, left_);
+}
+
+bool String::encode(const std::string& src_, oid*& dst_, const oid* end_)
+{
+	if (end_ - dst_ < (ptrdiff_t)src_.size() + 1)
+		return true;
+
+	*dst_++ = src_.size();
+	for (std::string::const_iterator i = src_.begin(); i != src_.end(); ++i)
+		*dst_++ = (u_char)*i;
+
+	return false;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct ObjectId
 
@@ -92,6 +160,23 @@ void ObjectId::put(const netsnmp_variable_list& src_, value_type& dst_)
 	dst_.assign(src_.val.objid, src_.val.objid + src_.val_len / sizeof(oid));
 }
 
+bool ObjectId::build(const value_type& src_, const oid* name_, size_t length_,
+	u_char*& dst_, size_t& left_)
+{
+	return varbind(ASN_OBJECT_ID, src_.empty() ? NULL : &src_[0],
+			src_.size()*sizeof(src_[0]), name_, length_, dst_, left_);
+}
+
+bool ObjectId::encode(const value_type& src_, oid*& dst_, const oid* end_)
+{
+	if (end_ - dst_ < (ptrdiff_t)src_.size() + 1)
+		return true;
+
+	*dst_++ = src_.size();
+	dst_ = std::copy(src_.begin(), src_.end(), dst_);
+	return false;
+}
+
 } // namespace Policy
 } // namespace Asn
 } // namespace Rmond
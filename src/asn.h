@@ -24,6 +24,7 @@
 #ifndef ASN_H
 #define ASN_H
 #include "mib.h"
+#include "published.h"
 #include <string>
 
 namespace Rmond
@@ -32,6 +33,11 @@ namespace Asn
 {
 namespace Policy
 {
+// NB. BER encodes a varbind at dst_ without any allocation. returns true if
+// it does not fit into left_ bytes, otherwise advances dst_ past it.
+bool varbind(u_char type_, const void* value_, size_t size_, const oid* name_,
+	size_t length_, u_char*& dst_, size_t& left_);
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Integer
 
@@ -47,6 +53,20 @@ struct Integer
 	{
 		dst_ = *src_.val.integer;
 	}
+	static bool encode(int src_, oid*& dst_, const oid* end_)
+	{
+		if (end_ == dst_)
+			return true;
+
+		// NB. the same widening as snmp_set_var_typed_value does.
+		*dst_++ = (ASN_INTEGER == T ? (oid)(long)src_ : (oid)(u_int)src_);
+		return false;
+	}
+	static bool build(int src_, const oid* name_, size_t length_, u_char*& dst_, size_t& left_)
+	{
+		long x = (ASN_INTEGER == T ? (long)src_ : (long)(u_int)src_);
+		return varbind(T, &x, sizeof(x), name_, length_, dst_, left_);
+	}
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -56,6 +76,11 @@ struct IP
 {
 	static void get(in_addr_t src_, netsnmp_variable_list& dst_);
 	static void put(const netsnmp_variable_list& src_, in_addr_t& dst_);
+	// NB. appends the index sub-identifiers. returns true if they do
+	// not fit.
+	static bool encode(in_addr_t src_, oid*& dst_, const oid* end_);
+	static bool build(in_addr_t src_, const oid* name_, size_t length_,
+		u_char*& dst_, size_t& left_);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -65,6 +90,9 @@ struct Counter
 {
 	static void get(unsigned long long src_, netsnmp_variable_list& dst_);
 	static void put(const netsnmp_variable_list& src_, unsigned long long& dst_);
+	static bool encode(unsigned long long src_, oid*& dst_, const oid* end_);
+	static bool build(unsigned long long src_, const oid* name_, size_t length_,
+		u_char*& dst_, size_t& left_);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -74,6 +102,9 @@ struct String
 {
 	static void get(const std::string& src_, netsnmp_variable_list& dst_);
 	static void put(const netsnmp_variable_list& src_, std::string& dst_);
+	static bool encode(const std::string& src_, oid*& dst_, const oid* end_);
+	static bool build(const std::string& src_, const oid* name_, size_t length_,
+		u_char*& dst_, size_t& left_);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -85,10 +116,129 @@ struct ObjectId
 
 	static void get(const value_type& src_, netsnmp_variable_list& dst_);
 	static void put(const netsnmp_variable_list& src_, value_type& dst_);
+	static bool encode(const value_type& src_, oid*& dst_, const oid* end_);
+	static bool build(const value_type& src_, const oid* name_, size_t length_,
+		u_char*& dst_, size_t& left_);
 };
 
 } // namespace Policy
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Slot
+// NB. the columns are written by the SDK event threads and read by the SNMP
+// thread without any lock. a scalar value is a relaxed atomic.
+
+template<class T>
+struct Slot
+{
+	Slot(): m_value()
+	{
+	}
+
+	T load() const
+	{
+		return __atomic_load_n(&m_value, __ATOMIC_RELAXED);
+	}
+	// NB. returns true if the value has changed.
+	bool store(T value_)
+	{
+		return value_ != __atomic_exchange_n(&m_value, value_, __ATOMIC_RELAXED);
+	}
+	template<class P>
+	bool build(const oid* name_, size_t length_, u_char*& dst_, size_t& left_) const
+	{
+		return P::build(load(), name_, length_, dst_, left_);
+	}
+	template<class P>
+	bool encode(oid*& dst_, const oid* end_) const
+	{
+		return P::encode(load(), dst_, end_);
+	}
+	template<class F>
+	void read(F& visitor_) const
+	{
+		visitor_(load());
+	}
+private:
+	T m_value;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Shared
+// NB. a value that cannot be copied atomically is published, see
+// published.h. the GET path encodes it right from the front copy.
+
+template<class T>
+struct Shared: Published<T>
+{
+	// NB. encodes the value in place, no copy is made.
+	template<class P>
+	bool build(const oid* name_, size_t length_, u_char*& dst_, size_t& left_) const
+	{
+		Build<P> b(name_, length_, dst_, left_);
+		this->read(b);
+		return b.output;
+	}
+	// NB. the index sub-identifiers, no copy either.
+	template<class P>
+	bool encode(oid*& dst_, const oid* end_) const
+	{
+		Encode<P> e(dst_, end_);
+		this->read(e);
+		return e.output;
+	}
+private:
+	template<class P>
+	struct Build
+	{
+		Build(const oid* name_, size_t length_, u_char*& dst_, size_t& left_):
+			output(true), m_name(name_), m_length(length_), m_dst(dst_),
+			m_left(left_)
+		{
+		}
+
+		void operator()(const T& value_)
+		{
+			output = P::build(value_, m_name, m_length, m_dst, m_left);
+		}
+
+		bool output;
+	private:
+		const oid* m_name;
+		size_t m_length;
+		u_char*& m_dst;
+		size_t& m_left;
+	};
+	template<class P>
+	struct Encode
+	{
+		Encode(oid*& dst_, const oid* end_):
+			output(true), m_dst(dst_), m_end(end_)
+		{
+		}
+
+		void operator()(const T& value_)
+		{
+			output = P::encode(value_, m_dst, m_end);
+		}
+
+		bool output;
+	private:
+		oid*& m_dst;
+		const oid* m_end;
+	};
+};
+
+template<>
+struct Slot<std::string>: Shared<std::string>
+{
+};
+
+template<>
+struct Slot<Oid_type>: Shared<Oid_type>
+{
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Bean
 
@@ -97,28 +247,41 @@ struct Bean
 {
 	typedef T value_type;
 
-	Bean(): m_value()
+	value_type get() const
 	{
+		return m_value.load();
 	}
-
-	const value_type& get() const
+	// NB. returns true if the value has changed.
+	bool put(const value_type& value_)
 	{
-		return m_value;
+		return m_value.store(value_);
 	}
-	void put(const value_type& value_)
+	void get(netsnmp_variable_list& dst_) const
 	{
-		m_value = value_;
+		P::get(m_value.load(), dst_);
 	}
-	void get(netsnmp_variable_list& dst_) const
+	bool put(const netsnmp_variable_list& src_)
+	{
+		value_type x = value_type();
+		P::put(src_, x);
+		return m_value.store(x);
+	}
+	bool encode(oid*& dst_, const oid* end_) const
+	{
+		return m_value.template encode<P>(dst_, end_);
+	}
+	bool build(const oid* name_, size_t length_, u_char*& dst_, size_t& left_) const
 	{
-		P::get(m_value, dst_);
+		return m_value.template build<P>(name_, length_, dst_, left_);
 	}
-	void put(const netsnmp_variable_list& src_)
+	// NB. calls visitor_ with the value, a published one is not copied.
+	template<class F>
+	void read(F& visitor_) const
 	{
-		P::put(src_, m_value);
+		m_value.read(visitor_);
 	}
 private:
-	value_type m_value;
+	Slot<value_type> m_value;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
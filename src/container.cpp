@@ -24,6 +24,10 @@
 #include "system.h"
 #include "container.h"
 #include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
 
 namespace Rmond
 {
@@ -32,29 +36,29 @@ namespace ThreadsafeContainer
 namespace
 {
 
-Unit* getData(netsnmp_container *ct_)
+Base* getData(netsnmp_container *ct_)
 {
-	return static_cast<Unit *>(ct_->container_data);
+	return static_cast<Base *>(ct_->container_data);
 }
 
-template <typename R, R (Unit::* F)()>
+template <typename R, R (Base::* F)()>
 R delegate(netsnmp_container *ct_)
 {
-	Unit *a = getData(ct_);
+	Base *a = getData(ct_);
 	return (a->*F)();
 }
 
-template <typename R, typename V, R (Unit::* F)(V)>
+template <typename R, typename V, R (Base::* F)(V)>
 R delegate(netsnmp_container *ct_, V arg_)
 {
-	Unit *a = getData(ct_);
+	Base *a = getData(ct_);
 	return (a->*F)(arg_);
 }
 
-template <typename R, typename V1, typename V2, R (Unit::* F)(V1, V2)>
+template <typename R, typename V1, typename V2, R (Base::* F)(V1, V2)>
 R delegate(netsnmp_container *ct_, V1 arg1_, V2 arg2_)
 {
-	Unit *a = getData(ct_);
+	Base *a = getData(ct_);
 	return (a->*F)(arg1_, arg2_);
 }
 
@@ -68,6 +72,7 @@ int cfree(netsnmp_container* ct_)
 	return 0; 
 }
 
+template<class U>
 netsnmp_container* make()
 {
 	netsnmp_container *c = SNMP_MALLOC_TYPEDEF(netsnmp_container);
@@ -76,19 +81,19 @@ netsnmp_container* make()
 		return NULL;
 	}   
 	
-	c->container_data = new Unit();
+	c->container_data = new U();
 	
-	c->get_size = delegate<size_t, &Unit::size>;
+	c->get_size = delegate<size_t, &Base::size>;
 	c->init = NULL;
 	c->cfree = cfree;
-	c->insert = delegate<int, const void*, &Unit::insert>;
-	c->remove = delegate<int, const void*, &Unit::remove>;
-	c->find = delegate<void*, const void*, &Unit::find>;
-	c->find_next = delegate<void*, const void*, &Unit::findNext>;
-	c->get_subset = delegate<netsnmp_void_array*, void*, &Unit::getSubset>;
+	c->insert = delegate<int, const void*, &Base::insert>;
+	c->remove = delegate<int, const void*, &Base::remove>;
+	c->find = delegate<void*, const void*, &Base::find>;
+	c->find_next = delegate<void*, const void*, &Base::next>;
+	c->get_subset = delegate<netsnmp_void_array*, void*, &Base::getSubset>;
 	c->get_iterator = NULL;
 	c->for_each = NULL;
-	c->clear = delegate<void, netsnmp_container_obj_func*, void*, &Unit::clear>;
+	c->clear = delegate<void, netsnmp_container_obj_func*, void*, &Base::clear>;
 	
 	return c;
 }
@@ -97,16 +102,187 @@ netsnmp_factory* getFactory()
 {
 	static netsnmp_factory f = { "threadsafe_array",
 								 (netsnmp_factory_produce_f*)
-								 make };
+								 make<Unit> };
 	return &f;
 }
 
+netsnmp_factory* getFlatFactory()
+{
+	static netsnmp_factory f = { "threadsafe_flat",
+								 (netsnmp_factory_produce_f*)
+								 make<Flat> };
+	return &f;
+}
+
+netsnmp_void_array* wrap(void** array_, size_t size_)
+{
+	netsnmp_void_array* va = SNMP_MALLOC_TYPEDEF(netsnmp_void_array);
+	if (va == NULL)
+	{
+		::free(array_);
+		return NULL;
+	}
+
+	va->size = size_;
+	va->array = array_;
+	
+	return va;
+}
+
+bool precedes(const void* rhs_, const void* lhs_)
+{
+	return netsnmp_compare_netsnmp_index(rhs_, lhs_) < 0;
+}
+
+// NB. the cursor of the request the thread handles.
+__thread Cursor* g_cursor;
+
 } // anonymous namespace
 
+Base::Base(): m_generation(1)
+{
+}
+
+Base::~Base()
+{
+}
+
+void Base::dispose(void* data_, void (*deleter_)(void* ))
+{
+	retire(data_, deleter_);
+}
+
+void* Base::next(const void* key_)
+{
+	Cursor* c = Cursor::current();
+	if (NULL == c || NULL == key_)
+		return findNext(key_);
+
+	return c->next(*this, key_);
+}
+
+bool Base::prefixed(const netsnmp_index& prefix_, const void* data_)
+{
+	const netsnmp_index* x = static_cast<const netsnmp_index* >(data_);
+	if (x->len < prefix_.len)
+		return false;
+
+	return std::equal(prefix_.oids, prefix_.oids + prefix_.len, x->oids);
+}
+
+netsnmp_void_array* Base::getSubset(void* data_)
+{
+	struct Collect: Visitor
+	{
+		bool operator()(void* data_)
+		{
+			output.push_back(data_);
+			return false;
+		}
+
+		std::vector<void* > output;
+	} c;
+	visit(*static_cast<const netsnmp_index* >(data_), c);
+	if (c.output.empty())
+		return NULL;
+
+	void **rtn = static_cast<void **>(::malloc(c.output.size() * sizeof(void*)));
+	if (rtn == NULL)
+		return NULL;
+
+	std::copy(c.output.begin(), c.output.end(), rtn);
+	return wrap(rtn, c.output.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Cursor
+
+Cursor* Cursor::current()
+{
+	return g_cursor;
+}
+
+void Cursor::destroy(void* cursor_)
+{
+	delete static_cast<Cursor* >(cursor_);
+}
+
+bool Cursor::follows(size_t position_, const void* key_) const
+{
+	if (0 < position_)
+		return 0 == netsnmp_compare_netsnmp_index(m_rows[position_ - 1], key_);
+
+	netsnmp_index x = {m_origin.size(), m_origin.empty() ? NULL :
+				const_cast<oid* >(&m_origin[0])};
+	return 0 == netsnmp_compare_netsnmp_index(&x, key_);
+}
+
+void* Cursor::next(Base& container_, const void* key_)
+{
+	unsigned long long v = container_.generation();
+	if (&container_ == m_owner && v == m_generation)
+	{
+		size_t n = m_rows.size();
+		for (size_t i = m_last; i <= m_last + 1 && i <= n; ++i)
+		{
+			if (!follows(i, key_))
+				continue;
+			if (i < n)
+			{
+				m_last = i;
+				return const_cast<void *>(m_rows[i]);
+			}
+			if (m_end)
+			{
+				m_last = i;
+				return NULL;
+			}
+			// NB. the walk went past the run, take a longer one.
+			m_span = std::min<size_t>(m_span * 2, MAX_RUN);
+			break;
+		}
+	}
+	struct Collect: Visitor
+	{
+		bool operator()(void* data_)
+		{
+			output->push_back(data_);
+			return span == output->size();
+		}
+
+		size_t span;
+		std::vector<const void* >* output;
+	} c;
+	c.span = m_span;
+	c.output = &m_rows;
+	m_rows.clear();
+	container_.walk(key_, c);
+	const netsnmp_index* k = static_cast<const netsnmp_index* >(key_);
+	m_origin.assign(k->oids, k->oids + k->len);
+	m_owner = &container_;
+	m_generation = v;
+	m_last = 0;
+	m_end = m_span > m_rows.size();
+	return m_rows.empty() ? NULL : const_cast<void *>(m_rows[0]);
+}
+
+Cursor::Scope::Scope(Cursor* cursor_): m_previous(g_cursor)
+{
+	g_cursor = cursor_;
+}
+
+Cursor::Scope::~Scope()
+{
+	g_cursor = m_previous;
+}
+
 int Unit::insert(const void* data_)
 {
 	Lock g(m_lock);
-	m_data.insert(data_);
+	if (!m_data.insert(data_).second)
+		return -1;
+
+	touch();
 	return 0;
 }
 
@@ -156,6 +332,7 @@ int Unit::remove(const void* data_)
 		return -1;
 
 	m_data.erase(i);
+	touch();
 	return 0;
 }
 
@@ -163,36 +340,438 @@ void Unit::clear(netsnmp_container_obj_func* f_, void* context_)
 {
 	Lock g(m_lock);
 	m_data.clear();
+	touch();
 }
 
-netsnmp_void_array* Unit::getSubset(void* data_)
+void Unit::visit(const netsnmp_index& prefix_, Visitor& visitor_)
 {
 	Lock g(m_lock);
 
-	range_type r = std::equal_range(m_data.begin(), m_data.end(), data_, data_type::key_compare());
-	if (r.first == r.second)
-		return NULL;
+	iterator_type i = m_data.lower_bound(&prefix_);
+	for (; i != m_data.end() && prefixed(prefix_, *i); ++i)
+	{
+		if (visitor_(const_cast<void *>(*i)))
+			break;
+	}
+}
 
-	void **rtn = static_cast<void **>(::malloc(std::distance(r.first, r.second) * sizeof(void*)));
-	if (rtn == NULL)
-		return NULL;
-	
-	iterator_type i(r.first);
-	size_t z = 0;
-	for (; i != r.second; ++i)
-		rtn[z++] = const_cast<void *>(*i);
+void Unit::walk(const void* key_, Visitor& visitor_)
+{
+	Lock g(m_lock);
 
-	netsnmp_void_array* va = SNMP_MALLOC_TYPEDEF(netsnmp_void_array);
-	if (va == NULL)
+	iterator_type i = m_data.upper_bound(key_);
+	for (; i != m_data.end(); ++i)
+	{
+		if (visitor_(const_cast<void *>(*i)))
+			break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Flat::Cursor
+// NB. walks the union of the main and the pending entries in the index
+// order, skips the gone ones.
+
+struct Flat::Cursor
+{
+	Cursor(const Version& version_, const Entry* key_, bool after_);
+
+	const Entry* get();
+	void next();
+private:
+	iterator_type m_main;
+	iterator_type m_mainEnd;
+	iterator_type m_pending;
+	iterator_type m_pendingEnd;
+	iterator_type m_gone;
+	iterator_type m_goneEnd;
+	bool m_fromMain;
+};
+
+Flat::Cursor::Cursor(const Version& version_, const Entry* key_, bool after_):
+	m_main(version_.main->begin()), m_mainEnd(version_.main->end()),
+	m_pending(version_.pending.begin()), m_pendingEnd(version_.pending.end()),
+	m_gone(version_.gone.begin()), m_goneEnd(version_.gone.end()),
+	m_fromMain(false)
+{
+	if (NULL == key_)
+		return;
+
+	if (after_)
+	{
+		m_main = std::upper_bound(m_main, m_mainEnd, *key_, Less());
+		m_pending = std::upper_bound(m_pending, m_pendingEnd, *key_, Less());
+		m_gone = std::upper_bound(m_gone, m_goneEnd, *key_, Less());
+	}
+	else
 	{
-		::free(rtn);
+		m_main = std::lower_bound(m_main, m_mainEnd, *key_, Less());
+		m_pending = std::lower_bound(m_pending, m_pendingEnd, *key_, Less());
+		m_gone = std::lower_bound(m_gone, m_goneEnd, *key_, Less());
+	}
+}
+
+const Flat::Entry* Flat::Cursor::get()
+{
+	// NB. the gone entries are those of the main, the same rows in order.
+	for (; m_main != m_mainEnd && m_gone != m_goneEnd; ++m_main)
+	{
+		while (m_gone != m_goneEnd && Less()(*m_gone, *m_main))
+			++m_gone;
+		if (m_gone == m_goneEnd || m_gone->data != m_main->data)
+			break;
+	}
+	bool x = m_main != m_mainEnd, y = m_pending != m_pendingEnd;
+	if (!x && !y)
 		return NULL;
+
+	m_fromMain = x && (!y || Less()(*m_main, *m_pending));
+	return m_fromMain ? &*m_main : &*m_pending;
+}
+
+void Flat::Cursor::next()
+{
+	if (m_fromMain)
+		++m_main;
+	else
+		++m_pending;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Flat
+
+Flat::Flat(): m_current(new Version)
+{
+	m_current->main.reset(new data_type);
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+Flat::~Flat()
+{
+	retire(m_current, &destroy);
+	BOOST_FOREACH(dead_type::const_reference d, m_dead)
+	{
+		retire(d.first, d.second);
 	}
+	pthread_mutex_destroy(&m_lock);
+}
 
-	va->size = z;
-	va->array = rtn;
-	
-	return va;
+bool Flat::Less::operator()(const Entry& rhs_, const Entry& lhs_) const
+{
+	u_int n = std::min<u_int>(std::min(rhs_.len, lhs_.len), PREFIX);
+	for (u_int i = 0; i < n; ++i)
+	{
+		if (rhs_.prefix[i] != lhs_.prefix[i])
+			return rhs_.prefix[i] < lhs_.prefix[i];
+	}
+	if (PREFIX > n)
+		return rhs_.len < lhs_.len;
+
+	return netsnmp_compare_netsnmp_index(rhs_.data, lhs_.data) < 0;
+}
+
+Flat::Entry Flat::make(const void* data_)
+{
+	const netsnmp_index* x = static_cast<const netsnmp_index* >(data_);
+	Entry output = {};
+	output.data = data_;
+	output.len = x->len;
+	// NB. sub-identifiers are 32 bit wide, see RFC 2578.
+	for (u_int i = 0; i < std::min<u_int>(output.len, PREFIX); ++i)
+		output.prefix[i] = x->oids[i];
+
+	return output;
+}
+
+bool Flat::prefixed(const Entry& prefix_, const Entry& entry_)
+{
+	if (entry_.len < prefix_.len)
+		return false;
+
+	u_int n = std::min<u_int>(prefix_.len, PREFIX);
+	for (u_int i = 0; i < n; ++i)
+	{
+		if (prefix_.prefix[i] != entry_.prefix[i])
+			return false;
+	}
+	return PREFIX >= prefix_.len || Base::prefixed(
+		*static_cast<const netsnmp_index* >(prefix_.data), entry_.data);
+}
+
+Flat::iterator_type Flat::locate(const data_type& data_, const Entry& key_)
+{
+	iterator_type output = std::lower_bound(data_.begin(), data_.end(), key_, Less());
+	if (output == data_.end() || Less()(key_, *output))
+		return data_.end();
+
+	return output;
+}
+
+bool Flat::removed(const Version& version_, const Entry& entry_)
+{
+	iterator_type i = locate(version_.gone, entry_);
+	return i != version_.gone.end() && i->data == entry_.data;
+}
+
+const Flat::Entry* Flat::lookup(const Version& version_, const Entry& key_)
+{
+	iterator_type i = locate(version_.pending, key_);
+	if (i != version_.pending.end())
+		return &*i;
+
+	i = locate(*version_.main, key_);
+	return i == version_.main->end() || removed(version_, *i) ? NULL : &*i;
+}
+
+void Flat::rebuild(Version& version_)
+{
+	if (version_.pending.size() < PENDING && version_.gone.size() < PENDING)
+		return;
+
+	data_type* x = new data_type;
+	x->reserve(version_.main->size() + version_.pending.size() -
+		version_.gone.size());
+	Cursor c(version_, NULL, false);
+	for (const Entry* e; NULL != (e = c.get()); c.next())
+		x->push_back(*e);
+
+	version_.main.reset(x);
+	version_.pending.clear();
+	version_.gone.clear();
+}
+
+void Flat::destroy(void* version_)
+{
+	delete static_cast<Version* >(version_);
+}
+
+const Flat::Version& Flat::current() const
+{
+	return *__atomic_load_n(&m_current, __ATOMIC_SEQ_CST);
+}
+
+void Flat::publish(Version* version_)
+{
+	Version* x = __atomic_exchange_n(&m_current, version_, __ATOMIC_SEQ_CST);
+	touch();
+	retire(x, &destroy);
+	if (!version_->gone.empty())
+		return;
+
+	// NB. a reader that still sees a gone entry holds the epoch of the
+	// retired version, thus the rows go after it.
+	BOOST_FOREACH(dead_type::const_reference d, m_dead)
+	{
+		retire(d.first, d.second);
+	}
+	m_dead.clear();
+}
+
+int Flat::insert(const void* data_)
+{
+	Lock g(m_lock);
+
+	Entry e = make(data_);
+	if (NULL != lookup(*m_current, e))
+		return -1;
+
+	Version* v = new Version(*m_current);
+	v->pending.insert(std::upper_bound(v->pending.begin(), v->pending.end(), e, Less()), e);
+	rebuild(*v);
+	publish(v);
+	return 0;
+}
+
+void* Flat::find(const void* key_)
+{
+	Guard g;
+
+	const Entry* e = lookup(current(), make(key_));
+	return NULL == e ? NULL : const_cast<void *>(e->data);
+}
+
+void* Flat::findNext(const void* key_)
+{
+	Guard g;
+
+	Entry k = {};
+	if (key_ != NULL)
+		k = make(key_);
+
+	Cursor c(current(), key_ == NULL ? NULL : &k, true);
+	const Entry* e = c.get();
+	return NULL == e ? NULL : const_cast<void *>(e->data);
+}
+
+size_t Flat::size()
+{
+	Guard g;
+
+	const Version& v = current();
+	return v.main->size() + v.pending.size() - v.gone.size();
+}
+
+int Flat::remove(const void* data_)
+{
+	Lock g(m_lock);
+
+	const Version& c = *m_current;
+	if (c.main->empty() && c.pending.empty())
+		return 0;
+
+	Entry e = make(data_);
+	iterator_type i = locate(c.pending, e);
+	if (i != c.pending.end())
+	{
+		Version* v = new Version(c);
+		v->pending.erase(v->pending.begin() + (i - c.pending.begin()));
+		publish(v);
+		return 0;
+	}
+	i = locate(*c.main, e);
+	if (i == c.main->end() || removed(c, *i))
+		return -1;
+
+	Version* v = new Version(c);
+	v->gone.insert(std::upper_bound(v->gone.begin(), v->gone.end(), *i, Less()), *i);
+	rebuild(*v);
+	publish(v);
+	return 0;
+}
+
+void Flat::dispose(void* data_, void (*deleter_)(void* ))
+{
+	Lock g(m_lock);
+
+	if (removed(*m_current, make(data_)))
+		m_dead.push_back(std::make_pair(data_, deleter_));
+	else
+		retire(data_, deleter_);
+}
+
+void Flat::clear(netsnmp_container_obj_func* f_, void* context_)
+{
+	Lock g(m_lock);
+
+	Version* v = new Version;
+	v->main.reset(new data_type);
+	publish(v);
+}
+
+void Flat::walk(const void* key_, Visitor& visitor_)
+{
+	Guard g;
+
+	Entry k = make(key_);
+	Cursor c(current(), &k, true);
+	for (const Entry* e; NULL != (e = c.get()); c.next())
+	{
+		if (visitor_(const_cast<void *>(e->data)))
+			break;
+	}
+}
+
+void Flat::visit(const netsnmp_index& prefix_, Visitor& visitor_)
+{
+	Guard g;
+
+	Entry k = make(&prefix_);
+	Cursor c(current(), &k, false);
+	for (const Entry* e; NULL != (e = c.get()) && prefixed(k, *e); c.next())
+	{
+		if (visitor_(const_cast<void *>(e->data)))
+			break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Groups
+
+Groups::Groups()
+{
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+Groups::~Groups()
+{
+	pthread_mutex_destroy(&m_lock);
+}
+
+size_t Groups::Hash::operator()(const key_type& key_) const
+{
+	return boost::hash_range(key_.begin(), key_.end());
+}
+
+size_t Groups::Hash::operator()(const netsnmp_index& key_) const
+{
+	return boost::hash_range(key_.oids, key_.oids + key_.len);
+}
+
+bool Groups::Equal::operator()(const netsnmp_index& rhs_, const key_type& lhs_) const
+{
+	return rhs_.len == lhs_.size() &&
+		std::equal(rhs_.oids, rhs_.oids + rhs_.len, lhs_.begin());
+}
+
+void Groups::insert(size_t span_, const void* data_)
+{
+	const netsnmp_index* x = (const netsnmp_index* )data_;
+	if (span_ > x->len)
+		return;
+
+	Lock g(m_lock);
+	rows_type& r = m_data[key_type(x->oids, x->oids + span_)];
+	r.insert(std::upper_bound(r.begin(), r.end(), data_, &precedes), data_);
+}
+
+void Groups::remove(size_t span_, const void* data_)
+{
+	const netsnmp_index* x = (const netsnmp_index* )data_;
+	if (span_ > x->len)
+		return;
+
+	netsnmp_index k = {span_, x->oids};
+	Lock g(m_lock);
+	data_type::iterator p = m_data.find(k, Hash(), Equal());
+	if (m_data.end() == p)
+		return;
+
+	rows_type& r = p->second;
+	rows_type::iterator i = std::lower_bound(r.begin(), r.end(), data_, &precedes);
+	for (; i != r.end() && *i != data_; ++i);
+	if (i != r.end())
+		r.erase(i);
+	if (r.empty())
+		m_data.erase(p);
+}
+
+void Groups::visit(const netsnmp_index& prefix_, Visitor& visitor_)
+{
+	// NB. the rows are copied out so that the visitor runs without the
+	// lock, a removed row is retired and outlives the Guard of the caller.
+	rows_type x;
+	{
+		Lock g(m_lock);
+		data_type::const_iterator p = m_data.find(prefix_, Hash(), Equal());
+		if (m_data.end() == p)
+			return;
+
+		x = p->second;
+	}
+	BOOST_FOREACH(const void* r, x)
+	{
+		if (visitor_(const_cast<void *>(r)))
+			break;
+	}
+}
+
+const char* backend()
+{
+	const char* output = getenv("RMOND_CONTAINER");
+	if (NULL == output || 0 != strcmp(output, getFlatFactory()->product))
+		return getFactory()->product;
+
+	return output;
 }
 
 void inject()
@@ -202,6 +781,11 @@ void inject()
 			getFactory(),
 			netsnmp_compare_netsnmp_index);
 	snmp_log(LOG_ERR, LOG_PREFIX"register with compare: %d\n", ret);
+	ret = 
+	netsnmp_container_register_with_compare("threadsafe_flat",
+			getFlatFactory(),
+			netsnmp_compare_netsnmp_index);
+	snmp_log(LOG_ERR, LOG_PREFIX"register flat with compare: %d\n", ret);
 }
 
 } // namespace ThreadsafeContainer
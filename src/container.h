@@ -27,17 +27,131 @@
 #include <net-snmp/net-snmp-config.h>
 #include <net-snmp/net-snmp-includes.h>
 #include <set>
+#include <vector>
 #include <iterator>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include "epoch.h"
 
 namespace Rmond
 {
 namespace ThreadsafeContainer
 {
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Visitor
+
+struct Visitor
+{
+	// NB. returns true to stop the walk.
+	virtual bool operator()(void* data_) = 0;
+protected:
+	~Visitor()
+	{
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Base
+
+struct Base
+{
+	Base();
+	virtual ~Base();
+
+	// NB. walks the rows whose index starts with prefix_ in the index
+	// order. the walk may hold the container lock, thus the visitor must
+	// not call back into the container.
+	virtual void visit(const netsnmp_index& prefix_, Visitor& visitor_) = 0;
+	// NB. walks the rows after key_ in the index order.
+	virtual void walk(const void* key_, Visitor& visitor_) = 0;
+	netsnmp_void_array* getSubset(void* data_);
+	// NB. findNext through the Cursor of the calling thread if there is
+	// one.
+	void* next(const void* key_);
+
+	// NB. non-zero when a row with the same index is there already.
+	virtual int insert(const void* data_) = 0;
+	virtual void* find(const void* key_) = 0;
+	virtual void* findNext(const void* key_) = 0;
+	virtual size_t size() = 0;
+	virtual int remove(const void* data_) = 0;
+	virtual void clear(netsnmp_container_obj_func* f_, void* context_) = 0;
+	// NB. reclaims a removed row through the epochs once the container
+	// does not refer to it either.
+	virtual void dispose(void* data_, void (*deleter_)(void* ));
+
+	static bool prefixed(const netsnmp_index& prefix_, const void* data_);
+	unsigned long long generation() const
+	{
+		return __atomic_load_n(&m_generation, __ATOMIC_ACQUIRE);
+	}
+
+protected:
+	// NB. every change of the rows must be followed by this.
+	void touch()
+	{
+		__atomic_add_fetch(&m_generation, 1, __ATOMIC_RELEASE);
+	}
+
+private:
+	unsigned long long m_generation;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Cursor
+// NB. the rows that follow the key of the last miss, kept for one agent
+// request. a GETBULK repetition asks for the row after the one it got the
+// time before, and all the varbinds of a repetition ask for the same row.
+// both are answered from here without a search while the rows stay put.
+// the run grows while the walk keeps to it. the table puts the cursor into
+// the data list of the request and makes it the one of the thread for the
+// handlers below, thus it needs no lock.
+
+struct Cursor: boost::noncopyable
+{
+	Cursor(): m_owner(), m_generation(), m_last(), m_span(MIN_RUN), m_end()
+	{
+	}
+
+	void* next(Base& container_, const void* key_);
+	static Cursor* current();
+	static void destroy(void* cursor_);
+
+	///////////////////////////////////////////////////////////////////////
+	// struct Scope
+
+	struct Scope: boost::noncopyable
+	{
+		explicit Scope(Cursor* cursor_);
+		~Scope();
+	private:
+		Cursor* m_previous;
+	};
+
+private:
+	enum
+	{
+		MIN_RUN = 4,
+		MAX_RUN = 256
+	};
+
+	bool follows(size_t position_, const void* key_) const;
+
+	const Base* m_owner;
+	unsigned long long m_generation;
+	std::vector<oid> m_origin;
+	std::vector<const void* > m_rows;
+	size_t m_last;
+	size_t m_span;
+	bool m_end;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Unit
 
-struct Unit
+struct Unit: Base
 {
 	int insert(const void* data_);
 	void* find(const void* key_);
@@ -45,7 +159,8 @@ struct Unit
 	size_t size();
 	int remove(const void* data_);
 	void clear(netsnmp_container_obj_func* f_, void* context_);
-	netsnmp_void_array* getSubset(void* data_);
+	void visit(const netsnmp_index& prefix_, Visitor& visitor_);
+	void walk(const void* key_, Visitor& visitor_);
 
 private:
 	typedef const void *value_type;
@@ -64,6 +179,128 @@ private:
 	pthread_mutex_t m_lock;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Flat
+// NB. a sorted vector of cache line sized entries that keep the leading
+// sub-identifiers of the row index inline, so that comparisons reach into
+// the row only when the prefixes tie. inserts go to a small sorted side
+// vector which is merged into the main one when it fills up. a removal of
+// a main entry leaves it in place and adds it to a sorted side vector of
+// the gone ones, the main is rebuilt without them when that one fills up.
+// the comparisons read the row, thus the rows of the gone entries are
+// disposed of only after the rebuild. readers take no lock: every change
+// publishes a new immutable version and retires the previous one through
+// the epochs.
+
+struct Flat: Base
+{
+	Flat();
+	~Flat();
+
+	int insert(const void* data_);
+	void* find(const void* key_);
+	void* findNext(const void* key_);
+	size_t size();
+	int remove(const void* data_);
+	void clear(netsnmp_container_obj_func* f_, void* context_);
+	void visit(const netsnmp_index& prefix_, Visitor& visitor_);
+	void walk(const void* key_, Visitor& visitor_);
+	void dispose(void* data_, void (*deleter_)(void* ));
+
+private:
+	enum
+	{
+		PREFIX = 12,
+		PENDING = 256
+	};
+	struct Entry
+	{
+		const void* data;
+		u_int len;
+		u_int prefix[PREFIX];
+	};
+	struct Less
+	{
+		bool operator()(const Entry& rhs_, const Entry& lhs_) const;
+	};
+	typedef std::vector<Entry> data_type;
+	typedef data_type::const_iterator iterator_type;
+	struct Version
+	{
+		boost::shared_ptr<const data_type> main;
+		data_type pending;
+		// NB. the entries of the main removed since it was built.
+		data_type gone;
+	};
+	struct Cursor;
+	typedef std::vector<std::pair<void*, void (*)(void* )> > dead_type;
+
+	static Entry make(const void* data_);
+	static bool prefixed(const Entry& prefix_, const Entry& entry_);
+	static iterator_type locate(const data_type& data_, const Entry& key_);
+	static bool removed(const Version& version_, const Entry& entry_);
+	static const Entry* lookup(const Version& version_, const Entry& key_);
+	static void rebuild(Version& version_);
+	static void destroy(void* version_);
+	const Version& current() const;
+	void publish(Version* version_);
+
+	Version* m_current;
+	// NB. the removed rows the gone entries still refer to.
+	dead_type m_dead;
+	pthread_mutex_t m_lock;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Groups
+// NB. a secondary index over the rows of a container that share the leading
+// sub-identifiers of the index, e.g. all the disks of a VE. a walk over a
+// group touches only the rows of the group instead of searching the
+// whole container.
+
+struct Groups: boost::noncopyable
+{
+	Groups();
+	~Groups();
+
+	// NB. span_ is the number of the leading sub-identifiers that name
+	// the group of the row.
+	void insert(size_t span_, const void* data_);
+	void remove(size_t span_, const void* data_);
+	// NB. walks the rows of the group named by prefix_ in the index order
+	// as they were at the start. the caller must hold a Guard, the visitor
+	// runs without the lock and may change the groups.
+	void visit(const netsnmp_index& prefix_, Visitor& visitor_);
+
+private:
+	typedef std::vector<oid> key_type;
+	typedef std::vector<const void* > rows_type;
+	struct Hash
+	{
+		size_t operator()(const key_type& key_) const;
+		size_t operator()(const netsnmp_index& key_) const;
+	};
+	struct Equal
+	{
+		bool operator()(const key_type& rhs_, const key_type& lhs_) const
+		{
+			return rhs_ == lhs_;
+		}
+		bool operator()(const netsnmp_index& rhs_, const key_type& lhs_) const;
+		bool operator()(const key_type& rhs_, const netsnmp_index& lhs_) const
+		{
+			return (*this)(lhs_, rhs_);
+		}
+	};
+	typedef boost::unordered_map<key_type, rows_type, Hash, Equal> data_type;
+
+	data_type m_data;
+	pthread_mutex_t m_lock;
+};
+
+// NB. the factory to use for the tables, threadsafe_array unless the
+// RMOND_CONTAINER environment variable names another one.
+const char* backend();
 void inject();
 
 } // namespace ThreadsafeContainer
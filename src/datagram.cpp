@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "datagram.h"
+#include <errno.h>
+
+namespace Rmond
+{
+///////////////////////////////////////////////////////////////////////////////
+// struct Datagram
+
+size_t Datagram::send(int socket_, const sockaddr_in& peer_,
+	std::vector<std::vector<u_char> >& frames_, size_t size_)
+{
+	m_vectors.resize(size_);
+	m_headers.resize(size_);
+	for (size_t i = 0; i < size_; ++i)
+	{
+		m_vectors[i].iov_base = &frames_[i][0];
+		m_vectors[i].iov_len = frames_[i].size();
+		m_headers[i] = mmsghdr();
+		m_headers[i].msg_hdr.msg_name = (void* )&peer_;
+		m_headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+		m_headers[i].msg_hdr.msg_iov = &m_vectors[i];
+		m_headers[i].msg_hdr.msg_iovlen = 1;
+	}
+	m_calls = 0;
+	for (size_t i = 0; i < size_; ++m_calls)
+	{
+		int n = sendmmsg(socket_, &m_headers[i], size_ - i, 0);
+		if (0 < n)
+			i += n;
+		else if (EINTR != errno)
+			return size_ - i;
+	}
+	return 0;
+}
+
+} // namespace Rmond
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef DATAGRAM_H
+#define DATAGRAM_H
+#include <vector>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+namespace Rmond
+{
+///////////////////////////////////////////////////////////////////////////////
+// struct Datagram
+// NB. sends frames to a UDP peer with as few sendmmsg calls as it can. the
+// trap batches and the trap benchmark share it.
+
+struct Datagram
+{
+	Datagram(): m_calls()
+	{
+	}
+
+	// NB. returns the number of the frames that did not go, errno tells
+	// why.
+	size_t send(int socket_, const sockaddr_in& peer_,
+		std::vector<std::vector<u_char> >& frames_, size_t size_);
+	// NB. the system calls of the last send.
+	unsigned calls() const
+	{
+		return m_calls;
+	}
+private:
+	unsigned m_calls;
+	std::vector<iovec> m_vectors;
+	std::vector<mmsghdr> m_headers;
+};
+
+} // namespace Rmond
+
+#endif // DATAGRAM_H
@@ -23,6 +23,7 @@
 
 #include "details.h"
 #include "handler.h"
+#include <algorithm>
 
 namespace Rmond
 {
@@ -38,6 +39,26 @@ Oid_type Schema<void>::uuid(Oid_type::value_type luid_)
 
 namespace Table
 {
+///////////////////////////////////////////////////////////////////////////////
+// struct Census
+
+unsigned long long Census::s_data[Census::KINDS];
+
+void Census::report()
+{
+	static unsigned long long s_last[KINDS];
+	unsigned long long x[KINDS];
+	for (int i = 0; i < KINDS; ++i)
+	{
+		x[i] = __atomic_load_n(&s_data[i], __ATOMIC_RELAXED);
+	}
+	DEBUGMSGTL((TOKEN_PREFIX"alloc", "slab %llu, released %llu, heap %llu, "
+		"live %llu, trap buffers %llu, trees %llu\n", x[SLAB] - s_last[SLAB],
+		x[RELEASE] - s_last[RELEASE], x[HEAP] - s_last[HEAP],
+		x[SLAB] - x[RELEASE], x[GROW] - s_last[GROW], x[TREE] - s_last[TREE]));
+	std::copy(x, x + KINDS, s_last);
+}
+
 namespace Request
 {
 ///////////////////////////////////////////////////////////////////////////////
@@ -69,6 +90,7 @@ void Details::cannot(int code_)
 }
 
 } // namespace Request
+
 } // namespace Table
 } // namespace Rmond
 
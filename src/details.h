@@ -25,6 +25,7 @@
 #define DETAILS_H
 #include "asn.h"
 #include <boost/mpl/find.hpp>
+#include <boost/mpl/front.hpp>
 #include <boost/mpl/size.hpp>
 #include <boost/mpl/quote.hpp>
 #include <boost/mpl/vector.hpp>
@@ -231,22 +232,38 @@ struct Set: private B
 		static_cast<const typename Column<U, N>::type* >(this)->get(dst_);
 	}
 	template<class U, U N>
+	bool encode(oid*& dst_, const oid* end_) const
+	{
+		return static_cast<const typename Column<U, N>::type* >(this)->encode(dst_, end_);
+	}
+	template<class U, U N>
+	bool build(const oid* name_, size_t length_, u_char*& dst_, size_t& left_) const
+	{
+		return static_cast<const typename Column<U, N>::type* >(this)->build(name_, length_, dst_, left_);
+	}
+	template<class U, U N>
 	typename Column<U, N>::type::value_type get() const
 	{
 		return static_cast<const typename Column<U, N>::type* >(this)->get();
 	}
+	template<class U, U N, class F>
+	void read(F& visitor_) const
+	{
+		static_cast<const typename Column<U, N>::type* >(this)->read(visitor_);
+	}
+	// NB. the puts return true if the value has changed.
 	template<T N>
-	void put(const typename Column<T, N>::type::value_type& value_)
+	bool put(const typename Column<T, N>::type::value_type& value_)
 	{
 		return static_cast<typename Column<T, N>::type* >(this)->put(value_);
 	}
 	template<T N>
-	void put(const netsnmp_variable_list& value_)
+	bool put(const netsnmp_variable_list& value_)
 	{
-		static_cast<typename Column<T, N>::type* >(this)->put(value_);
+		return static_cast<typename Column<T, N>::type* >(this)->put(value_);
 	}
 	template<class U, U N>
-	void put(const typename Column<U, N>::type::value_type& value_)
+	bool put(const typename Column<U, N>::type::value_type& value_)
 	{
 		return static_cast<typename Column<U, N>::type* >(this)->put(value_);
 	}
@@ -316,6 +333,43 @@ private:
 	netsnmp_variable_list* m_list;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Group
+// NB. the rows of a table with a composite index are grouped by the leading
+// index column, e.g. the VEID of the disks, the networks and the CPUs.
+
+template<class T>
+struct Group
+{
+	typedef typename Key<T>::seq_type seq_type;
+	typedef typename mpl::front<seq_type>::type head_type;
+	enum
+	{
+		ENABLED = (1 < mpl::size<seq_type>::value),
+		ASN_TYPE = Column<typename head_type::value_type,
+				head_type::value>::type::ASN_TYPE
+	};
+
+	// NB. the number of the sub-identifiers the leading column takes in
+	// the index, 0 for a malformed one.
+	static size_t span(const netsnmp_index& key_)
+	{
+		if (0 == key_.len)
+			return 0;
+
+		switch ((int)ASN_TYPE)
+		{
+		case ASN_OCTET_STR:
+		case ASN_OBJECT_ID:
+			return key_.oids[0] < key_.len ? 1 + key_.oids[0] : 0;
+		case ASN_IPADDRESS:
+			return 4 > key_.len ? 0 : 4;
+		default:
+			return 1;
+		}
+	}
+};
+
 } // namespace Index
 
 namespace Dispatcher
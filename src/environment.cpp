@@ -68,18 +68,14 @@ void Environment::refresh(PRL_HANDLE performance_)
 	}
 }
 
-Value::Provider* Environment::snapshot(const Value::Metrix_type& metrix_) const
+void Environment::stream(const Value::Filter& filter_, Value::Stream& dst_) const
 {
-	Value::List* output = new Value::List;
 	providerList_type::const_iterator e = m_providerList.end();
 	providerList_type::const_iterator p = m_providerList.begin();
 	for (; p != e; ++p)
 	{
-		Value::Provider* y = p->snapshot(metrix_);
-		if (NULL != y)
-			output->push_back(y);
+		p->stream(filter_, dst_);
 	}
-	return output;
 }
 
 } // namespace Rmond
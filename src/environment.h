@@ -30,13 +30,13 @@ namespace Rmond
 ///////////////////////////////////////////////////////////////////////////////
 // struct Environment
 
-struct Environment: Value::Composite::Base, Value::Storage
+struct Environment: Value::Storage
 {
 	explicit Environment(PRL_HANDLE h_);
 	virtual ~Environment();
 
 	void refresh(PRL_HANDLE performance_);
-	Value::Provider* snapshot(const Value::Metrix_type& metrix_) const;
+	void stream(const Value::Filter& filter_, Value::Stream& dst_) const;
 
 	virtual void pullState() = 0;
 	virtual void pullUsage() = 0;
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "epoch.h"
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <boost/foreach.hpp>
+
+namespace Rmond
+{
+namespace ThreadsafeContainer
+{
+namespace
+{
+///////////////////////////////////////////////////////////////////////////////
+// epochs
+
+enum
+{
+	MAX_READERS = 64
+};
+
+// NB. a slot per reader thread, each on its own cache line. zero means out
+// of a read section, otherwise the epoch of the section entrance.
+struct Slot
+{
+	unsigned long long epoch;
+	char pad[64 - sizeof(unsigned long long)];
+};
+
+struct Retired
+{
+	void* data;
+	void (*deleter)(void* );
+	unsigned long long epoch;
+};
+
+Slot s_slots[MAX_READERS];
+int s_claimed;
+// NB. the readers beyond MAX_READERS share this counter and block all the
+// reclamation while any of them is in.
+unsigned s_overflow;
+unsigned long long s_epoch = 1;
+pthread_mutex_t s_retiredLock = PTHREAD_MUTEX_INITIALIZER;
+__thread int t_slot = -1;
+__thread unsigned t_depth;
+
+// NB. never destroyed for the tables may go away during the static
+// destruction.
+std::vector<Retired>& retired()
+{
+	static std::vector<Retired>* s = new std::vector<Retired>;
+	return *s;
+}
+
+// NB. the oldest epoch still in a read section.
+unsigned long long horizon()
+{
+	if (0 != __atomic_load_n(&s_overflow, __ATOMIC_SEQ_CST))
+		return 0;
+
+	unsigned long long output = ~0ULL;
+	int n = std::min<int>(__atomic_load_n(&s_claimed, __ATOMIC_SEQ_CST), MAX_READERS);
+	for (int i = 0; i < n; ++i)
+	{
+		unsigned long long e = __atomic_load_n(&s_slots[i].epoch, __ATOMIC_SEQ_CST);
+		if (0 != e)
+			output = std::min(output, e);
+	}
+	return output;
+}
+
+struct Pending
+{
+	explicit Pending(unsigned long long horizon_): m_horizon(horizon_)
+	{
+	}
+
+	bool operator()(const Retired& retired_) const
+	{
+		return retired_.epoch > m_horizon;
+	}
+private:
+	unsigned long long m_horizon;
+};
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Guard
+
+Guard::Guard()
+{
+	if (0 != t_depth++)
+		return;
+
+	if (0 > t_slot)
+		t_slot = std::min<int>(__atomic_fetch_add(&s_claimed, 1, __ATOMIC_SEQ_CST), MAX_READERS);
+	if (MAX_READERS > t_slot)
+	{
+		__atomic_store_n(&s_slots[t_slot].epoch,
+			__atomic_load_n(&s_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+	}
+	else
+		__atomic_add_fetch(&s_overflow, 1, __ATOMIC_SEQ_CST);
+}
+
+Guard::~Guard()
+{
+	if (0 != --t_depth)
+		return;
+
+	if (MAX_READERS > t_slot)
+		__atomic_store_n(&s_slots[t_slot].epoch, 0, __ATOMIC_SEQ_CST);
+	else
+		__atomic_sub_fetch(&s_overflow, 1, __ATOMIC_SEQ_CST);
+}
+
+void retire(void* data_, void (*deleter_)(void* ))
+{
+	Retired x = {data_, deleter_,
+		__atomic_add_fetch(&s_epoch, 1, __ATOMIC_SEQ_CST)};
+	std::vector<Retired> g;
+	pthread_mutex_lock(&s_retiredLock);
+	std::vector<Retired>& r = retired();
+	r.push_back(x);
+	std::vector<Retired>::iterator p = std::partition(r.begin(),
+		r.end(), Pending(horizon()));
+	g.assign(p, r.end());
+	r.erase(p, r.end());
+	pthread_mutex_unlock(&s_retiredLock);
+	// NB. the deleters run out of the critical section as they may retire
+	// something themselves.
+	BOOST_FOREACH(const Retired& r, g)
+	{
+		r.deleter(r.data);
+	}
+}
+
+} // namespace ThreadsafeContainer
+} // namespace Rmond
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <boost/noncopyable.hpp>
+
+namespace Rmond
+{
+namespace ThreadsafeContainer
+{
+///////////////////////////////////////////////////////////////////////////////
+// struct Guard
+// NB. an epoch read section. rows and versions retired while a section is
+// open are reclaimed only after it is closed. sections nest.
+
+struct Guard: boost::noncopyable
+{
+	Guard();
+	~Guard();
+};
+
+// NB. calls deleter_(data_) once every read section open at the moment of
+// the call is closed.
+void retire(void* data_, void (*deleter_)(void* ));
+
+} // namespace ThreadsafeContainer
+} // namespace Rmond
+
+#endif // EPOCH_H
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "export.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <boost/foreach.hpp>
+
+namespace Rmond
+{
+namespace Export
+{
+namespace
+{
+enum
+{
+	// NB. the records of a table start on a cache line.
+	ALIGNMENT = 64
+};
+
+size_t align(size_t value_)
+{
+	return (value_ + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+}
+
+} // namespace
+
+Oid_type uuid(Host::PROPERTY )
+{
+	return Central::product();
+}
+
+Oid_type prefix(Host::PROPERTY )
+{
+	return Central::product();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Region
+
+Region::~Region()
+{
+	if (NULL != m_data)
+		munmap(m_data, m_size);
+}
+
+// NB. the file is prepared aside and renamed over the path, so that a
+// reader never maps a half written header.
+bool Region::create(const std::string& path_, const tableList_type& tables_,
+	const columnList_type& columns_)
+{
+	size_t z = align(sizeof(export_header) + tables_.size() * sizeof(export_table) +
+			columns_.size() * sizeof(export_column));
+	tableList_type t(tables_);
+	BOOST_FOREACH(export_table& x, t)
+	{
+		x.offset = z;
+		z = align(z + (size_t)x.capacity * x.record_size);
+	}
+	std::string n = path_ + ".new";
+	unlink(n.c_str());
+	int f = open(n.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (-1 == f)
+	{
+		snmp_log(LOG_ERR, LOG_PREFIX"cannot create the export file %s: %s\n",
+			n.c_str(), strerror(errno));
+		return true;
+	}
+	void* m = MAP_FAILED;
+	if (0 == ftruncate(f, z))
+		m = mmap(NULL, z, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+	close(f);
+	if (MAP_FAILED == m)
+	{
+		snmp_log(LOG_ERR, LOG_PREFIX"cannot map the export file %s: %s\n",
+			n.c_str(), strerror(errno));
+		unlink(n.c_str());
+		return true;
+	}
+	export_header* h = (export_header* )m;
+	memcpy(h->magic, EXPORT_MAGIC, EXPORT_MAGIC_SIZE);
+	h->version = EXPORT_VERSION;
+	h->size = z;
+	h->tables = t.size();
+	h->columns = columns_.size();
+	export_table* a = (export_table* )(h + 1);
+	std::copy(t.begin(), t.end(), a);
+	std::copy(columns_.begin(), columns_.end(), (export_column* )(a + t.size()));
+	if (0 != rename(n.c_str(), path_.c_str()))
+	{
+		snmp_log(LOG_ERR, LOG_PREFIX"cannot publish the export file %s: %s\n",
+			path_.c_str(), strerror(errno));
+		munmap(m, z);
+		unlink(n.c_str());
+		return true;
+	}
+	m_data = (u_char* )m;
+	m_size = z;
+	return false;
+}
+
+export_record* Region::record(unsigned table_, size_t slot_) const
+{
+	const export_table& t = ((const export_table* )(m_data + sizeof(export_header)))[table_];
+	return (export_record* )(m_data + t.offset + slot_ * t.record_size);
+}
+
+// NB. the writer side of the record seqlock. the scheduler thread is the
+// only writer, thus it reads the record plainly and skips a write that
+// would change nothing.
+void Region::write(unsigned table_, size_t slot_, const netsnmp_index& key_,
+	const uint64_t* values_, const Pass& pass_)
+{
+	export_record* r = record(table_, slot_);
+	const export_table& t = ((const export_table* )(m_data + sizeof(export_header)))[table_];
+	uint64_t* v = (uint64_t* )(r + 1);
+	bool s = 0 != (r->flags & EXPORT_RECORD_LIVE) && r->key_size == key_.len &&
+		std::equal(values_, values_ + t.columns, v);
+	for (size_t i = 0; s && i < key_.len; ++i)
+		s = r->key[i] == (uint32_t)key_.oids[i];
+	if (s)
+		return;
+
+	uint32_t q = r->sequence;
+	__atomic_store_n(&r->sequence, q + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&r->flags, (uint32_t)EXPORT_RECORD_LIVE, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->stamp, (uint64_t)pass_.stamp, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->key_size, (uint32_t)key_.len, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < key_.len; ++i)
+		__atomic_store_n(r->key + i, (uint32_t)key_.oids[i], __ATOMIC_RELAXED);
+	for (size_t i = 0; i < t.columns; ++i)
+		__atomic_store_n(v + i, values_[i], __ATOMIC_RELAXED);
+	__atomic_store_n(&r->sequence, q + 2, __ATOMIC_RELEASE);
+}
+
+void Region::clear(unsigned table_, size_t slot_)
+{
+	export_record* r = record(table_, slot_);
+	uint32_t q = r->sequence;
+	__atomic_store_n(&r->sequence, q + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&r->flags, (uint32_t)0, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->key_size, (uint32_t)0, __ATOMIC_RELAXED);
+	__atomic_store_n(&r->sequence, q + 2, __ATOMIC_RELEASE);
+}
+
+void Region::finish(const Pass& pass_)
+{
+	export_header* h = (export_header* )m_data;
+	__atomic_store_n(&h->stamp, (uint64_t)pass_.stamp, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->generation, (uint64_t)pass_.generation, __ATOMIC_RELEASE);
+}
+
+void Region::retire()
+{
+	export_header* h = (export_header* )m_data;
+	__atomic_store_n(&h->retired, (uint32_t)1, __ATOMIC_RELEASE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Unit
+
+Unit::Unit(const std::string& path_): m_path(path_), m_generation(),
+	m_host(1), m_ve(CAPACITY), m_disk(4 * CAPACITY), m_network(4 * CAPACITY),
+	m_cpu(8 * CAPACITY), m_linux(CAPACITY)
+{
+}
+
+bool Unit::create()
+{
+	tableList_type t;
+	columnList_type c;
+	m_host.describe(t, c);
+	m_ve.describe(t, c);
+	m_disk.describe(t, c);
+	m_network.describe(t, c);
+	m_cpu.describe(t, c);
+	m_linux.describe(t, c);
+	std::auto_ptr<Region> x(new Region);
+	if (x->create(m_path, t, c))
+		return true;
+
+	if (NULL != m_region.get())
+		m_region->retire();
+
+	m_region = x;
+	m_host.attach();
+	m_ve.attach();
+	m_disk.attach();
+	m_network.attach();
+	m_cpu.attach();
+	m_linux.attach();
+	return false;
+}
+
+// NB. returns true if a table has outgrown the file.
+bool Unit::pass(const Host::space_type& host_, const VE::space_type& ves_)
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	Pass p = {++m_generation, t.tv_sec * 1000000000ULL + t.tv_nsec};
+	Host::tupleSP_type h = host_.get<0>();
+	if (NULL != h.get())
+	{
+		netsnmp_index k = {};
+		m_host.put(*h, k, *m_region, p);
+	}
+	m_ve.publish(*ves_.get<0>(), *m_region, p);
+	m_disk.publish(*ves_.get<1>(), *m_region, p);
+	m_network.publish(*ves_.get<2>(), *m_region, p);
+	m_cpu.publish(*ves_.get<3>(), *m_region, p);
+	m_linux.publish(*ves_.get<4>(), *m_region, p);
+	m_region->finish(p);
+
+	bool output = m_host.grow();
+	output = m_ve.grow() || output;
+	output = m_disk.grow() || output;
+	output = m_network.grow() || output;
+	output = m_cpu.grow() || output;
+	output = m_linux.grow() || output;
+	return output;
+}
+
+void Unit::publish(const Host::space_type& host_, const VE::space_type& ves_)
+{
+	timespec b, e;
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	if (NULL == m_region.get() && create())
+		return;
+
+	if (pass(host_, ves_))
+	{
+		// NB. the rows that did not fit go to a bigger file at once.
+		DEBUGMSGTL((TOKEN_PREFIX"export", "grow %s\n", m_path.c_str()));
+		if (!create())
+			pass(host_, ves_);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &e);
+	DEBUGMSGTL((TOKEN_PREFIX"export", "pass %llu in %ld ns\n", m_generation,
+		(long)((e.tv_sec - b.tv_sec) * 1000000000L + e.tv_nsec - b.tv_nsec)));
+}
+
+UnitSP Unit::inject()
+{
+	const char* x = getenv("RMOND_EXPORT");
+	if (NULL == x || '\0' == *x)
+		return UnitSP();
+
+	UnitSP output(new Unit(x));
+	if (output->create())
+		return UnitSP();
+
+	return output;
+}
+
+} // namespace Export
+} // namespace Rmond
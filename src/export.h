@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+#include "ve.h"
+#include "host.h"
+#include "layout.h"
+#include <boost/unordered_map.hpp>
+
+namespace Rmond
+{
+namespace Export
+{
+typedef std::vector<export_table> tableList_type;
+typedef std::vector<export_column> columnList_type;
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Numeric
+
+struct Numeric
+{
+	template<class U>
+	struct apply
+	{
+		typedef mpl::bool_<ASN_OCTET_STR != U::asn_type::value &&
+			ASN_OBJECT_ID != U::asn_type::value &&
+			ASN_IPADDRESS != U::asn_type::value> type;
+	};
+};
+
+template<int D>
+uint64_t widen(int value_)
+{
+	// NB. the same widening as Policy::Integer does.
+	return ASN_INTEGER == D ? (uint64_t)(int64_t)value_ : (uint64_t)(u_int)value_;
+}
+
+template<int D>
+uint64_t widen(unsigned long long value_)
+{
+	return value_;
+}
+
+template<class T>
+Oid_type uuid(T )
+{
+	return Schema<T>::uuid();
+}
+
+// NB. the host scalars hang off the product OID.
+Oid_type uuid(Host::PROPERTY );
+
+// NB. the name of a column less its sub-identifier, as in the traps.
+template<class T>
+Oid_type prefix(T )
+{
+	Oid_type output = Schema<T>::uuid();
+	output.push_back(1);
+	return output;
+}
+
+Oid_type prefix(Host::PROPERTY );
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Extract
+// NB. copies the numeric columns of a row widened to 8 bytes.
+
+template<class R>
+struct Extract
+{
+	Extract(const R& row_, uint64_t*& dst_): m_dst(&dst_), m_row(&row_)
+	{
+	}
+
+	template<class U>
+	void operator()(U )
+	{
+		*(*m_dst)++ = widen<U::asn_type::value>
+			(m_row->template get<U::name_type::value>());
+	}
+private:
+	uint64_t** m_dst;
+	const R* m_row;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Pass
+
+struct Pass
+{
+	unsigned long long generation;
+	// NB. monotonic, nanoseconds.
+	unsigned long long stamp;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Region
+// NB. the mapping of an export file. there is one writer, the scheduler
+// thread.
+
+struct Region: boost::noncopyable
+{
+	Region(): m_size(), m_data(NULL)
+	{
+	}
+	~Region();
+
+	bool create(const std::string& path_, const tableList_type& tables_,
+		const columnList_type& columns_);
+	void write(unsigned table_, size_t slot_, const netsnmp_index& key_,
+		const uint64_t* values_, const Pass& pass_);
+	void clear(unsigned table_, size_t slot_);
+	void finish(const Pass& pass_);
+	void retire();
+private:
+	export_record* record(unsigned table_, size_t slot_) const;
+
+	size_t m_size;
+	u_char* m_data;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Sheet
+// NB. the records of one table. a row keeps its record while it lives, the
+// rows are told apart by address as the tables never move them.
+
+template<class T>
+struct Sheet: boost::noncopyable
+{
+	typedef typename mpl::copy_if<Schema<T>, Numeric,
+			mpl::back_inserter<mpl::vector0<> > >::type seq_type;
+	enum
+	{
+		COLUMNS = mpl::size<seq_type>::value,
+		MAX_CAPACITY = 1 << 20
+	};
+
+	explicit Sheet(size_t capacity_): m_table(), m_pending(), m_next(),
+		m_capacity(), m_wanted(capacity_), m_overflow()
+	{
+	}
+
+	void describe(tableList_type& tables_, columnList_type& columns_);
+	// NB. the name, the OID and the columns of the table.
+	static void declare(export_table& table_, columnList_type& columns_);
+	// NB. moves to the records described last, the file is created.
+	void attach();
+	template<class R>
+	void put(const R& row_, const netsnmp_index& key_, Region& region_, const Pass& pass_);
+	void publish(const Table::Unit<T>& table_, Region& region_, const Pass& pass_);
+	// NB. asks for twice the capacity if a row did not fit, returns true
+	// if so. the rows over MAX_CAPACITY are not published.
+	bool grow();
+private:
+	struct Slot
+	{
+		size_t index;
+		unsigned long long generation;
+	};
+	typedef boost::unordered_map<const void* , Slot> slotMap_type;
+
+	struct Describe
+	{
+		explicit Describe(columnList_type& dst_): m_dst(&dst_)
+		{
+		}
+
+		template<class U>
+		void operator()(U )
+		{
+			export_column x = {};
+			x.name = U::name_type::value;
+			x.type = U::asn_type::value;
+			m_dst->push_back(x);
+		}
+	private:
+		columnList_type* m_dst;
+	};
+	struct Visitor
+	{
+		bool operator()(typename Table::Unit<T>::tuple_type& tuple_)
+		{
+			sheet->put(tuple_, tuple_.key(), *region, *pass);
+			return false;
+		}
+
+		Sheet* sheet;
+		Region* region;
+		const Pass* pass;
+	};
+
+	unsigned m_table;
+	unsigned m_pending;
+	size_t m_next;
+	size_t m_capacity;
+	size_t m_wanted;
+	bool m_overflow;
+	slotMap_type m_slots;
+	std::vector<size_t> m_free;
+};
+
+template<class T>
+void Sheet<T>::describe(tableList_type& tables_, columnList_type& columns_)
+{
+	m_pending = tables_.size();
+	export_table t = {};
+	declare(t, columns_);
+	t.capacity = m_wanted;
+	t.record_size = sizeof(export_record) + COLUMNS * EXPORT_VALUE_SIZE;
+	tables_.push_back(t);
+}
+
+template<class T>
+void Sheet<T>::declare(export_table& table_, columnList_type& columns_)
+{
+	const char* n = Schema<T>::name();
+	if (0 == strncmp(n, TOKEN_PREFIX, sizeof(TOKEN_PREFIX) - 1))
+		n += sizeof(TOKEN_PREFIX) - 1;
+	strncpy(table_.name, n, sizeof(table_.name) - 1);
+	Oid_type u = uuid(T());
+	table_.oid_size = std::min<size_t>(u.size(), EXPORT_OID_MAX);
+	std::copy(u.begin(), u.begin() + table_.oid_size, table_.oid);
+	table_.column = columns_.size();
+	table_.columns = COLUMNS;
+	mpl::for_each<seq_type>(Describe(columns_));
+}
+
+template<class T>
+void Sheet<T>::attach()
+{
+	m_next = 0;
+	m_free.clear();
+	m_slots.clear();
+	m_table = m_pending;
+	m_capacity = m_wanted;
+	m_overflow = false;
+}
+
+template<class T>
+template<class R>
+void Sheet<T>::put(const R& row_, const netsnmp_index& key_, Region& region_, const Pass& pass_)
+{
+	if (EXPORT_KEY_MAX < key_.len)
+		return;
+
+	typename slotMap_type::iterator p = m_slots.find(&row_);
+	if (m_slots.end() == p)
+	{
+		Slot s = {m_next, pass_.generation};
+		if (!m_free.empty())
+		{
+			s.index = m_free.back();
+			m_free.pop_back();
+		}
+		else if (m_capacity > m_next)
+			++m_next;
+		else
+		{
+			m_overflow = true;
+			return;
+		}
+		p = m_slots.insert(std::make_pair(&row_, s)).first;
+	}
+	p->second.generation = pass_.generation;
+
+	uint64_t v[COLUMNS];
+	uint64_t* x = v;
+	mpl::for_each<seq_type>(Extract<R>(row_, x));
+	region_.write(m_table, p->second.index, key_, v, pass_);
+}
+
+template<class T>
+void Sheet<T>::publish(const Table::Unit<T>& table_, Region& region_, const Pass& pass_)
+{
+	Visitor v = {this, &region_, &pass_};
+	table_.for_each_in_range(Oid_type(), v);
+	for (typename slotMap_type::iterator p = m_slots.begin(); p != m_slots.end();)
+	{
+		if (pass_.generation == p->second.generation)
+		{
+			++p;
+			continue;
+		}
+		region_.clear(m_table, p->second.index);
+		m_free.push_back(p->second.index);
+		p = m_slots.erase(p);
+	}
+}
+
+template<class T>
+bool Sheet<T>::grow()
+{
+	if (!m_overflow)
+		return false;
+
+	m_overflow = false;
+	if (MAX_CAPACITY <= m_capacity)
+		return false;
+
+	m_wanted = 2 * m_capacity;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Unit
+// NB. publishes the numeric columns into the file named by RMOND_EXPORT.
+
+struct Unit: boost::noncopyable
+{
+	explicit Unit(const std::string& path_);
+
+	void publish(const Host::space_type& host_, const VE::space_type& ves_);
+	static boost::shared_ptr<Unit> inject();
+private:
+	enum
+	{
+		// NB. the VEs the first file is sized for.
+		CAPACITY = 256
+	};
+
+	bool create();
+	bool pass(const Host::space_type& host_, const VE::space_type& ves_);
+
+	std::string m_path;
+	unsigned long long m_generation;
+	std::auto_ptr<Region> m_region;
+	Sheet<Host::PROPERTY> m_host;
+	Sheet<VE::TABLE> m_ve;
+	Sheet<VE::Disk::TABLE> m_disk;
+	Sheet<VE::Network::TABLE> m_network;
+	Sheet<VE::CPU::TABLE> m_cpu;
+	Sheet<VE::Counters::Linux::TABLE> m_linux;
+};
+typedef boost::shared_ptr<Unit> UnitSP;
+
+} // namespace Export
+} // namespace Rmond
+
+#endif // EXPORT_H
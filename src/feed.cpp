@@ -0,0 +1,361 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "feed.h"
+#include <poll.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+namespace Rmond
+{
+namespace Feed
+{
+namespace
+{
+time_t now()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec;
+}
+
+unsigned long long nanoseconds(const timespec& start_, const timespec& finish_)
+{
+	return (finish_.tv_sec - start_.tv_sec) * 1000000000ULL +
+		finish_.tv_nsec - start_.tv_nsec;
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Encoder
+
+Encoder::Encoder(std::vector<u_char>& dst_, frame_kind kind_):
+	m_start(dst_.size()), m_dst(&dst_)
+{
+	m_dst->resize(m_start + FRAME_HEADER_SIZE);
+	(*m_dst)[m_start + FRAME_HEADER_SIZE - 1] = kind_;
+}
+
+void Encoder::put(uint64_t value_, unsigned size_)
+{
+	size_t n = m_dst->size();
+	m_dst->resize(n + size_);
+	for (unsigned i = 0; i < size_; ++i)
+		(*m_dst)[n + i] = (u_char)(value_ >> (8 * i));
+}
+
+void Encoder::put(const netsnmp_index& key_)
+{
+	put(key_.len, 1);
+	for (size_t i = 0; i < key_.len; ++i)
+		put((uint32_t)key_.oids[i], 4);
+}
+
+void Encoder::end()
+{
+	uint32_t x = m_dst->size() - m_start - 4;
+	for (unsigned i = 0; i < 4; ++i)
+		(*m_dst)[m_start + i] = (u_char)(x >> (8 * i));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Connection
+
+bool Connection::open(int transport_, const std::string& host_, int port_)
+{
+	if (m_transport != transport_ || m_host != host_ || m_port != port_)
+	{
+		close();
+		m_transport = transport_;
+		m_host = host_;
+		m_port = port_;
+		m_retry = 0;
+		m_backoff = 0;
+	}
+	if (-1 == m_socket)
+	{
+		if (now() < m_retry)
+			return true;
+		if (connect())
+		{
+			fail("connect to");
+			return true;
+		}
+	}
+	if (!m_connecting)
+		return false;
+
+	pollfd p = {m_socket, POLLOUT, 0};
+	if (0 == poll(&p, 1, 0))
+		return true;
+
+	int e = 0;
+	socklen_t n = sizeof(e);
+	if (0 != getsockopt(m_socket, SOL_SOCKET, SO_ERROR, &e, &n) || 0 != e)
+	{
+		errno = e;
+		fail("connect to");
+		return true;
+	}
+	establish();
+	return false;
+}
+
+bool Connection::connect()
+{
+	int e = -1;
+	if (Sink::TRANSPORT_UNIX == m_transport)
+	{
+		sockaddr_un a = {};
+		a.sun_family = AF_UNIX;
+		if (sizeof(a.sun_path) <= m_host.size())
+		{
+			errno = ENAMETOOLONG;
+			return true;
+		}
+		strcpy(a.sun_path, m_host.c_str());
+		m_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (-1 != m_socket)
+			e = ::connect(m_socket, (const sockaddr* )&a, sizeof(a));
+	}
+	else
+	{
+		addrinfo h = {}, *r = NULL;
+		h.ai_family = AF_UNSPEC;
+		h.ai_socktype = SOCK_STREAM;
+		char p[16];
+		snprintf(p, sizeof(p), "%d", m_port);
+		int x = getaddrinfo(m_host.c_str(), p, &h, &r);
+		if (0 != x || NULL == r)
+		{
+			snmp_log(LOG_ERR, LOG_PREFIX"cannot resolve the sink %s: %s\n",
+				m_host.c_str(), gai_strerror(x));
+			errno = EHOSTUNREACH;
+			return true;
+		}
+		m_socket = socket(r->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (-1 != m_socket)
+		{
+			int y = 1;
+			setsockopt(m_socket, IPPROTO_TCP, TCP_NODELAY, &y, sizeof(y));
+			e = ::connect(m_socket, r->ai_addr, r->ai_addrlen);
+		}
+		freeaddrinfo(r);
+	}
+	if (0 == e)
+		establish();
+	else if (-1 != m_socket && EINPROGRESS == errno)
+		m_connecting = true;
+	else
+		return true;
+
+	return false;
+}
+
+void Connection::establish()
+{
+	DEBUGMSGTL((TOKEN_PREFIX"feed", "connected to %s:%d\n", m_host.c_str(), m_port));
+	m_connecting = false;
+	m_backoff = 0;
+	m_backlog.clear();
+	m_sent = 0;
+	++m_epoch;
+}
+
+void Connection::fail(const char* what_)
+{
+	snmp_log(LOG_ERR, LOG_PREFIX"cannot %s the sink %s:%d: %s\n",
+		what_, m_host.c_str(), m_port, strerror(errno));
+	close();
+	m_backoff = std::min<unsigned>(std::max(1U, 2 * m_backoff), MAX_BACKOFF);
+	m_retry = now() + m_backoff;
+}
+
+void Connection::close()
+{
+	if (-1 != m_socket)
+		::close(m_socket);
+
+	m_socket = -1;
+	m_connecting = false;
+	m_backlog.clear();
+	m_sent = 0;
+}
+
+bool Connection::flush()
+{
+	while (m_sent < m_backlog.size())
+	{
+		ssize_t n = send(m_socket, &m_backlog[m_sent], m_backlog.size() - m_sent,
+				MSG_NOSIGNAL);
+		if (0 < n)
+			m_sent += n;
+		else if (EINTR == errno)
+			continue;
+		else if (EAGAIN == errno || EWOULDBLOCK == errno)
+			break;
+		else
+		{
+			fail("write to");
+			return true;
+		}
+	}
+	// NB. the frames the peer has taken are dropped once they are the
+	// most of the backlog.
+	if (m_sent == m_backlog.size())
+	{
+		m_backlog.clear();
+		m_sent = 0;
+	}
+	else if (m_sent > m_backlog.size() / 2)
+	{
+		m_backlog.erase(m_backlog.begin(), m_backlog.begin() + m_sent);
+		m_sent = 0;
+	}
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Unit
+
+Unit::Unit(): m_tick(), m_epoch(), m_generation(), m_report(), m_host(0),
+	m_ve(1), m_disk(2), m_network(3), m_cpu(4), m_linux(5)
+{
+	m_report.start = now();
+}
+
+void Unit::describe(std::vector<u_char>& dst_) const
+{
+	dst_.insert(dst_.end(), FRAME_MAGIC, FRAME_MAGIC + FRAME_MAGIC_SIZE);
+	dst_.push_back(FRAME_VERSION);
+	Encoder e(dst_, FRAME_SCHEMA);
+	e.put(TABLES, 2);
+	m_host.describe(e);
+	m_ve.describe(e);
+	m_disk.describe(e);
+	m_network.describe(e);
+	m_cpu.describe(e);
+	m_linux.describe(e);
+	e.end();
+}
+
+void Unit::push(const Sink::table_type::tuple_type& sink_,
+	boost::shared_ptr<Value::Filter> filter_,
+	const Host::space_type& host_, const VE::space_type& ves_)
+{
+	timespec b;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &b);
+	if (m_connection.open(sink_.get<Sink::TRANSPORT>(), sink_.get<Sink::HOST>(),
+		sink_.get<Sink::PORT>()))
+		return;
+
+	std::vector<u_char>& o = m_connection.backlog();
+	bool f = false;
+	if (m_epoch != m_connection.epoch())
+	{
+		m_epoch = m_connection.epoch();
+		m_host.clear();
+		m_ve.clear();
+		m_disk.clear();
+		m_network.clear();
+		m_cpu.clear();
+		m_linux.clear();
+		describe(o);
+		f = true;
+	}
+	if (MAX_BACKLOG < m_connection.pending())
+	{
+		// NB. the rows keep the values last sent, the next inform that
+		// goes sends everything changed since then.
+		++m_report.drops;
+		m_connection.flush();
+		return;
+	}
+	if (m_filter != filter_)
+	{
+		m_filter = filter_;
+		m_host.select(*m_filter);
+		m_ve.select(*m_filter);
+		m_disk.select(*m_filter);
+		m_network.select(*m_filter);
+		m_cpu.select(*m_filter);
+		m_linux.select(*m_filter);
+		f = true;
+	}
+	// NB. a delta of N sends all the values every Nth inform.
+	int d = sink_.get<Sink::DELTA>();
+	if (0 >= d || 0 == m_tick++ % d)
+		f = true;
+
+	timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	size_t z = o.size();
+	Context x = {++m_generation, t.tv_sec * 1000000000ULL + t.tv_nsec, f, 0, 0, &o};
+	Host::tupleSP_type h = host_.get<0>();
+	if (NULL != h.get())
+	{
+		netsnmp_index k = {};
+		m_host.put(*h, k, x);
+	}
+	m_ve.push(*ves_.get<0>(), x);
+	m_disk.push(*ves_.get<1>(), x);
+	m_network.push(*ves_.get<2>(), x);
+	m_cpu.push(*ves_.get<3>(), x);
+	m_linux.push(*ves_.get<4>(), x);
+	z = o.size() - z;
+	DEBUGMSGTL((TOKEN_PREFIX"feed", "%u frames, %u samples, %zu bytes, %zu pending\n",
+		x.frames, x.samples, z, m_connection.pending()));
+	m_connection.flush();
+	account(x, z, b);
+}
+
+// NB. the rates are reported under the feed token every REPORT_PERIOD
+// seconds, the CPU time is that of the informs of the sink.
+void Unit::account(const Context& context_, size_t bytes_, const timespec& start_)
+{
+	timespec e;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &e);
+	m_report.frames += context_.frames;
+	m_report.samples += context_.samples;
+	m_report.bytes += bytes_;
+	m_report.cpu += nanoseconds(start_, e);
+
+	time_t n = now();
+	time_t s = n - m_report.start;
+	if (REPORT_PERIOD > s)
+		return;
+
+	DEBUGMSGTL((TOKEN_PREFIX"feed", "%llu frames/s, %llu bytes/s, %llu ns "
+		"per 10k samples, %u informs dropped\n", m_report.frames / s,
+		m_report.bytes / s, 0 == m_report.samples ? 0ULL :
+		m_report.cpu * 10000 / m_report.samples, m_report.drops));
+	m_report = Report();
+	m_report.start = n;
+}
+
+} // namespace Feed
+} // namespace Rmond
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef FEED_H
+#define FEED_H
+#include "sink.h"
+#include "export.h"
+#include "frame.h"
+#include <boost/foreach.hpp>
+#include <boost/static_assert.hpp>
+
+namespace Rmond
+{
+namespace Feed
+{
+///////////////////////////////////////////////////////////////////////////////
+// struct Encoder
+// NB. appends one frame to the buffer, the length is filled in by end().
+
+struct Encoder
+{
+	Encoder(std::vector<u_char>& dst_, frame_kind kind_);
+
+	void put(uint64_t value_, unsigned size_);
+	void put(const netsnmp_index& key_);
+	void end();
+private:
+	size_t m_start;
+	std::vector<u_char>* m_dst;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Connection
+// NB. a persistent non-blocking stream to the sink. the frames wait in the
+// backlog till the socket takes them. a lost connection is opened again
+// after a backoff that doubles with every failure.
+
+struct Connection: boost::noncopyable
+{
+	Connection(): m_socket(-1), m_port(), m_transport(), m_epoch(),
+		m_sent(), m_retry(), m_backoff(), m_connecting()
+	{
+	}
+	~Connection()
+	{
+		close();
+	}
+
+	// NB. returns true if there is no connection to write to yet.
+	bool open(int transport_, const std::string& host_, int port_);
+	// NB. bumped by every new connection, the backlog is empty then.
+	unsigned epoch() const
+	{
+		return m_epoch;
+	}
+	std::vector<u_char>& backlog()
+	{
+		return m_backlog;
+	}
+	size_t pending() const
+	{
+		return m_backlog.size() - m_sent;
+	}
+	// NB. writes what the socket takes. returns true if the connection is
+	// lost.
+	bool flush();
+private:
+	enum
+	{
+		MAX_BACKOFF = 30
+	};
+
+	bool connect();
+	void establish();
+	void fail(const char* what_);
+	void close();
+
+	int m_socket;
+	std::string m_host;
+	int m_port;
+	int m_transport;
+	unsigned m_epoch;
+	size_t m_sent;
+	time_t m_retry;
+	unsigned m_backoff;
+	bool m_connecting;
+	std::vector<u_char> m_backlog;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Context
+
+struct Context
+{
+	unsigned long long generation;
+	// NB. CLOCK_REALTIME, nanoseconds.
+	unsigned long long stamp;
+	// NB. all the columns are sent, not only the changed ones.
+	bool full;
+	unsigned frames;
+	unsigned samples;
+	std::vector<u_char>* output;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Rows
+// NB. the values sent of every row of a table. like the export sheets the
+// rows are told apart by address, the key tells a reused address.
+
+template<class T>
+struct Rows: boost::noncopyable
+{
+	typedef Export::Sheet<T> sheet_type;
+	typedef typename sheet_type::seq_type seq_type;
+	enum
+	{
+		COLUMNS = sheet_type::COLUMNS
+	};
+	BOOST_STATIC_ASSERT(FRAME_COLUMNS_MAX >= (int)COLUMNS);
+
+	explicit Rows(unsigned id_): m_id(id_), m_mask()
+	{
+	}
+
+	void describe(Encoder& dst_) const;
+	void select(const Value::Filter& filter_);
+	void clear()
+	{
+		m_rows.clear();
+	}
+	template<class R>
+	void put(const R& row_, const netsnmp_index& key_, Context& context_);
+	void push(const Table::Unit<T>& table_, Context& context_);
+private:
+	struct Row
+	{
+		unsigned long long generation;
+		std::vector<uint32_t> key;
+		uint64_t values[COLUMNS];
+	};
+	typedef boost::unordered_map<const void* , Row> rowMap_type;
+
+	struct Visitor
+	{
+		bool operator()(typename Table::Unit<T>::tuple_type& tuple_)
+		{
+			rows->put(tuple_, tuple_.key(), *context);
+			return false;
+		}
+
+		Rows* rows;
+		Context* context;
+	};
+
+	static bool same(const std::vector<uint32_t>& key_, const netsnmp_index& index_);
+	void gone(const std::vector<uint32_t>& key_, Context& context_) const;
+
+	unsigned m_id;
+	uint64_t m_mask;
+	rowMap_type m_rows;
+};
+
+template<class T>
+void Rows<T>::describe(Encoder& dst_) const
+{
+	export_table t = {};
+	Export::columnList_type c;
+	sheet_type::declare(t, c);
+	dst_.put(m_id, 2);
+	dst_.put(t.oid_size, 1);
+	for (uint32_t i = 0; i < t.oid_size; ++i)
+		dst_.put(t.oid[i], 4);
+
+	dst_.put(c.size(), 1);
+	BOOST_FOREACH(const export_column& x, c)
+	{
+		dst_.put(x.name, 4);
+		dst_.put(x.type, 1);
+	}
+}
+
+template<class T>
+void Rows<T>::select(const Value::Filter& filter_)
+{
+	export_table t = {};
+	Export::columnList_type c;
+	sheet_type::declare(t, c);
+	Oid_type u = Export::prefix(T());
+	m_mask = 0;
+	for (size_t i = 0; i < c.size(); ++i)
+	{
+		u.push_back(c[i].name);
+		if (filter_.match(u))
+			m_mask |= 1ULL << i;
+		u.pop_back();
+	}
+}
+
+template<class T>
+bool Rows<T>::same(const std::vector<uint32_t>& key_, const netsnmp_index& index_)
+{
+	if (key_.size() != index_.len)
+		return false;
+
+	for (size_t i = 0; i < index_.len; ++i)
+	{
+		if (key_[i] != (uint32_t)index_.oids[i])
+			return false;
+	}
+	return true;
+}
+
+template<class T>
+void Rows<T>::gone(const std::vector<uint32_t>& key_, Context& context_) const
+{
+	Encoder e(*context_.output, FRAME_GONE);
+	e.put(context_.stamp, 8);
+	e.put(m_id, 2);
+	e.put(key_.size(), 1);
+	BOOST_FOREACH(uint32_t x, key_)
+	{
+		e.put(x, 4);
+	}
+	e.end();
+	++context_.frames;
+}
+
+template<class T>
+template<class R>
+void Rows<T>::put(const R& row_, const netsnmp_index& key_, Context& context_)
+{
+	if (EXPORT_KEY_MAX < key_.len)
+		return;
+
+	uint64_t v[COLUMNS];
+	uint64_t* x = v;
+	mpl::for_each<seq_type>(Export::Extract<R>(row_, x));
+
+	std::pair<typename rowMap_type::iterator, bool> p =
+		m_rows.insert(std::make_pair(&row_, Row()));
+	Row& r = p.first->second;
+	bool f = context_.full || p.second;
+	if (!p.second && !same(r.key, key_))
+	{
+		gone(r.key, context_);
+		f = true;
+	}
+	if (f)
+		r.key.assign(key_.oids, key_.oids + key_.len);
+
+	r.generation = context_.generation;
+	uint64_t m = 0;
+	for (size_t i = 0; i < COLUMNS; ++i)
+	{
+		if (0 != (m_mask & (1ULL << i)) && (f || r.values[i] != v[i]))
+			m |= 1ULL << i;
+	}
+	std::copy(v, v + COLUMNS, r.values);
+	if (0 == m)
+		return;
+
+	Encoder e(*context_.output, FRAME_ROW);
+	e.put(context_.stamp, 8);
+	e.put(m_id, 2);
+	e.put(key_);
+	e.put(m, 8);
+	for (size_t i = 0; i < COLUMNS; ++i)
+	{
+		if (0 == (m & (1ULL << i)))
+			continue;
+
+		e.put(v[i], 8);
+		++context_.samples;
+	}
+	e.end();
+	++context_.frames;
+}
+
+template<class T>
+void Rows<T>::push(const Table::Unit<T>& table_, Context& context_)
+{
+	Visitor v = {this, &context_};
+	table_.for_each_in_range(Oid_type(), v);
+	for (typename rowMap_type::iterator p = m_rows.begin(); p != m_rows.end();)
+	{
+		if (context_.generation == p->second.generation)
+		{
+			++p;
+			continue;
+		}
+		gone(p->second.key, context_);
+		p = m_rows.erase(p);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Unit
+// NB. the streaming flavour of a sink. every inform sends the rows changed
+// since the previous one and all the rows once in DELTA informs. when the
+// peer does not keep up the informs are dropped till the backlog drains.
+
+struct Unit: boost::noncopyable
+{
+	Unit();
+
+	void push(const Sink::table_type::tuple_type& sink_,
+		boost::shared_ptr<Value::Filter> filter_,
+		const Host::space_type& host_, const VE::space_type& ves_);
+private:
+	enum
+	{
+		TABLES = 6,
+		MAX_BACKLOG = 4 << 20,
+		// NB. seconds between the rate reports.
+		REPORT_PERIOD = 10
+	};
+	struct Report
+	{
+		time_t start;
+		unsigned drops;
+		unsigned long long frames;
+		unsigned long long samples;
+		unsigned long long bytes;
+		// NB. nanoseconds of the scheduler thread.
+		unsigned long long cpu;
+	};
+
+	void describe(std::vector<u_char>& dst_) const;
+	void account(const Context& context_, size_t bytes_, const timespec& start_);
+
+	unsigned m_tick;
+	unsigned m_epoch;
+	unsigned long long m_generation;
+	boost::shared_ptr<Value::Filter> m_filter;
+	Report m_report;
+	Connection m_connection;
+	Rows<Host::PROPERTY> m_host;
+	Rows<VE::TABLE> m_ve;
+	Rows<VE::Disk::TABLE> m_disk;
+	Rows<VE::Network::TABLE> m_network;
+	Rows<VE::CPU::TABLE> m_cpu;
+	Rows<VE::Counters::Linux::TABLE> m_linux;
+};
+typedef boost::shared_ptr<Unit> UnitSP;
+
+} // namespace Feed
+} // namespace Rmond
+
+#endif // FEED_H
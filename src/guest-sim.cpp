@@ -0,0 +1,502 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "guest.h"
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+// NB. drs-guest-sim feeds the guest stream consumer from local producers
+// that write the drs-transport output into pipes, so that the guest path
+// can be measured without VMs.
+//
+//	drs-guest-sim [-B] [-n PRODUCERS] [-r RATE] [-t SECONDS] [-i MS]
+//		[-s STALL%] [-S MS] [-p PARTIAL%] [-b BURST%] [-v]
+
+namespace
+{
+using namespace Rmond;
+
+// NB. monotonic, milliseconds.
+unsigned long long now()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000ULL + t.tv_nsec / 1000000;
+}
+
+void pause(unsigned long long ms_)
+{
+	timespec t = {(time_t)(ms_ / 1000), (long)(ms_ % 1000) * 1000000};
+	while (-1 == nanosleep(&t, &t) && EINTR == errno);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Options
+
+struct Options
+{
+	Options(): binary(false), verbose(false), producers(16), rate(1),
+		seconds(10), interval(1000), stall(0), stallLength(3000),
+		partial(0), burst(0)
+	{
+	}
+
+	bool parse(int argc_, char** argv_);
+
+	bool binary;
+	bool verbose;
+	unsigned producers;
+	// NB. samples per second of every producer.
+	unsigned rate;
+	unsigned seconds;
+	// NB. milliseconds between the consumer passes.
+	unsigned interval;
+	// NB. the percentages of the samples that stall, go in two halves
+	// or come in a burst of BURST_SIZE.
+	unsigned stall;
+	unsigned stallLength;
+	unsigned partial;
+	unsigned burst;
+};
+
+bool Options::parse(int argc_, char** argv_)
+{
+	int c;
+	while (-1 != (c = getopt(argc_, argv_, "Bn:r:t:i:s:S:p:b:v")))
+	{
+		switch (c)
+		{
+		case 'B':
+			binary = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'n':
+			producers = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'i':
+			interval = atoi(optarg);
+			break;
+		case 's':
+			stall = atoi(optarg);
+			break;
+		case 'S':
+			stallLength = atoi(optarg);
+			break;
+		case 'p':
+			partial = atoi(optarg);
+			break;
+		case 'b':
+			burst = atoi(optarg);
+			break;
+		default:
+			return true;
+		}
+	}
+	return optind != argc_ || 0 == producers || 0 == rate || 1000 < rate ||
+		0 == seconds || 0 == interval || 100 < stall + partial + burst;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Producer
+// NB. a fake drs-transport. every sample carries the time it was written
+// in meminfo_Mapped, the consumer takes the staleness from it.
+
+struct Producer: Guest::Channel
+{
+	enum
+	{
+		BURST_SIZE = 5,
+		STAMP_MODULO = 1000000000
+	};
+
+	Producer(const Options& options_, unsigned seed_);
+	~Producer();
+
+	bool start();
+	void stop();
+	int fd() const
+	{
+		return m_pipe[0];
+	}
+	bool alive()
+	{
+		return !__atomic_load_n(&m_done, __ATOMIC_ACQUIRE);
+	}
+	unsigned long long written() const
+	{
+		return __atomic_load_n(&m_written, __ATOMIC_RELAXED);
+	}
+private:
+	static void* run(void* this_);
+	void loop();
+	void sample(std::string& dst_);
+	void text(std::string& dst_);
+	void frame(std::string& dst_, int type_, const std::string& payload_);
+	void put(std::string& dst_, unsigned long long value_, unsigned size_);
+	bool send(const char* data_, size_t size_);
+
+	const Options* m_options;
+	unsigned m_seed;
+	unsigned long long m_sequence;
+	unsigned long long m_written;
+	bool m_stop;
+	bool m_done;
+	bool m_started;
+	int m_pipe[2];
+	pthread_t m_thread;
+};
+
+const char* const NAMES[] =
+{
+	"loadavg_currExisting",
+	"loadavg_runQJobs01",
+	"diskstats_ms_writing",
+	"diskstats_IOs_in_process",
+	"meminfo_Writeback",
+	"meminfo_SUnreclaim",
+	"meminfo_PageTables",
+	"meminfo_Mapped",
+	"meminfo_Dirty"
+};
+
+const unsigned STAMP = 7;
+
+Producer::Producer(const Options& options_, unsigned seed_): m_options(&options_),
+	m_seed(seed_), m_sequence(), m_written(), m_stop(), m_done(), m_started()
+{
+	m_pipe[0] = m_pipe[1] = -1;
+}
+
+Producer::~Producer()
+{
+	stop();
+	if (-1 != m_pipe[0])
+		close(m_pipe[0]);
+}
+
+bool Producer::start()
+{
+	if (0 != pipe(m_pipe) || 0 != fcntl(m_pipe[0], F_SETFL, O_NONBLOCK))
+		return true;
+
+	m_started = 0 == pthread_create(&m_thread, NULL, &run, this);
+	return !m_started;
+}
+
+void Producer::stop()
+{
+	if (!m_started)
+		return;
+
+	// NB. a producer blocked on the full pipe gets EPIPE.
+	__atomic_store_n(&m_stop, true, __ATOMIC_RELEASE);
+	close(m_pipe[0]);
+	m_pipe[0] = -1;
+	pthread_join(m_thread, NULL);
+	m_started = false;
+}
+
+void* Producer::run(void* this_)
+{
+	Producer* p = static_cast<Producer* >(this_);
+	p->loop();
+	close(p->m_pipe[1]);
+	__atomic_store_n(&p->m_done, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+void Producer::put(std::string& dst_, unsigned long long value_, unsigned size_)
+{
+	for (unsigned i = 0; i < size_; ++i)
+		dst_.push_back((char)(value_ >> (8 * i)));
+}
+
+void Producer::frame(std::string& dst_, int type_, const std::string& payload_)
+{
+	put(dst_, payload_.size() + 1, 4);
+	dst_.push_back((char)type_);
+	dst_.append(payload_);
+}
+
+void Producer::text(std::string& dst_)
+{
+	char b[64];
+	unsigned long long s = now() % STAMP_MODULO;
+	for (unsigned i = 0; i < sizeof(NAMES)/sizeof(NAMES[0]); ++i)
+	{
+		if (1 == i)
+			snprintf(b, sizeof(b), "%s:%lf ", NAMES[i], 0.01 * (m_sequence % 100));
+		else
+			snprintf(b, sizeof(b), "%s:%llu ", NAMES[i],
+				STAMP == i ? s : m_sequence + i);
+		dst_.append(b);
+	}
+	dst_.push_back('\n');
+}
+
+void Producer::sample(std::string& dst_)
+{
+	++m_sequence;
+	if (!m_options->binary)
+		return text(dst_);
+
+	std::string p;
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	put(p, t.tv_sec * 1000000000ULL + t.tv_nsec, 8);
+	put(p, sizeof(NAMES)/sizeof(NAMES[0]), 2);
+	for (unsigned i = 0; i < sizeof(NAMES)/sizeof(NAMES[0]); ++i)
+	{
+		if (1 == i)
+		{
+			double d = 0.01 * (m_sequence % 100);
+			unsigned long long x;
+			memcpy(&x, &d, sizeof(x));
+			put(p, x, PROTOCOL_VALUE_SIZE);
+		}
+		else
+			put(p, STAMP == i ? now() % STAMP_MODULO : m_sequence + i,
+				PROTOCOL_VALUE_SIZE);
+	}
+	frame(dst_, FRAME_SAMPLE, p);
+}
+
+bool Producer::send(const char* data_, size_t size_)
+{
+	while (0 < size_)
+	{
+		ssize_t n = write(m_pipe[1], data_, size_);
+		if (-1 == n && EINTR == errno)
+			continue;
+		if (-1 == n)
+			return true;
+
+		data_ += n;
+		size_ -= n;
+	}
+	return false;
+}
+
+void Producer::loop()
+{
+	unsigned long long d = now(), p = 1000 / m_options->rate;
+	std::string o;
+	if (m_options->binary)
+	{
+		o.append(PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE);
+		o.push_back((char)PROTOCOL_VERSION);
+		std::string x;
+		put(x, sizeof(NAMES)/sizeof(NAMES[0]), 2);
+		for (unsigned i = 0; i < sizeof(NAMES)/sizeof(NAMES[0]); ++i)
+		{
+			x.push_back((char)(1 == i ? DOUBLE_TYPE : INTEGER_TYPE));
+			x.push_back((char)strlen(NAMES[i]));
+			x.append(NAMES[i]);
+		}
+		frame(o, FRAME_DICTIONARY, x);
+	}
+	while (!__atomic_load_n(&m_stop, __ATOMIC_ACQUIRE))
+	{
+		unsigned r = rand_r(&m_seed) % 100;
+		if (r < m_options->stall)
+		{
+			pause(m_options->stallLength);
+			d = now();
+		}
+		r -= std::min(r, m_options->stall);
+		unsigned n = r < m_options->burst ? BURST_SIZE : 1;
+		for (unsigned i = 0; i < n; ++i)
+			sample(o);
+
+		if (r >= m_options->burst && r < m_options->burst + m_options->partial)
+		{
+			// NB. the consumer sees a half of the sample first.
+			size_t h = o.size() / 2;
+			if (send(o.data(), h))
+				return;
+			pause(p / 4);
+			if (send(o.data() + h, o.size() - h))
+				return;
+		}
+		else if (send(o.data(), o.size()))
+			return;
+
+		__atomic_fetch_add(&m_written, n, __ATOMIC_RELAXED);
+		o.clear();
+		d += p;
+		unsigned long long x = now();
+		if (d > x)
+			pause(d - x);
+		else
+			d = x;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Consumer
+// NB. pulls every session once a pass, as the agent does once a refresh.
+
+struct Consumer
+{
+	Consumer(): pulls(), fresh(), lost(), late()
+	{
+	}
+
+	void account(const Guest::Session& session_, unsigned long long samples_);
+	void report(const Options& options_, const boost::ptr_vector<Producer>& producers_,
+		const std::vector<Guest::Session* >& sessions_, unsigned long long elapsed_);
+
+	unsigned long long pulls;
+	unsigned long long fresh;
+	unsigned long long lost;
+	// NB. the samples that stayed in the pipe longer than a second.
+	unsigned long long late;
+	std::vector<unsigned> staleness;
+};
+
+void Consumer::account(const Guest::Session& session_, unsigned long long samples_)
+{
+	const Guest::Sample& s = session_.sample();
+	if (!s.known.test(Guest::MEMINFO_MAPPED))
+		return;
+
+	unsigned long long x = now() % Producer::STAMP_MODULO;
+	unsigned long long y = (unsigned)s.values[Guest::MEMINFO_MAPPED];
+	unsigned a = (x + Producer::STAMP_MODULO - y) % Producer::STAMP_MODULO;
+	staleness.push_back(a);
+	if (samples_ != session_.statistics().samples)
+		++fresh;
+	if (1000 < a)
+		++late;
+}
+
+unsigned percentile(const std::vector<unsigned>& sorted_, unsigned p_)
+{
+	if (sorted_.empty())
+		return 0;
+
+	return sorted_[std::min<size_t>(sorted_.size() - 1, sorted_.size() * p_ / 100)];
+}
+
+void Consumer::report(const Options& options_, const boost::ptr_vector<Producer>& producers_,
+	const std::vector<Guest::Session* >& sessions_, unsigned long long elapsed_)
+{
+	Guest::Statistics t;
+	unsigned long long w = 0;
+	for (size_t i = 0; i < sessions_.size(); ++i)
+	{
+		const Guest::Statistics& s = sessions_[i]->statistics();
+		t.samples += s.samples;
+		t.replays += s.replays;
+		t.faults += s.faults;
+		t.decode += s.decode;
+		w += producers_[i].written();
+	}
+	std::sort(staleness.begin(), staleness.end());
+	double e = elapsed_ / 1000.0;
+	printf("%u %s producers at %u/s for %.1f s, stall %u%% partial %u%% burst %u%%\n",
+		options_.producers, options_.binary ? "binary" : "text", options_.rate, e,
+		options_.stall, options_.partial, options_.burst);
+	printf("written %llu, decoded %llu (%.0f/s), fresh pulls %llu of %llu, "
+		"replays %llu, faults %llu, lost %llu\n", w, t.samples, t.samples / e,
+		fresh, pulls, t.replays, t.faults, lost);
+	printf("parse %llu ns/sample\n", t.samples ? t.decode / t.samples : 0ULL);
+	printf("staleness ms: p50 %u, p90 %u, p99 %u, max %u, over 1 s %llu\n",
+		percentile(staleness, 50), percentile(staleness, 90),
+		percentile(staleness, 99), staleness.empty() ? 0 : staleness.back(), late);
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	Options o;
+	if (o.parse(argc, argv))
+	{
+		fprintf(stderr, "usage: %s [-B] [-n PRODUCERS] [-r RATE] [-t SECONDS] "
+			"[-i MS] [-s STALL%%] [-S MS] [-p PARTIAL%%] [-b BURST%%] [-v]\n", argv[0]);
+		return 2;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	if (!o.verbose)
+		snmp_disable_log();
+
+	boost::ptr_vector<Producer> p;
+	std::vector<Guest::Session* > s;
+	for (unsigned i = 0; i < o.producers; ++i)
+	{
+		p.push_back(new Producer(o, i + 1));
+		if (p.back().start())
+		{
+			perror("producer");
+			return 1;
+		}
+		s.push_back(new Guest::Session(p.back()));
+	}
+	Consumer c;
+	unsigned long long b = now(), f = b + o.seconds * 1000ULL;
+	for (unsigned long long d = b; now() < f;)
+	{
+		for (size_t i = 0; i < s.size(); ++i)
+		{
+			if (s[i]->lost())
+				continue;
+
+			unsigned long long x = s[i]->statistics().samples;
+			++c.pulls;
+			if (s[i]->pull())
+				c.account(*s[i], x);
+			else if (s[i]->lost())
+				++c.lost;
+		}
+		d += o.interval;
+		unsigned long long x = now();
+		if (d > x)
+			pause(d - x);
+	}
+	unsigned long long e = now() - b;
+	c.report(o, p, s, e);
+	for (size_t i = 0; i < s.size(); ++i)
+	{
+		delete s[i];
+		p[i].stop();
+	}
+	// NB. a session is lost only to long stalls.
+	return 0 == c.fresh || (0 == o.stall && 0 != c.lost);
+}
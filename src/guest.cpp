@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "guest.h"
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <poll.h>
+#include <unistd.h>
+
+namespace Rmond
+{
+namespace Guest
+{
+namespace
+{
+///////////////////////////////////////////////////////////////////////////////
+// struct Counter
+
+struct Counter
+{
+	const char* name;
+	COUNTER id;
+};
+
+const Counter NAMES[] =
+{
+	{"loadavg_15", LOADAVG_15},
+	{"loadavg_currExisting", LOADAVG_CURRENT_EXISTING},
+	{"diskstats_ios_in_process", DISKSTATS_IOS_IN_PROCESS},
+	{"diskstats_ms_writing", DISKSTATS_MS_WRITING},
+	{"meminfo_PageTables", MEMINFO_PAGETABLES},
+	{"meminfo_Mapped", MEMINFO_MAPPED},
+	{"meminfo_Dirty", MEMINFO_DIRTY},
+	{"meminfo_SUnreclaim", MEMINFO_SUNRECLAIM},
+	{"meminfo_Writeback", MEMINFO_WRITEBACK}
+};
+
+int lookup(const char* name_, size_t size_)
+{
+	for (size_t i = 0; i < sizeof(NAMES)/sizeof(NAMES[0]); ++i)
+	{
+		const char* n = NAMES[i].name;
+		if (0 == strncmp(n, name_, size_) && n[size_] == '\0')
+			return NAMES[i].id;
+	}
+	return -1;
+}
+
+unsigned long long le(const unsigned char* data_, size_t size_)
+{
+	unsigned long long output = 0;
+	while (size_-- > 0)
+	{
+		output = (output << 8) | data_[size_];
+	}
+	return output;
+}
+
+// NB. monotonic, milliseconds.
+unsigned long long now()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000ULL + t.tv_nsec / 1000000;
+}
+
+unsigned long long nanoseconds(const timespec& start_, const timespec& finish_)
+{
+	return (finish_.tv_sec - start_.tv_sec) * 1000000000ULL +
+		finish_.tv_nsec - start_.tv_nsec;
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Decoder
+
+Decoder::Decoder(): m_protocol(UNKNOWN), m_size(0)
+{
+}
+
+char* Decoder::tail(size_t& size_)
+{
+	size_ = BUFFER_SIZE - m_size - 1;
+	return m_buffer + m_size;
+}
+
+bool Decoder::commit(size_t size_)
+{
+	m_size += size_;
+	if (UNKNOWN == m_protocol && negotiate())
+		return false;
+
+	switch (m_protocol)
+	{
+	case TEXT:
+		return text();
+	case BINARY:
+		return frames();
+	default:
+		return false;
+	}
+}
+
+void Decoder::set(int counter_, int value_)
+{
+	if (0 > counter_ || COUNTERS <= counter_)
+		return;
+
+	m_sample.known.set(counter_);
+	m_sample.values[counter_] = value_;
+}
+
+bool Decoder::negotiate()
+{
+	if (0 == m_size)
+		return true;
+	if ('\0' != m_buffer[0])
+	{
+		m_protocol = TEXT;
+		return false;
+	}
+	if (PROTOCOL_MAGIC_SIZE + 1 > m_size)
+		return true;
+
+	if (0 != memcmp(m_buffer, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE) ||
+		PROTOCOL_VERSION != (unsigned char)m_buffer[PROTOCOL_MAGIC_SIZE])
+	{
+		snmp_log(LOG_ERR, LOG_PREFIX"unsupported guest protocol version %d\n",
+			(unsigned char)m_buffer[PROTOCOL_MAGIC_SIZE]);
+		m_protocol = BROKEN;
+		return true;
+	}
+	consume(PROTOCOL_MAGIC_SIZE + 1);
+	m_protocol = BINARY;
+	return false;
+}
+
+void Decoder::consume(size_t size_)
+{
+	memmove(m_buffer, m_buffer + size_, m_size - size_);
+	m_size -= size_;
+}
+
+bool Decoder::text()
+{
+	m_buffer[m_size] = '\0';
+	char* e = strrchr(m_buffer, '\n');
+	if (NULL == e)
+	{
+		if (BUFFER_SIZE - 1 == m_size)
+			m_size = 0;
+		return false;
+	}
+	// NB. only the last complete line matters, the older ones are stale.
+	*e = '\0';
+	char* b = strrchr(m_buffer, '\n');
+	b = (NULL == b ? m_buffer : b + 1);
+	while (b < e)
+	{
+		char* c = strchr(b, ':');
+		if (NULL == c)
+			break;
+		char* n = strchr(c, ' ');
+		set(lookup(b, c - b), strtol(c + 1, NULL, 10));
+		if (NULL == n)
+			break;
+		b = n + 1;
+	}
+	consume(e - m_buffer + 1);
+	return true;
+}
+
+bool Decoder::frames()
+{
+	bool output = false;
+	const unsigned char* b = (const unsigned char* )m_buffer;
+	size_t x = 0;
+	while (m_size - x >= PROTOCOL_HEADER_SIZE)
+	{
+		size_t n = le(b + x, PROTOCOL_HEADER_SIZE - 1);
+		if (0 == n || BUFFER_SIZE - 1 < n + PROTOCOL_HEADER_SIZE - 1)
+		{
+			snmp_log(LOG_ERR, LOG_PREFIX"bad guest frame of %zu bytes\n", n);
+			m_protocol = BROKEN;
+			return output;
+		}
+		if (m_size - x < n + PROTOCOL_HEADER_SIZE - 1)
+			break;
+
+		const unsigned char* p = b + x + PROTOCOL_HEADER_SIZE;
+		switch (b[x + PROTOCOL_HEADER_SIZE - 1])
+		{
+		case FRAME_DICTIONARY:
+			dictionary(p, n - 1);
+			break;
+		case FRAME_SAMPLE:
+			output = sample(p, n - 1) || output;
+			break;
+		}
+		x += n + PROTOCOL_HEADER_SIZE - 1;
+	}
+	consume(x);
+	return output;
+}
+
+void Decoder::dictionary(const unsigned char* data_, size_t size_)
+{
+	m_dictionary.clear();
+	if (2 > size_)
+		return;
+
+	size_t c = le(data_, 2), x = 2;
+	for (; c > 0 && x + 2 <= size_; --c)
+	{
+		size_t n = data_[x + 1];
+		if (x + 2 + n > size_)
+			break;
+
+		m_dictionary.push_back(counter_type(
+			lookup((const char* )data_ + x + 2, n),
+			DOUBLE_TYPE == data_[x]));
+		x += 2 + n;
+	}
+}
+
+bool Decoder::sample(const unsigned char* data_, size_t size_)
+{
+	if (10 > size_)
+		return false;
+
+	m_sample.stamp = le(data_, 8);
+	size_t c = std::min<size_t>(le(data_ + 8, 2), m_dictionary.size());
+	c = std::min<size_t>(c, (size_ - 10) / PROTOCOL_VALUE_SIZE);
+	const unsigned char* v = data_ + 10;
+	for (size_t i = 0; i < c; ++i, v += PROTOCOL_VALUE_SIZE)
+	{
+		const counter_type& t = m_dictionary[i];
+		if (0 > t.first)
+			continue;
+
+		unsigned long long x = le(v, PROTOCOL_VALUE_SIZE);
+		if (t.second)
+		{
+			double d;
+			memcpy(&d, &x, sizeof(d));
+			set(t.first, (int)d);
+		}
+		else
+			set(t.first, (int)(long long)x);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Channel
+
+Channel::~Channel()
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Session
+
+Session::Session(Channel& channel_): m_channel(&channel_), m_errors(0), m_seen(0)
+{
+}
+
+Session::~Session()
+{
+	report();
+}
+
+bool Session::pull()
+{
+	int faults = 0;
+
+	if (0 == ++m_statistics.pulls % REPORT_PERIOD)
+		report();
+	while (faults != MAX_FAULTS && !m_decoder.bad())
+	{
+		size_t z = 0;
+		char* t = m_decoder.tail(z);
+		if (0 == z)
+		{
+			snmp_log(LOG_ERR, LOG_PREFIX"guest buffer overflow\n");
+			break;
+		}
+		int n = read(m_channel->fd(), t, std::min<size_t>(z, READ_SIZE));
+		if (-1 == n && EAGAIN == errno)
+		{
+			// NB. only the binary transport keeps silent on unchanged
+			// counters, a text one that did not write is late and is
+			// waited for.
+			unsigned long long a = now() - m_seen;
+			if (m_decoder.binary() && MAX_SILENCE > a && !sample().empty())
+			{
+				++m_statistics.replays;
+				m_statistics.staleness = std::max(m_statistics.staleness, a);
+				return true;
+			}
+			pollfd p = {m_channel->fd(), POLLIN, 0};
+			poll(&p, 1, POLL_TIMEOUT);
+			++faults;
+			continue;
+		}
+		if (-1 == n)
+		{
+			snmp_log(LOG_ERR, LOG_PREFIX"read error %s\n", strerror(errno));
+			++m_statistics.faults;
+			m_errors = m_channel->alive() ? m_errors + 1 : MAX_FAULTS;
+			return false;
+		}
+		// NB. the producer has closed its end.
+		if (0 == n)
+			break;
+
+		timespec b, e;
+		clock_gettime(CLOCK_MONOTONIC, &b);
+		bool x = m_decoder.commit(n);
+		clock_gettime(CLOCK_MONOTONIC, &e);
+		m_statistics.decode += nanoseconds(b, e);
+		if (x)
+		{
+			++m_statistics.samples;
+			m_errors = 0;
+			m_seen = now();
+			return true;
+		}
+		// unlikely case of incomplete sample
+		++faults;
+	}
+	snmp_log(LOG_ERR, LOG_PREFIX"could not read whole sample\n");
+	++m_statistics.faults;
+	// NB. a broken stream or a gone producer never recovers, let the
+	// caller reconnect.
+	m_errors = m_decoder.bad() || !m_channel->alive() ? MAX_FAULTS : m_errors + 1;
+	return false;
+}
+
+void Session::report() const
+{
+	DEBUGMSGTL((TOKEN_PREFIX"guest", "pulls %llu, samples %llu, replays %llu, "
+		"faults %llu, decode %llu ns/sample, staleness max %llu ms\n",
+		m_statistics.pulls, m_statistics.samples, m_statistics.replays,
+		m_statistics.faults, m_statistics.samples ?
+			m_statistics.decode / m_statistics.samples : 0ULL,
+		m_statistics.staleness));
+}
+
+} // namespace Guest
+} // namespace Rmond
+
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef GUEST_H
+#define GUEST_H
+
+#include "mib.h"
+#include "protocol.h"
+#include <bitset>
+#include <algorithm>
+#include <boost/noncopyable.hpp>
+
+namespace Rmond
+{
+namespace Guest
+{
+// NB. the counters a linux guest reports, VE::Counters::Linux keeps them
+// in the same order.
+enum COUNTER
+{
+	LOADAVG_15,
+	LOADAVG_CURRENT_EXISTING,
+	DISKSTATS_IOS_IN_PROCESS,
+	DISKSTATS_MS_WRITING,
+	MEMINFO_PAGETABLES,
+	MEMINFO_MAPPED,
+	MEMINFO_DIRTY,
+	MEMINFO_SUNRECLAIM,
+	MEMINFO_WRITEBACK,
+	COUNTERS
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Sample
+// NB. the latest value of every counter the guest has reported so far.
+
+struct Sample
+{
+	Sample(): stamp()
+	{
+		std::fill(values, values + COUNTERS, 0);
+	}
+
+	bool empty() const
+	{
+		return known.none();
+	}
+
+	// NB. the guest monotonic time of the last sample, nanoseconds. the
+	// text protocol has no timestamps thus it is always 0 there.
+	unsigned long long stamp;
+	std::bitset<COUNTERS> known;
+	int values[COUNTERS];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Decoder
+
+struct Decoder: boost::noncopyable
+{
+	Decoder();
+
+	// NB. the free space of the buffer for the next read.
+	char* tail(size_t& size_);
+	// NB. accounts size_ bytes read into the tail and decodes the latest
+	// complete sample. returns true if a sample was decoded.
+	bool commit(size_t size_);
+	const Sample& sample() const
+	{
+		return m_sample;
+	}
+	bool bad() const
+	{
+		return BROKEN == m_protocol;
+	}
+	bool binary() const
+	{
+		return BINARY == m_protocol;
+	}
+private:
+	enum PROTOCOL
+	{
+		UNKNOWN,
+		TEXT,
+		BINARY,
+		BROKEN
+	};
+	enum
+	{
+		BUFFER_SIZE = 16384
+	};
+	typedef std::pair<int, bool> counter_type;
+
+	bool negotiate();
+	bool text();
+	bool frames();
+	void dictionary(const unsigned char* data_, size_t size_);
+	bool sample(const unsigned char* data_, size_t size_);
+	void consume(size_t size_);
+	void set(int counter_, int value_);
+
+	PROTOCOL m_protocol;
+	size_t m_size;
+	Sample m_sample;
+	std::vector<counter_type> m_dictionary;
+	char m_buffer[BUFFER_SIZE];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Channel
+// NB. the readable end of a guest transport. the descriptor must be
+// non-blocking. a VM connection is one, the producers of drs-guest-sim
+// are the others.
+
+struct Channel
+{
+	virtual ~Channel();
+
+	virtual int fd() const = 0;
+	// NB. false once the producer is gone for good.
+	virtual bool alive() = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Statistics
+
+struct Statistics
+{
+	Statistics(): pulls(), samples(), replays(), faults(), decode(),
+		staleness()
+	{
+	}
+
+	unsigned long long pulls;
+	unsigned long long samples;
+	unsigned long long replays;
+	unsigned long long faults;
+	// NB. nanoseconds spent in the decoder.
+	unsigned long long decode;
+	// NB. the age of the oldest replayed sample, milliseconds.
+	unsigned long long staleness;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Session
+
+struct Session: boost::noncopyable
+{
+	explicit Session(Channel& channel_);
+	~Session();
+
+	// NB. returns true if sample() holds a fresh or a replayed sample.
+	bool pull();
+	const Sample& sample() const
+	{
+		return m_decoder.sample();
+	}
+	bool lost() const
+	{
+		return MAX_FAULTS == m_errors;
+	}
+	int errors() const
+	{
+		return m_errors;
+	}
+	const Statistics& statistics() const
+	{
+		return m_statistics;
+	}
+private:
+	enum
+	{
+		MAX_FAULTS = 3,
+		READ_SIZE = 1024,
+		POLL_TIMEOUT = 1000,
+		REPORT_PERIOD = 1000,
+		// NB. the transport keeps silent while the counters stay the same
+		// and sends a keepalive every PROTOCOL_KEEPALIVE periods of 1 second.
+		MAX_SILENCE = 3000*PROTOCOL_KEEPALIVE
+	};
+
+	void report() const;
+
+	Channel* m_channel;
+	Decoder m_decoder;
+	int m_errors;
+	unsigned long long m_seen;
+	Statistics m_statistics;
+};
+
+} // namespace Guest
+} // namespace Rmond
+
+#endif // GUEST_H
+
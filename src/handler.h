@@ -198,7 +198,7 @@ void Unit<T>::reserve()
 				cannot(SNMP_ERR_INCONSISTENTVALUE);
 			return;
 		}
-		r.reset(new typename table_type::tuple_type(c));
+		r = table_type::make(c);
 		if (NULL == r.get())
 			return cannotInsert();
 
@@ -272,6 +272,47 @@ void Unit<T>::cannotExtract()
 				 NULL, 0);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Row
+// NB. the GET of a batch. the container_table helper leaves the row it found
+// in every varbind, and the varbinds of a GETBULK repetition name the
+// columns of one row. the cells are filled straight from the row without a
+// copy of its pointer or a search, the table is taken once for the batch.
+
+template<class T>
+struct Row: private Details
+{
+	typedef Table::Unit<T> table_type;
+
+	Row(request_type* request_, const table_type& table_):
+		Details(request_), m_request(request_), m_table(&table_)
+	{
+	}
+
+	// NB. returns true when the request has no row of its own.
+	bool get();
+private:
+	request_type* m_request;
+	const table_type* m_table;
+};
+
+template<class T>
+bool Row<T>::get()
+{
+	typename table_type::tuple_type* r = m_table->peek(m_request);
+	if (NULL == r)
+		return true;
+
+	cell_type* c = cell();
+	if (NULL == c)
+		return true;
+
+	if (r->get(c->colnum, *m_request->requestvb))
+		cannot(SNMP_NOSUCHOBJECT);
+
+	return false;
+}
+
 } // namespace Request
 
 namespace Handler
@@ -288,13 +329,29 @@ struct Base
 	{
 	}
 
-	void operator()(int mode_, netsnmp_request_info* request_)
+	// NB. a GET is the same for every handler, its varbinds go through
+	// the Row pass and only those without a row fall back to the handler.
+	void operator()(int mode_, netsnmp_request_info* requests_)
 	{
 		tableSP_type x = m_table.lock();
 		if (NULL == x.get())
 			return;
 
-		static_cast<P* >(this)->do_(mode_, Request::Unit<T>(request_, *x));
+		for (; NULL != requests_; requests_ = requests_->next)
+		{
+			if (0 != requests_->processed)
+				continue;
+
+			if (0 != requests_->status)
+			{
+				// already got an error.
+				break;
+			}
+			if (MODE_GET == mode_ && !Request::Row<T>(requests_, *x).get())
+				continue;
+
+			static_cast<P* >(this)->do_(mode_, Request::Unit<T>(requests_, *x));
+		}
 	}
 private:
 	boost::weak_ptr<Table::Unit<T> > m_table;
@@ -22,19 +22,17 @@
  */
 
 #include "host.h"
+#include "proxy.h"
 #include "system.h"
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
 #include <boost/assign/list_of.hpp>
 #include <boost/algorithm/string.hpp>
+#include <limits>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
-
-extern netsnmp_session* main_session;
-extern "C"
-{
-int handle_pdu(netsnmp_agent_session* );
-};
+#include <algorithm>
 
 namespace Rmond
 {
@@ -102,46 +100,6 @@ VE::Unit* make(PRL_HANDLE h_, const VE::space_type& ves_)
 	return new VE::Unit(h_, k, ves_);
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// struct Proxy
-
-struct Proxy: Value::Composite::Base
-{
-	explicit Proxy(const Oid_type& name_);
-
-	Value::Provider* snapshot(const Value::Metrix_type& metrix_) const;
-private:
-	Oid_type m_name;
-};
-
-Proxy::Proxy(const Oid_type& name_): m_name(name_)
-{
-}
-
-Value::Provider* Proxy::snapshot(const Value::Metrix_type& metrix_) const
-{
-	if (!metrix_.empty() && metrix_.count(m_name) == 0)
-		return NULL;
-
-	netsnmp_pdu* u = snmp_pdu_create(SNMP_MSG_GET);
-	if (NULL == u)
-		return NULL;
-
-	Value::Provider* output = NULL;
-	snmp_add_null_var(u, &m_name[0], m_name.size());
-	u->flags |= UCD_MSG_FLAG_ALWAYS_IN_VIEW;
-	netsnmp_agent_session* s = init_agent_snmp_session(main_session, u);
-	snmp_free_pdu(u);
-	int e = handle_pdu(s);
-	if (SNMP_ERR_NOERROR == e)
-	{
-		output = new Value::Named(m_name, s->pdu->variables);
-		s->pdu->variables = NULL;
-	}
-	free_agent_snmp_session(s);
-	return output;
-}
-
 } // namespace
 
 namespace Scalar
@@ -23,6 +23,7 @@
 
 #include "host.h"
 #include "sink.h"
+#include "feed.h"
 #include <limits>
 #include "system.h"
 #include "container.h"
@@ -46,6 +47,54 @@ enum
 	COLLECT_TIMEOUT = 1
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Fanout
+// NB. encodes the VEs of a large host on several threads. the VEs are split
+// into contiguous partitions, a stream each, and the streams are joined in
+// the VE order. RMOND_WORKERS limits the threads, 0 turns it off.
+
+struct Fanout: boost::noncopyable
+{
+	typedef std::vector<VE::UnitSP> veList_type;
+
+	Fanout();
+	~Fanout();
+
+	void stream(const veList_type& ves_, const Value::Filter& filter_, Value::Stream& dst_);
+private:
+	enum
+	{
+		MIN_PARTITION = 32,
+		MAX_WORKERS = 8
+	};
+	struct Job
+	{
+		void operator()() const;
+
+		const veList_type* ves;
+		size_t begin;
+		size_t end;
+		const Value::Filter* filter;
+		Value::Stream* result;
+	};
+
+	void start();
+	void work();
+	static void* loop(void* argv_);
+
+	bool m_stop;
+	bool m_started;
+	size_t m_next;
+	size_t m_left;
+	pthread_mutex_t m_busy;
+	pthread_mutex_t m_lock;
+	ConditionalVariable m_work;
+	ConditionalVariable m_done;
+	std::vector<Job> m_jobs;
+	std::vector<pthread_t> m_threads;
+	std::vector<Value::Stream> m_parts;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Server declaration
 
@@ -58,7 +107,16 @@ struct Server: boost::enable_shared_from_this<Server>, Details::Automat<Server,
 	void performance(PRL_HANDLE event_);
 
 	bool attach(PRL_HANDLE host_);
-	void  snapshot(const Value::Metrix_type& metrix_, boost::ptr_list<Value::Provider>& dst_) const;
+	void stream(const Value::Filter& filter_, Value::Stream& dst_) const;
+	void publish(Export::Unit& dst_) const
+	{
+		dst_.publish(m_host.first, m_ves.first);
+	}
+	void feed(Feed::Unit& dst_, const Sink::table_type::tuple_type& sink_,
+		boost::shared_ptr<Value::Filter> filter_) const
+	{
+		dst_.push(sink_, filter_, m_host.first, m_ves.first);
+	}
 	static ServerSP inject();
 
 	typedef mpl::vector<
@@ -90,6 +148,7 @@ private:
 	static PRL_RESULT PRL_CALL handle(PRL_HANDLE , PRL_VOID_PTR );
 	
 	PRL_HANDLE m_psdk;
+	mutable Fanout m_fanout;
 	std::pair<VE::space_type, veMap_type> m_ves;
 	std::pair<Host::space_type, Host::UnitSP> m_host;
 };
@@ -203,6 +262,38 @@ private:
 	Sink::ReaperSP m_reaper;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Publish
+
+struct Publish
+{
+	Publish(ServerSP server_, Export::UnitSP export_):
+		m_server(server_), m_export(export_)
+	{
+	}
+
+	void operator()() const
+	{
+		m_server->publish(*m_export);
+		Central::schedule(COLLECT_TIMEOUT, *this);
+	}
+private:
+	ServerSP m_server;
+	Export::UnitSP m_export;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Census
+
+struct Census
+{
+	void operator()() const
+	{
+		Table::Census::report();
+		Central::schedule(COLLECT_TIMEOUT, *this);
+	}
+};
+
 } // namespace Handler
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -366,25 +457,154 @@ void Server::erase(PRL_HANDLE event_)
 	m_host.second->ves(m_ves.second.size());
 }
 
-void Server::snapshot(const Value::Metrix_type& metrix_, boost::ptr_list<Value::Provider>& dst_) const
+void Server::stream(const Value::Filter& filter_, Value::Stream& dst_) const
 {
-	Lock a(g_big);
-	if (NULL == m_host.second.get())
-		return;
+	// NB. the values are read without a lock, the global ones are taken
+	// only to pick the host and the VEs to report.
+	Host::UnitSP h;
+	Fanout::veList_type v;
+	{
+		Lock a(g_big);
+		if (NULL == m_host.second.get())
+			return;
 
-	Lock b(g_ves);
-	Value::Provider* h = m_host.second->snapshot(metrix_);
-	if (NULL != h)
-		dst_.push_back(h);
+		h = m_host.second;
+		v.reserve(m_ves.second.size());
+		BOOST_FOREACH(veMap_type::const_reference r, m_ves.second)
+		{
+			v.push_back(r.second);
+		}
+	}
+	h->stream(filter_, dst_);
+	dst_.mark();
+	m_fanout.stream(v, filter_, dst_);
+}
 
-	BOOST_FOREACH(veMap_type::const_reference r, m_ves.second)
+///////////////////////////////////////////////////////////////////////////////
+// struct Fanout
+
+void Fanout::Job::operator()() const
+{
+	result->clear();
+	for (size_t i = begin; i < end; ++i)
 	{
-		Value::Provider* u = r.second->snapshot(metrix_);
-		if (NULL != u)
-			dst_.push_back(u);
+		(*ves)[i]->stream(*filter, *result);
+		result->mark();
 	}
 }
 
+Fanout::Fanout(): m_stop(), m_started(), m_next(), m_left()
+{
+	pthread_mutex_init(&m_busy, NULL);
+	pthread_mutex_init(&m_lock, NULL);
+}
+
+Fanout::~Fanout()
+{
+	Lock g(m_lock);
+	m_stop = true;
+	m_work.signal();
+	g.leave();
+	BOOST_FOREACH(pthread_t t, m_threads)
+	{
+		pthread_join(t, NULL);
+	}
+	pthread_mutex_destroy(&m_lock);
+	pthread_mutex_destroy(&m_busy);
+}
+
+void Fanout::start()
+{
+	m_started = true;
+	long n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	const char* x = getenv("RMOND_WORKERS");
+	if (NULL != x)
+		n = atol(x);
+
+	n = std::max(0L, std::min<long>(n, MAX_WORKERS));
+	for (long i = 0; i < n; ++i)
+	{
+		pthread_t t;
+		int e = pthread_create(&t, NULL, &Fanout::loop, this);
+		if (0 != e)
+		{
+			snmp_log(LOG_ERR, LOG_PREFIX"cannot start a snapshot worker: 0x%x\n", e);
+			break;
+		}
+		m_threads.push_back(t);
+	}
+}
+
+// NB. called under m_lock.
+void Fanout::work()
+{
+	while (m_next < m_jobs.size())
+	{
+		const Job& j = m_jobs[m_next++];
+		pthread_mutex_unlock(&m_lock);
+		j();
+		pthread_mutex_lock(&m_lock);
+		if (0 == --m_left)
+			m_done.signal();
+	}
+}
+
+void* Fanout::loop(void* argv_)
+{
+	Fanout* f = (Fanout* )argv_;
+	Lock g(f->m_lock);
+	while (!f->m_stop)
+	{
+		f->work();
+		if (!f->m_stop)
+			f->m_work.wait(f->m_lock);
+	}
+	return NULL;
+}
+
+void Fanout::stream(const veList_type& ves_, const Value::Filter& filter_, Value::Stream& dst_)
+{
+	Lock a(m_busy);
+	if (!m_started)
+		start();
+
+	size_t n = std::min(m_threads.size() + 1, ves_.size() / MIN_PARTITION);
+	if (2 > n)
+	{
+		BOOST_FOREACH(const VE::UnitSP& v, ves_)
+		{
+			v->stream(filter_, dst_);
+			dst_.mark();
+		}
+		return;
+	}
+	Lock b(m_lock);
+	m_parts.resize(n);
+	m_jobs.resize(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		Job& j = m_jobs[i];
+		j.ves = &ves_;
+		j.begin = ves_.size() * i / n;
+		j.end = ves_.size() * (i + 1) / n;
+		j.filter = &filter_;
+		j.result = &m_parts[i];
+	}
+	m_next = 0;
+	m_left = n;
+	m_work.signal();
+	work();
+	while (0 < m_left)
+		m_done.wait(m_lock);
+
+	b.leave();
+	BOOST_FOREACH(const Value::Stream& s, m_parts)
+	{
+		dst_.append(s);
+	}
+	DEBUGMSGTL((TOKEN_PREFIX"trap", "%zu VEs in %zu partitions\n", ves_.size(), n));
+}
+
 PRL_RESULT PRL_CALL Server::handle(PRL_HANDLE event_, PRL_VOID_PTR user_)
 {
 	ServerSP s;
@@ -408,6 +628,7 @@ PRL_RESULT PRL_CALL Server::handle(PRL_HANDLE event_, PRL_VOID_PTR user_)
 ///////////////////////////////////////////////////////////////////////////////
 // struct Central
 
+Scheduler::UnitSP Central::s_sender;
 Scheduler::UnitSP Central::s_scheduler;
 
 bool Central::init()
@@ -442,8 +663,20 @@ bool Central::init()
 			if (y->go() || y->push(Handler::Link(s)))
 				break;
 
+			Scheduler::UnitSP z(new Scheduler::Unit);
+			if (z->go())
+			{
+				y->stop();
+				break;
+			}
 			y->push(Handler::Reaper(x));
+			y->push(Handler::Census());
+			Export::UnitSP e = Export::Unit::inject();
+			if (NULL != e.get())
+				y->push(Handler::Publish(s, e));
+
 			s_scheduler = y;
+			s_sender = z;
 			return false;
 		} while(false);
 	}
@@ -455,13 +688,17 @@ void Central::fini()
 {
 	Lock g(g_big);
 	Scheduler::UnitSP x = s_scheduler;
+	Scheduler::UnitSP y = s_sender;
 	if (NULL != x.get())
 	{
 		s_scheduler.reset();
+		s_sender.reset();
 		g_active.clear();
 		g.leave();
+		VE::Unit::fini();
 		PrlApi_Deinit();
 		x->stop();
+		y->stop();
 	}
 }
 
@@ -489,6 +726,16 @@ bool Central::schedule(unsigned timeout_, Scheduler::Queue::job_type job_)
 	return NULL == x.get() || x->push(timeout_, job_);
 }
 
+bool Central::send(Scheduler::Queue::job_type job_)
+{
+	Scheduler::UnitSP x;
+	{
+		Lock g(g_big);
+		x = s_sender;
+	}
+	return NULL == x.get() || x->push(job_);
+}
+
 namespace Sink
 {
 ///////////////////////////////////////////////////////////////////////////////
@@ -500,30 +747,88 @@ void Inform::push(table_type::tupleSP_type target_) const
 	if (NULL == z.get())
 		return;
 
-	Unit u(target_, m_metrix);
+	Unit u(target_, m_metrix, *m_buffer->session, m_buffer->head);
 	if (u.bad())
 		return;
 
-	int n = u.limit(), i = 0;
-	boost::ptr_list<Value::Provider> d;
-	z->snapshot(u.metrix(), d);
-	netsnmp_variable_list a = {}, *b = &a;
-	BOOST_FOREACH(const Value::Provider& p, d)
+	// NB. the filter is compiled again only when a metric changes.
+	unsigned long long g = Table::Generation<Metrix::TABLE>::get();
+	if (NULL == m_buffer->filter.get() || m_buffer->generation != g)
 	{
-		netsnmp_variable_list* v = p.make();
-		if (NULL == v)
-			continue;
-		b->next_variable = v;
-		for (; b->next_variable != NULL; b = b->next_variable) {}
-		if (++i < n)
-			continue;
+		m_buffer->filter.reset(new Value::Filter(u.metrix()));
+		m_buffer->generation = g;
+	}
+	if (u.stream())
+	{
+		if (NULL == m_buffer->feed.get())
+			m_buffer->feed.reset(new Feed::Unit);
 
-		u.push(a.next_variable);
-		i = 0;
-		b = &a;
-		a.next_variable = NULL;
+		z->feed(*m_buffer->feed, *target_, m_buffer->filter);
+		return;
+	}
+	timespec c;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &c);
+	Value::Filter& f = *m_buffer->filter;
+	Share::streamSP_type y = m_share->find(f.metrix());
+	bool h = (NULL != y.get());
+	if (!h)
+	{
+		y = m_share->make();
+		z->stream(f, *y);
+		m_share->keep(f.metrix(), y);
+	}
+	// NB. a delta of N sends all the values every Nth inform. the delta
+	// remembers the varbinds as they are encoded, thus it is forgotten
+	// when the traps of the previous inform did not all go, or have not
+	// gone yet.
+	BatchSP& w = m_buffer->batch;
+	bool r = NULL != w.get() && (!w.unique() || w->failed());
+	const Value::Stream* s = y.get();
+	int d = target_->get<DELTA>();
+	if (0 < d)
+	{
+		if (0 == m_buffer->tick++ % d || r)
+			m_buffer->delta.clear();
+
+		m_buffer->data.clear();
+		m_buffer->data.append(*y, m_buffer->delta);
+		s = &m_buffer->data;
+	}
+	else
+		m_buffer->tick = 0;
+
+	DEBUGMSGTL((TOKEN_PREFIX"trap", "%s snapshot, %zu bytes, %u unchanged varbinds\n",
+		h ? "shared" : "own", s->size(), s->same()));
+	// NB. the limit counts the composites, i.e. the host and the VEs.
+	// NB. the batch of the previous inform may still wait for the sender.
+	if (NULL == w.get() || !w.unique())
+		w.reset(new Batch(m_buffer->session));
+
+	w->clear();
+	size_t n = u.limit(), q = u.budget();
+	unsigned k = 0;
+	bool x = false;
+	for (size_t b = 0, e = 0; b < s->size() && 0 < n; b = e)
+	{
+		e = s->cut(b, n, q);
+		if (!u.push(s->data() + b, e - b, *w))
+			++k;
+		else
+			x = true;
 	}
-	u.push(a.next_variable);
+	// NB. a trap that cannot be framed is not sent either.
+	if (x && 0 < d)
+		m_buffer->delta.clear();
+
+	if (0 < k && Central::send(Flush(w)))
+		w->send();
+
+	// NB. the encoding cost only, the sender thread sends the traps. it
+	// compares with the rates under the feed token.
+	timespec e;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &e);
+	DEBUGMSGTL((TOKEN_PREFIX"trap", "%u traps encoded in %llu ns\n", k,
+		(e.tv_sec - c.tv_sec) * 1000000000ULL + e.tv_nsec - c.tv_nsec));
 }
 
 } // namespace Sink
@@ -54,7 +54,10 @@ struct Central
 	static Oid_type product();
 	static SchedulerSP scheduler();
 	static bool schedule(unsigned timeout_, Scheduler::Queue::job_type job_);
+	// NB. runs the job on the thread that sends the traps.
+	static bool send(Scheduler::Queue::job_type job_);
 private:
+	static Scheduler::UnitSP s_sender;
 	static Scheduler::UnitSP s_scheduler;
 };
 
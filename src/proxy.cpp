@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "proxy.h"
+#include "system.h"
+#include <ctime>
+#include <limits>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
+
+extern netsnmp_session* main_session;
+extern "C"
+{
+int handle_pdu(netsnmp_agent_session* );
+};
+
+namespace Rmond
+{
+namespace Host
+{
+Reader::read_type Reader::find(const Oid_type& name_, const char*& key_)
+{
+	static const struct
+	{
+		oid name[11];
+		size_t length;
+		read_type read;
+		const char* key;
+	} s_known[] =
+	{
+		{{1, 3, 6, 1, 4, 1, 2021, 4, 3, 0}, 10, &Reader::meminfo, "SwapTotal:"},
+		{{1, 3, 6, 1, 4, 1, 2021, 4, 4, 0}, 10, &Reader::meminfo, "SwapFree:"},
+		{{1, 3, 6, 1, 4, 1, 2021, 4, 5, 0}, 10, &Reader::meminfo, "MemTotal:"},
+		{{1, 3, 6, 1, 4, 1, 2021, 4, 6, 0}, 10, &Reader::meminfo, "MemFree:"},
+		{{1, 3, 6, 1, 4, 1, 2021, 4, 14, 0}, 10, &Reader::meminfo, "Buffers:"},
+		{{1, 3, 6, 1, 4, 1, 2021, 4, 15, 0}, 10, &Reader::meminfo, "Cached:"},
+		{{1, 3, 6, 1, 4, 1, 2021, 10, 1, 3, 1}, 11, &Reader::loadavg, "0"},
+		{{1, 3, 6, 1, 4, 1, 2021, 10, 1, 3, 2}, 11, &Reader::loadavg, "1"},
+		{{1, 3, 6, 1, 4, 1, 2021, 10, 1, 3, 3}, 11, &Reader::loadavg, "2"}
+	};
+	for (size_t i = 0; i < sizeof(s_known) / sizeof(s_known[0]); ++i)
+	{
+		if (name_.size() == s_known[i].length &&
+			std::equal(name_.begin(), name_.end(), s_known[i].name))
+		{
+			key_ = s_known[i].key;
+			return s_known[i].read;
+		}
+	}
+	return NULL;
+}
+
+netsnmp_variable_list* Reader::meminfo(const char* key_)
+{
+	std::ifstream f("/proc/meminfo");
+	std::string k;
+	long v;
+	while (f >> k >> v)
+	{
+		f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		if (k != key_)
+			continue;
+
+		netsnmp_variable_list* output = SNMP_MALLOC_TYPEDEF(netsnmp_variable_list);
+		if (NULL != output)
+		{
+			// NB. kB, the same as UCD reports.
+			int x = std::min<long>(v, std::numeric_limits<int>::max());
+			snmp_set_var_typed_value(output, ASN_INTEGER, (u_char* )&x, sizeof(x));
+		}
+		return output;
+	}
+	return NULL;
+}
+
+netsnmp_variable_list* Reader::loadavg(const char* key_)
+{
+	std::ifstream f("/proc/loadavg");
+	double a[3];
+	if (!(f >> a[0] >> a[1] >> a[2]))
+		return NULL;
+
+	char b[16];
+	int n = snprintf(b, sizeof(b), "%.2f", a[*key_ - '0']);
+	netsnmp_variable_list* output = SNMP_MALLOC_TYPEDEF(netsnmp_variable_list);
+	if (NULL != output)
+		snmp_set_var_typed_value(output, ASN_OCTET_STR, (u_char* )b, n);
+
+	return output;
+}
+
+Proxy::Proxy(const Oid_type& name_): m_name(name_), m_read(NULL),
+	m_key(NULL), m_tick(-1), m_value(NULL)
+{
+	pthread_mutex_init(&m_lock, NULL);
+	const char* x = getenv("RMOND_PROXY");
+	if (NULL == x || 0 != strcmp(x, "agent"))
+		m_read = Reader::find(m_name, m_key);
+}
+
+Proxy::~Proxy()
+{
+	snmp_free_varbind(m_value);
+	pthread_mutex_destroy(&m_lock);
+}
+
+netsnmp_variable_list* Proxy::dispatch() const
+{
+	netsnmp_pdu* u = snmp_pdu_create(SNMP_MSG_GET);
+	if (NULL == u)
+		return NULL;
+
+	netsnmp_variable_list* output = NULL;
+	snmp_add_null_var(u, &m_name[0], m_name.size());
+	u->flags |= UCD_MSG_FLAG_ALWAYS_IN_VIEW;
+	netsnmp_agent_session* s = init_agent_snmp_session(main_session, u);
+	snmp_free_pdu(u);
+	int e = handle_pdu(s);
+	if (SNMP_ERR_NOERROR == e)
+	{
+		output = s->pdu->variables;
+		s->pdu->variables = NULL;
+	}
+	free_agent_snmp_session(s);
+	return output;
+}
+
+Value::Provider* Proxy::snapshot(const Value::Metrix_type& metrix_) const
+{
+	if (!metrix_.empty() && metrix_.count(m_name) == 0)
+		return NULL;
+
+	timespec b, e;
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	Lock g(m_lock);
+	if (m_tick != b.tv_sec)
+	{
+		// NB. the fetch may go through the agent, thus it runs out of the
+		// lock. the tick is taken first: the other traps of the second get
+		// the previous value meanwhile and a failure is kept till the next.
+		m_tick = b.tv_sec;
+		g.leave();
+		netsnmp_variable_list* y = NULL == m_read ? dispatch() : m_read(m_key);
+		g.enter();
+		if (m_tick == b.tv_sec)
+			std::swap(m_value, y);
+
+		snmp_free_varbind(y);
+	}
+	netsnmp_variable_list* x = snmp_clone_varbind(m_value);
+	g.leave();
+	clock_gettime(CLOCK_MONOTONIC, &e);
+	DEBUGMSGTL((TOKEN_PREFIX"proxy", "%s value in %ld ns\n",
+		NULL == m_read ? "agent" : "direct",
+		(long)((e.tv_sec - b.tv_sec) * 1000000000L + e.tv_nsec - b.tv_nsec)));
+	if (NULL == x)
+		return NULL;
+
+	return new Value::Named(m_name, x);
+}
+
+void Proxy::stream(const Value::Filter& filter_, Value::Stream& dst_) const
+{
+	if (!filter_.match(m_name))
+		return;
+
+	std::auto_ptr<Value::Provider> x(snapshot(Value::Metrix_type()));
+	if (NULL == x.get())
+		return;
+
+	Table::Census::count(Table::Census::TREE);
+	dst_.put(*x);
+}
+
+} // namespace Host
+} // namespace Rmond
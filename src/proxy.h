@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "value.h"
+#include <pthread.h>
+
+namespace Rmond
+{
+namespace Host
+{
+///////////////////////////////////////////////////////////////////////////////
+// struct Reader
+// NB. reads a UCD-SNMP-MIB scalar straight from /proc instead of running a
+// GET through the whole agent.
+
+struct Reader
+{
+	typedef netsnmp_variable_list* (*read_type)(const char* key_);
+
+	// NB. returns NULL for a name without a reader.
+	static read_type find(const Oid_type& name_, const char*& key_);
+private:
+	static netsnmp_variable_list* meminfo(const char* key_);
+	static netsnmp_variable_list* loadavg(const char* key_);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Proxy
+// NB. the value is read at most once a second and every trap of that second
+// gets a copy. names without a reader go through the agent, as do all of
+// them when RMOND_PROXY is "agent".
+
+struct Proxy: Value::Composite::Base
+{
+	explicit Proxy(const Oid_type& name_);
+	~Proxy();
+
+	Value::Provider* snapshot(const Value::Metrix_type& metrix_) const;
+	void stream(const Value::Filter& filter_, Value::Stream& dst_) const;
+private:
+	netsnmp_variable_list* dispatch() const;
+
+	Oid_type m_name;
+	Reader::read_type m_read;
+	const char* m_key;
+	mutable time_t m_tick;
+	mutable netsnmp_variable_list* m_value;
+	mutable pthread_mutex_t m_lock;
+};
+
+} // namespace Host
+} // namespace Rmond
+
+#endif // PROXY_H
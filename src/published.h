@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#ifndef PUBLISHED_H
+#define PUBLISHED_H
+
+#include "epoch.h"
+
+namespace Rmond
+{
+///////////////////////////////////////////////////////////////////////////////
+// struct Published
+// NB. a value that cannot be copied atomically is never changed in place.
+// a writer publishes a new copy with an exchange and retires the previous
+// one through the epochs, thus a reader uses the copy within a read
+// section. neither readers nor other writers ever hold a writer up. a store
+// of the value already there allocates nothing.
+
+template<class T>
+struct Published
+{
+	Published(): m_value(new T)
+	{
+	}
+	Published(const Published& origin_): m_value(new T(origin_.load()))
+	{
+	}
+	~Published()
+	{
+		delete m_value;
+	}
+
+	Published& operator=(const Published& origin_)
+	{
+		store(origin_.load());
+		return *this;
+	}
+	T load() const
+	{
+		ThreadsafeContainer::Guard g;
+		return *__atomic_load_n(&m_value, __ATOMIC_ACQUIRE);
+	}
+	// NB. returns true if the value has changed.
+	bool store(const T& value_)
+	{
+		if (same(value_))
+			return false;
+
+		T* x = __atomic_exchange_n(&m_value, new T(value_), __ATOMIC_ACQ_REL);
+		ThreadsafeContainer::retire(x, &destroy);
+		return true;
+	}
+	// NB. calls visitor_ with the current copy, no copy is made.
+	template<class F>
+	void read(F& visitor_) const
+	{
+		ThreadsafeContainer::Guard g;
+		visitor_(*__atomic_load_n(&m_value, __ATOMIC_ACQUIRE));
+	}
+private:
+	bool same(const T& value_) const
+	{
+		ThreadsafeContainer::Guard g;
+		return *__atomic_load_n(&m_value, __ATOMIC_ACQUIRE) == value_;
+	}
+	static void destroy(void* value_)
+	{
+		delete (T* )value_;
+	}
+
+	T* m_value;
+};
+
+} // namespace Rmond
+
+#endif // PUBLISHED_H
@@ -23,7 +23,9 @@
 
 #include "sink.h"
 #include "value.h"
+#include <netdb.h>
 #include <sstream>
+#include <sys/socket.h>
 #include <boost/foreach.hpp>
 
 namespace Rmond
@@ -64,32 +66,79 @@ netsnmp_handler_registration* Schema<Metrix::TABLE>::handler(Netsnmp_Node_Handle
 	return Schema<void>::table<Metrix::TABLE>(handler_, my_, HANDLER_CAN_RWRITE);
 }
 
+namespace Metrix
+{
+///////////////////////////////////////////////////////////////////////////////
+// struct Collect
+
+struct Collect
+{
+	bool operator()(table_type::tuple_type& tuple_)
+	{
+		output->insert(tuple_.get<METRIC>());
+		return false;
+	}
+
+	Value::Metrix_type* output;
+};
+
+} // namespace Metrix
+
 namespace Sink
 {
 ///////////////////////////////////////////////////////////////////////////////
-// struct Unit
+// struct Open
+// NB. opens the session right from the host of the row, no copy is made.
 
-Unit::Unit(table_type::tupleSP_type tuple_, Metrix::tableWP_type metrix_):
-	m_session(NULL), m_metrix(metrix_), m_tuple(tuple_)
+struct Open
 {
-	if (NULL == m_tuple.get() || m_tuple->get<PORT>() == 0)
-		return;
+	void operator()(const std::string& host_)
+	{
+		output = session->open(host_, port);
+	}
 
-	netsnmp_session x = {};
-	snmp_sess_init(&x);
-	std::ostringstream y;
-	y << "udp:" << m_tuple->get<HOST>() << ":" << m_tuple->get<PORT>();
-	std::string z = y.str();
-	x.version = SNMP_VERSION_2c;
-	x.peername = &z[0];
-	x.remote_port = m_tuple->get<PORT>();
+	Session* session;
+	int port;
+	void* output;
+};
 
-	m_session = snmp_sess_open(&x);
-}
+///////////////////////////////////////////////////////////////////////////////
+// struct Empty
+
+struct Empty
+{
+	void operator()(const std::string& value_)
+	{
+		output = value_.empty();
+	}
+
+	bool output;
+};
 
-Unit::~Unit()
+///////////////////////////////////////////////////////////////////////////////
+// struct Unit
+
+Unit::Unit(table_type::tupleSP_type tuple_, Metrix::tableWP_type metrix_,
+	Session& session_, Value::Stream& head_): m_stream(), m_session(NULL),
+	m_head(head_), m_metrix(metrix_), m_tuple(tuple_)
 {
-	snmp_sess_close(m_session);
+	m_head.clear();
+	if (NULL == m_tuple.get())
+		return;
+
+	// NB. a unix sink names its socket by the host and has no port.
+	int t = m_tuple->get<TRANSPORT>();
+	m_stream = (TRANSPORT_TCP == t || TRANSPORT_UNIX == t);
+	if (m_stream || m_tuple->get<PORT>() == 0)
+		return;
+
+	Open o = {&session_, m_tuple->get<PORT>(), NULL};
+	m_tuple->read<HOST>(o);
+	m_session = o.output;
+	Empty e = {true};
+	m_tuple->read<TICKET>(e);
+	if (!e.output)
+		Value::Cell::Unit<TABLE, TICKET>::write(*m_tuple, m_head);
 }
 
 unsigned Unit::limit() const
@@ -104,6 +153,21 @@ unsigned Unit::limit() const
 	return (std::numeric_limits<int>::max)();
 }
 
+size_t Unit::budget() const
+{
+	if (NULL == m_tuple.get() || NULL == m_session)
+		return 0;
+
+	int x = m_tuple->get<BUDGET>();
+	netsnmp_session* s = snmp_sess_session(m_session);
+	size_t o = 0;
+	if (0 >= x || NULL == s || Value::Trap::overhead(*s, m_head, o))
+		return 0;
+
+	// NB. an overhead above the budget leaves one varbind a trap.
+	return (size_t)x > o ? x - o : 1;
+}
+
 Value::Metrix_type Unit::metrix() const
 {
 	Metrix::tableSP_type m = m_metrix.lock();
@@ -111,10 +175,8 @@ Value::Metrix_type Unit::metrix() const
 		return Value::Metrix_type();
 
 	Value::Metrix_type output;
-	BOOST_FOREACH(Metrix::table_type::tupleSP_type y, m->range(m_tuple->key()))
-	{
-		output.insert(y->get<Metrix::METRIC>());
-	}
+	Metrix::Collect c = {&output};
+	m->for_each_in_range(m_tuple->key(), c);
 	return output;
 }
 
@@ -135,40 +197,130 @@ ReaperSP Unit::inject(ServerSP server_)
 	return output;
 }
 
-bool Unit::push(netsnmp_variable_list* list_) const
+bool Unit::push(const u_char* data_, size_t size_, Batch& dst_) const
 {
-	if (NULL == m_session)
-	{
-		snmp_free_varbind(list_);
+	if (NULL == m_session || 0 == size_)
 		return true;
-	}
-	netsnmp_variable_list* x = list_;
-	if (NULL != m_tuple.get() && !m_tuple->get<TICKET>().empty())
-	{
-		netsnmp_variable_list* y = 
-			Value::Cell::Unit<Sink::TABLE, Sink::TICKET>(m_tuple).make();
-		if (NULL != y)
-		{
-			y->next_variable = x;
-			x = y;
-		}
-	}
-	netsnmp_pdu* u = Value::Trap::pdu(x);
-	if (NULL == u)
+
+	netsnmp_session* s = snmp_sess_session(m_session);
+	if (NULL == s)
 		return true;
-	if (0 != snmp_sess_async_send(m_session, u, NULL, NULL))
+
+	if (!Value::Trap::frame(*s, m_head, data_, size_, dst_.next()))
 		return false;
 
-	snmp_free_pdu(u);
+	dst_.pop();
+	snmp_log(LOG_ERR, LOG_PREFIX"cannot encode a trap of %zu bytes\n", size_);
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Session
+
+Session::~Session()
+{
+	close();
+}
+
+void Session::close()
+{
+	if (NULL != m_session)
+		snmp_sess_close(m_session);
+
+	m_session = NULL;
+}
+
+void* Session::open(const std::string& host_, int port_)
+{
+	if (NULL != m_session && m_host == host_ && m_port == port_)
+		return m_session;
+
+	close();
+	// NB. the udp transport is IPv4 only.
+	addrinfo h = {}, *r = NULL;
+	h.ai_family = AF_INET;
+	h.ai_socktype = SOCK_DGRAM;
+	int e = getaddrinfo(host_.c_str(), NULL, &h, &r);
+	if (0 != e || NULL == r)
+	{
+		snmp_log(LOG_ERR, LOG_PREFIX"cannot resolve the sink %s: %s\n",
+			host_.c_str(), gai_strerror(e));
+		return NULL;
+	}
+	memcpy(&m_peer, r->ai_addr, sizeof(m_peer));
+	m_peer.sin_port = htons(port_);
+	freeaddrinfo(r);
+
+	netsnmp_session x = {};
+	snmp_sess_init(&x);
+	std::ostringstream y;
+	y << "udp:" << host_ << ":" << port_;
+	std::string z = y.str();
+	x.version = SNMP_VERSION_2c;
+	x.peername = &z[0];
+	x.remote_port = port_;
+
+	m_session = snmp_sess_open(&x);
+	if (NULL == m_session)
+		return NULL;
+
+	m_host = host_;
+	m_port = port_;
+	return m_session;
+}
+
+int Session::socket() const
+{
+	netsnmp_transport* t = snmp_sess_transport(m_session);
+	return NULL == t ? -1 : t->sock;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Batch
+
+std::vector<u_char>& Batch::next()
+{
+	if (m_frames.size() == m_size)
+		m_frames.resize(m_size + 1);
+
+	return m_frames[m_size++];
+}
+
+void Batch::send()
+{
+	if (0 == m_size)
+		return;
+
+	int s = m_session->socket();
+	if (0 > s)
+	{
+		m_size = 0;
+		__atomic_store_n(&m_failed, true, __ATOMIC_RELEASE);
+		return;
+	}
+
+	size_t b = 0;
+	for (size_t i = 0; i < m_size; ++i)
+		b += m_frames[i].size();
+
+	size_t n = m_datagram.send(s, m_session->peer(), m_frames, m_size);
+	if (0 < n)
+	{
+		snmp_log(LOG_ERR, LOG_PREFIX"cannot send %zu traps: %s\n",
+			n, strerror(errno));
+		__atomic_store_n(&m_failed, true, __ATOMIC_RELEASE);
+	}
+	DEBUGMSGTL((TOKEN_PREFIX"trap", "%zu packets, %zu bytes in %u system calls\n",
+		m_size, b, m_datagram.calls()));
+	m_size = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Inform
 
 Inform::Inform(table_type::tupleSP_type sink_, Metrix::tableWP_type metrix_,
-		ServerWP server_): m_server(server_), m_metrix(metrix_),
-		m_sink(sink_)
+		ServerWP server_, ShareSP share_): m_server(server_), m_metrix(metrix_),
+		m_share(share_), m_sink(sink_), m_buffer(new Buffer)
 {
 }
 
@@ -187,11 +339,77 @@ void Inform::operator()() const
 	Central::schedule(t->get<Sink::PERIOD>(), *this);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Share
+
+void Share::expire()
+{
+	timespec x;
+	clock_gettime(CLOCK_MONOTONIC, &x);
+	if (m_tick == x.tv_sec)
+		return;
+
+	m_tick = x.tv_sec;
+	// NB. the metrics stay as the keys, the next keep of them copies
+	// nothing. those not kept for a second go only when there are too many.
+	bool z = MAX_KEYS < m_map.size();
+	for (map_type::iterator p = m_map.begin(); p != m_map.end();)
+	{
+		if (NULL != p->second.get())
+		{
+			m_spare.push_back(p->second);
+			(p++)->second.reset();
+		}
+		else if (z)
+			m_map.erase(p++);
+		else
+			++p;
+	}
+	if (MAX_SPARE < m_spare.size())
+		m_spare.erase(m_spare.begin(), m_spare.end() - MAX_SPARE);
+}
+
+Share::streamSP_type Share::find(const Value::Metrix_type& metrix_)
+{
+	boost::mutex::scoped_lock g(m_lock);
+	expire();
+	map_type::const_iterator p = m_map.find(metrix_);
+	if (m_map.end() == p)
+		return streamSP_type();
+
+	// NB. NULL if the key has outlived its stream.
+	return p->second;
+}
+
+Share::streamSP_type Share::make()
+{
+	boost::mutex::scoped_lock g(m_lock);
+	std::vector<streamSP_type>::iterator p = m_spare.begin();
+	for (; p != m_spare.end(); ++p)
+	{
+		if (!p->unique())
+			continue;
+
+		streamSP_type output = *p;
+		m_spare.erase(p);
+		output->clear();
+		return output;
+	}
+	return streamSP_type(new Value::Stream);
+}
+
+void Share::keep(const Value::Metrix_type& metrix_, streamSP_type stream_)
+{
+	boost::mutex::scoped_lock g(m_lock);
+	expire();
+	m_map[metrix_] = stream_;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Actor
 
 Actor::Actor(Metrix::tableSP_type metrix_, ReaperSP reaper_, ServerSP server_):
-	m_server(server_), m_metrix(metrix_), m_reaper(reaper_)
+	m_server(server_), m_share(new Share), m_metrix(metrix_), m_reaper(reaper_)
 {
 }
 
@@ -204,7 +422,7 @@ void Actor::commit(Table::Request::Unit<TABLE> event_)
 		if (NULL != r.get())
 			r->track(i);
 		Central::schedule(i->get<Sink::PERIOD>(),
-				Inform(i, m_metrix, m_server));
+				Inform(i, m_metrix, m_server, m_share));
 	}
 	event_.commit();
 }
@@ -233,8 +451,10 @@ void Reaper::do_()
 			z.push_back(y);
 			continue;
 		}
-		BOOST_FOREACH(Metrix::table_type::tupleSP_type m,
-				m_metrix->range(y->key()))
+		ThreadsafeContainer::Guard a;
+		Metrix::table_type::rows_type b;
+		m_metrix->range(y->key(), b);
+		BOOST_FOREACH(Metrix::table_type::tuple_type* m, b)
 		{
 			m_metrix->erase(*m);
 		}
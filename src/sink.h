@@ -26,6 +26,8 @@
 
 #include "value.h"
 #include "handler.h"
+#include "datagram.h"
+#include <netinet/in.h>
 #include <boost/tuple/tuple.hpp>
 
 namespace Rmond
@@ -40,7 +42,18 @@ enum TABLE
 	LIMIT,
 	ACKS,
 	ROW_STATUS,
-	TICKET
+	TICKET,
+	DELTA,
+	BUDGET,
+	TRANSPORT
+};
+
+// NB. the values of the TRANSPORT column, zero stands for TRANSPORT_TRAP.
+enum TRANSPORT_TYPE
+{
+	TRANSPORT_TRAP = 1,
+	TRANSPORT_TCP,
+	TRANSPORT_UNIX
 };
 } // namespace Sink
 
@@ -64,6 +77,9 @@ struct Schema<Sink::TABLE>: mpl::vector<
 			Declaration<Sink::TABLE, Sink::LIMIT, ASN_INTEGER>,
 			Declaration<Sink::TABLE, Sink::ACKS, ASN_INTEGER>,
 			Declaration<Sink::TABLE, Sink::TICKET, ASN_OCTET_STR>,
+			Declaration<Sink::TABLE, Sink::DELTA, ASN_INTEGER>,
+			Declaration<Sink::TABLE, Sink::BUDGET, ASN_INTEGER>,
+			Declaration<Sink::TABLE, Sink::TRANSPORT, ASN_INTEGER>,
 			Declaration<Sink::TABLE, Sink::ROW_STATUS, ASN_INTEGER> >
 {
 	typedef mpl::vector<
@@ -106,6 +122,11 @@ typedef boost::weak_ptr<table_type> tableWP_type;
 typedef boost::shared_ptr<table_type> tableSP_type;
 } // namespace Metrix
 
+namespace Feed
+{
+struct Unit;
+} // namespace Feed
+
 namespace Sink
 {
 typedef Table::Unit<TABLE> table_type;
@@ -135,25 +156,179 @@ private:
 };
 typedef boost::shared_ptr<Reaper> ReaperSP;
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Share
+// NB. the sinks with the same metrics that fire within the same second
+// share one encoded snapshot. the share holds it till that second is over,
+// then the last sink that has sent it releases it. the released streams are
+// reused, so are the keys of the metrics.
+
+struct Share
+{
+	typedef boost::shared_ptr<Value::Stream> streamSP_type;
+
+	Share(): m_tick()
+	{
+	}
+
+	streamSP_type find(const Value::Metrix_type& metrix_);
+	// NB. a clear stream to fill.
+	streamSP_type make();
+	void keep(const Value::Metrix_type& metrix_, streamSP_type stream_);
+private:
+	enum
+	{
+		MAX_SPARE = 16,
+		MAX_KEYS = 64
+	};
+	typedef std::map<Value::Metrix_type, streamSP_type> map_type;
+
+	void expire();
+
+	time_t m_tick;
+	map_type m_map;
+	boost::mutex m_lock;
+	std::vector<streamSP_type> m_spare;
+};
+typedef boost::shared_ptr<Share> ShareSP;
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Session
+// NB. the SNMP session of a sink is opened once for the life of the sink
+// and again only if the sink moves to another host or port. the traps go
+// out through the socket of its transport.
+
+struct Session: boost::noncopyable
+{
+	Session(): m_session(NULL), m_port(), m_peer()
+	{
+	}
+	~Session();
+
+	// NB. NULL if the session cannot be opened or the host resolved.
+	void* open(const std::string& host_, int port_);
+	int socket() const;
+	const sockaddr_in& peer() const
+	{
+		return m_peer;
+	}
+private:
+	void close();
+
+	void* m_session;
+	std::string m_host;
+	int m_port;
+	sockaddr_in m_peer;
+};
+typedef boost::shared_ptr<Session> SessionSP;
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Batch
+// NB. the traps of an inform. the sender thread sends them with as few
+// sendmmsg calls as it can. the frames are reused by the next inform of the
+// sink once the batch is sent.
+
+struct Batch: boost::noncopyable
+{
+	explicit Batch(SessionSP session_): m_size(), m_failed(), m_session(session_)
+	{
+	}
+
+	std::vector<u_char>& next();
+	void pop()
+	{
+		--m_size;
+	}
+	void clear()
+	{
+		m_size = 0;
+		__atomic_store_n(&m_failed, false, __ATOMIC_RELAXED);
+	}
+	void send();
+	// NB. true if some of the traps of the last send did not go.
+	bool failed() const
+	{
+		return __atomic_load_n(&m_failed, __ATOMIC_ACQUIRE);
+	}
+private:
+	size_t m_size;
+	bool m_failed;
+	SessionSP m_session;
+	Datagram m_datagram;
+	std::vector<std::vector<u_char> > m_frames;
+};
+typedef boost::shared_ptr<Batch> BatchSP;
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Flush
+
+struct Flush
+{
+	explicit Flush(BatchSP batch_): m_batch(batch_)
+	{
+	}
+
+	void operator()() const
+	{
+		m_batch->send();
+	}
+private:
+	BatchSP m_batch;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Buffer
+// NB. the encoded varbinds and the message of a sink, reused by each inform.
+
+struct Buffer
+{
+	Buffer(): tick(), generation(), session(new Session)
+	{
+	}
+
+	unsigned tick;
+	unsigned long long generation;
+	boost::shared_ptr<Value::Filter> filter;
+	SessionSP session;
+	BatchSP batch;
+	Value::Delta delta;
+	// NB. the varbinds in front of every trap, i.e. the ticket.
+	Value::Stream head;
+	// NB. the changed varbinds of the shared snapshot in delta mode.
+	Value::Stream data;
+	// NB. the connection and the rows sent of a streaming sink.
+	boost::shared_ptr<Feed::Unit> feed;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Unit
 
 struct Unit
 {
-	Unit(table_type::tupleSP_type tuple_, Metrix::tableWP_type metrix_);
-	~Unit();
+	// NB. the head_ of the traps is encoded again into the room it has.
+	Unit(table_type::tupleSP_type tuple_, Metrix::tableWP_type metrix_,
+		Session& session_, Value::Stream& head_);
 
 	bool bad() const
 	{
-		return NULL == m_session;
+		return NULL == m_session && !m_stream;
+	}
+	// NB. a streaming sink sends frames of its own instead of the traps.
+	bool stream() const
+	{
+		return m_stream;
 	}
 	unsigned limit() const;
+	// NB. the room for the varbinds in a trap, 0 if there is no budget.
+	size_t budget() const;
 	Value::Metrix_type metrix() const;
-	bool push(netsnmp_variable_list* list_) const;
+	bool push(const u_char* data_, size_t size_, Batch& dst_) const;
 
 	static ReaperSP inject(ServerSP server_);
 private:
+	bool m_stream;
 	void* m_session;
+	Value::Stream& m_head;
 	Metrix::tableWP_type m_metrix;
 	table_type::tupleSP_type m_tuple;
 };
@@ -164,7 +339,7 @@ private:
 struct Inform
 {
 	Inform(table_type::tupleSP_type sink_, Metrix::tableWP_type metrix_,
-		ServerWP server_);
+		ServerWP server_, ShareSP share_);
 
 	void operator()() const;
 private:
@@ -172,7 +347,9 @@ private:
 
 	ServerWP m_server;
 	Metrix::tableWP_type m_metrix;
+	ShareSP m_share;
 	tupleWP_type m_sink;
+	boost::shared_ptr<Buffer> m_buffer;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -186,6 +363,7 @@ struct Actor
 	void reserve(Table::Request::Unit<TABLE> );
 private:
 	ServerWP m_server;
+	ShareSP m_share;
 	Metrix::tableWP_type m_metrix;
 	boost::weak_ptr<Reaper> m_reaper;
 	
@@ -0,0 +1,700 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "ve.h"
+#include "sink.h"
+#include "table.h"
+#include "allocations.h"
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <pthread.h>
+#include <boost/foreach.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+
+// NB. drs-table-bench times the containers of the tables and the rows of the
+// VE disk table the way the agent walks them, without the agent.
+//
+//	drs-table-bench [-f] [-m MODE] [-n ROWS] [-r ROUNDS] [-t THREADS]
+//
+// -f takes the flat container instead of the default one. the modes are:
+//	walk	a walk of every column, the search of the row and the fill of
+//		the varbind timed apart, and the fill against a copy of the
+//		varbind kept by the full name. then GETBULK requests of every
+//		column with the cursor of the request and without it.
+//	lookup	find, findNext and getSubset of the disks of a VE for every
+//		row in a random order.
+//	update	THREADS walks by GETBULK requests, first alone, then against
+//		UPDATES a second that replace a random row. -r is the seconds
+//		of either.
+//	key	the index of a row of every table put into a stack buffer
+//		and by build_oid, the time and the heap allocations of a key.
+//	slab	ROWS disk tuples and rows made and freed ROUNDS times, from
+//		the slabs of the table and from the heap.
+
+namespace Rmond
+{
+// NB. the bench links neither the MIB nor the tables, the OID is that of
+// the agent.
+Oid_type Central::product()
+{
+	static const Oid_type::value_type NAME[] = {SNMP_OID_ENTERPRISES, 26171, 1, 2};
+	return Oid_type(NAME, NAME + sizeof(NAME)/sizeof(NAME[0]));
+}
+
+} // namespace Rmond
+
+namespace
+{
+using namespace Rmond;
+namespace Disk = VE::Disk;
+
+typedef Table::Unit<Disk::TABLE> table_type;
+typedef table_type::tupleSP_type tupleSP_type;
+typedef table_type::tuple_type tuple_type;
+// NB. the same as the rows of Table::Unit.
+typedef std::pair<netsnmp_index, tupleSP_type> row_type;
+
+enum
+{
+	// NB. the columns of a disk that are not the index.
+	COLUMNS = Disk::WRITE_BYTES,
+	// NB. the max-repetitions of a GETBULK.
+	REPEAT = 50,
+	UPDATES = 1000
+};
+
+// NB. monotonic, nanoseconds.
+unsigned long long now()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Options
+
+struct Options
+{
+	Options(): flat(false), mode("walk"), rows(10000), rounds(10), threads(4)
+	{
+	}
+
+	bool parse(int argc_, char** argv_);
+
+	bool flat;
+	std::string mode;
+	unsigned rows;
+	unsigned rounds;
+	unsigned threads;
+};
+
+bool Options::parse(int argc_, char** argv_)
+{
+	int c;
+	while (-1 != (c = getopt(argc_, argv_, "fm:n:r:t:")))
+	{
+		switch (c)
+		{
+		case 'f':
+			flat = true;
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		case 'n':
+			rows = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		default:
+			return true;
+		}
+	}
+	return optind != argc_ || 0 == rows || 0 == rounds || 0 == threads;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Rows
+// NB. the disks of VEs, four a VE, in a container of their own.
+
+struct Rows: boost::noncopyable
+{
+	explicit Rows(const Options& options_);
+	~Rows();
+
+	const char* backend() const
+	{
+		return m_flat ? "threadsafe_flat" : "threadsafe_array";
+	}
+	ThreadsafeContainer::Base& container()
+	{
+		return *m_container;
+	}
+
+	std::vector<row_type* > data;
+private:
+	bool m_flat;
+	ThreadsafeContainer::Base* m_container;
+};
+
+Rows::Rows(const Options& options_): m_flat(options_.flat)
+{
+	if (m_flat)
+		m_container = new ThreadsafeContainer::Flat;
+	else
+		m_container = new ThreadsafeContainer::Unit;
+
+	char b[64];
+	for (unsigned i = 0; i < options_.rows; ++i)
+	{
+		table_type::key_type k;
+		snprintf(b, sizeof(b), "%08x-0000-4000-8000-%012x", i / 4, i / 4);
+		k.put<VE::TABLE, VE::VEID>(b);
+		k.put<Disk::HASH1>(i % 4 * 2654435761U);
+		k.put<Disk::HASH2>(i % 4);
+		tupleSP_type t = table_type::make(k);
+		snprintf(b, sizeof(b), "hdd%u", i % 4);
+		t->put<Disk::NAME>(b);
+		t->put<Disk::TOTAL>(1ULL << 36);
+		t->put<Disk::USAGE>(i * 4096ULL);
+		t->put<Disk::READ_REQUESTS>(i);
+		t->put<Disk::WRITE_REQUESTS>(i * 2);
+		t->put<Disk::READ_BYTES>(i * 512ULL);
+		t->put<Disk::WRITE_BYTES>(i * 1024ULL);
+		row_type* r = new row_type(t->key(), t);
+		if (0 != m_container->insert(r))
+		{
+			delete r;
+			continue;
+		}
+		data.push_back(r);
+	}
+}
+
+Rows::~Rows()
+{
+	m_container->clear(NULL, NULL);
+	delete m_container;
+	BOOST_FOREACH(row_type* r, data)
+	{
+		delete r;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Copy
+// NB. the varbinds of a walk kept by the full name, the way a response
+// cache would serve them.
+
+struct Copy
+{
+	void put(const Oid_type& name_, const netsnmp_variable_list& src_)
+	{
+		Entry& e = m_data[name_];
+		e.type = src_.type;
+		e.value.assign((const char* )src_.val.string, src_.val_len);
+	}
+	bool get(const Oid_type& name_, netsnmp_variable_list& dst_) const
+	{
+		data_type::const_iterator p = m_data.find(name_);
+		if (m_data.end() == p)
+			return true;
+
+		snmp_set_var_typed_value(&dst_, p->second.type,
+			p->second.value.data(), p->second.value.size());
+		return false;
+	}
+private:
+	struct Entry
+	{
+		u_char type;
+		std::string value;
+	};
+	typedef boost::unordered_map<Oid_type, Entry, boost::hash<Oid_type> > data_type;
+
+	data_type m_data;
+};
+
+// NB. the column, then the index, as the table helper names a cell.
+Oid_type name(int column_, const row_type& row_)
+{
+	Oid_type output(1, column_);
+	output.insert(output.end(), row_.first.oids, row_.first.oids + row_.first.len);
+	return output;
+}
+
+// NB. GETBULK requests of every column over all the rows, the way the
+// container_table helper searches for the varbinds of the repetitions.
+// returns the time of the searches.
+unsigned long long bulk(ThreadsafeContainer::Base& container_, bool cursor_,
+	unsigned long long& cells_)
+{
+	unsigned long long output = 0;
+	const void* p = container_.findNext(NULL);
+	while (NULL != p)
+	{
+		ThreadsafeContainer::Cursor u;
+		ThreadsafeContainer::Cursor::Scope s(cursor_ ? &u : NULL);
+		ThreadsafeContainer::Guard g;
+		unsigned long long a = now();
+		for (unsigned j = 0; j < REPEAT && NULL != p; ++j)
+		{
+			const void* q = NULL;
+			for (int i = 1; i <= COLUMNS; ++i, ++cells_)
+				q = container_.next(p);
+
+			p = q;
+		}
+		output += now() - a;
+	}
+	return output;
+}
+
+int walk(const Options& options_)
+{
+	Rows w(options_);
+	ThreadsafeContainer::Base& c = w.container();
+	netsnmp_variable_list v = {};
+	std::vector<Oid_type> n;
+	Copy y;
+	BOOST_FOREACH(row_type* r, w.data)
+	{
+		n.push_back(name(1, *r));
+		for (int i = 1; i <= COLUMNS; ++i)
+		{
+			n.back()[0] = i;
+			r->second->get(i, v);
+			y.put(n.back(), v);
+		}
+	}
+	unsigned long long search = 0, fill = 0, copy = 0, cells = 0;
+	for (unsigned k = 0; k < options_.rounds; ++k)
+	{
+		ThreadsafeContainer::Guard g;
+		for (int i = 1; i <= COLUMNS; ++i)
+		{
+			// NB. the container_table helper searches for every varbind.
+			unsigned long long a = now();
+			for (const void* p = c.findNext(NULL); NULL != p; p = c.findNext(p))
+				++cells;
+
+			unsigned long long b = now();
+			BOOST_FOREACH(row_type* r, w.data)
+			{
+				r->second->get(i, v);
+			}
+			unsigned long long d = now();
+			BOOST_FOREACH(Oid_type& x, n)
+			{
+				x[0] = i;
+				y.get(x, v);
+			}
+			copy += now() - d;
+			fill += d - b;
+			search += b - a;
+		}
+	}
+	snmp_set_var_typed_value(&v, ASN_NULL, NULL, 0);
+	if (0 == cells)
+		return 1;
+
+	printf("walk of %zu rows, %u columns on %s: search %llu ns, fill %llu ns, "
+		"name-keyed copy %llu ns a varbind\n", w.data.size(), (unsigned)COLUMNS,
+		w.backend(), search / cells, fill / cells, copy / cells);
+	unsigned long long with = 0, without = 0, l = 0, m = 0;
+	for (unsigned k = 0; k < options_.rounds; ++k)
+	{
+		with += bulk(c, true, l);
+		without += bulk(c, false, m);
+	}
+	if (0 == l || 0 == m)
+		return 1;
+
+	printf("getbulk by %u of %u columns on %s: search %llu ns with the cursor, "
+		"%llu ns without a varbind\n", (unsigned)REPEAT, (unsigned)COLUMNS,
+		w.backend(), with / l, without / m);
+	return 0;
+}
+
+// NB. the number of the leading sub-identifiers of a disk index that name
+// the VE.
+size_t ve(const row_type& row_)
+{
+	return row_.first.len - 2;
+}
+
+int lookup(const Options& options_)
+{
+	Rows w(options_);
+	ThreadsafeContainer::Base& c = w.container();
+	std::vector<row_type* > o(w.data);
+	srand(1);
+	std::random_shuffle(o.begin(), o.end());
+	unsigned long long find = 0, next = 0, subset = 0, n = 0, m = 0;
+	for (unsigned k = 0; k < options_.rounds; ++k)
+	{
+		ThreadsafeContainer::Guard g;
+		unsigned long long a = now();
+		BOOST_FOREACH(row_type* r, o)
+		{
+			if (r != c.find(r))
+				return 1;
+		}
+		unsigned long long b = now();
+		BOOST_FOREACH(row_type* r, o)
+		{
+			c.findNext(r);
+		}
+		unsigned long long d = now();
+		for (size_t i = 0; i < o.size(); i += 4, ++m)
+		{
+			netsnmp_index p = {ve(*o[i]), o[i]->first.oids};
+			netsnmp_void_array* x = c.getSubset(&p);
+			if (NULL == x)
+				return 1;
+
+			::free(x->array);
+			::free(x);
+		}
+		subset += now() - d;
+		next += d - b;
+		find += b - a;
+		n += o.size();
+	}
+	printf("lookup in %zu rows on %s: find %llu ns, findNext %llu ns, "
+		"getSubset of a VE %llu ns\n", w.data.size(), w.backend(),
+		find / n, next / n, subset / m);
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Walker
+// NB. walks the container by GETBULK requests of one column until told to
+// stop and checks the order of the rows it gets.
+
+struct Walker
+{
+	explicit Walker(ThreadsafeContainer::Base& container_):
+		stop(), cells(), walks(), bad(), m_container(&container_)
+	{
+	}
+
+	static void* run(void* walker_);
+
+	bool stop;
+	unsigned long long cells;
+	unsigned long long walks;
+	unsigned long long bad;
+private:
+	void walk();
+
+	ThreadsafeContainer::Base* m_container;
+};
+
+void* Walker::run(void* walker_)
+{
+	Walker* w = static_cast<Walker* >(walker_);
+	while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE))
+		w->walk();
+
+	return NULL;
+}
+
+void Walker::walk()
+{
+	const void* p = m_container->findNext(NULL);
+	while (NULL != p)
+	{
+		ThreadsafeContainer::Cursor u;
+		ThreadsafeContainer::Cursor::Scope s(&u);
+		ThreadsafeContainer::Guard g;
+		for (unsigned j = 0; j < REPEAT && NULL != p; ++j, ++cells)
+		{
+			const void* q = m_container->next(p);
+			if (NULL != q && 0 <= netsnmp_compare_netsnmp_index(p, q))
+				++bad;
+
+			p = q;
+		}
+	}
+	++walks;
+}
+
+void destroy(void* row_)
+{
+	delete static_cast<row_type* >(row_);
+}
+
+// NB. runs the walkers for seconds_, replaces rate_ rows a second meanwhile.
+// returns the mean time of a replace.
+unsigned long long load(Rows& rows_, std::vector<Walker>& walkers_,
+	unsigned seconds_, unsigned rate_)
+{
+	std::vector<pthread_t> t(walkers_.size());
+	for (size_t i = 0; i < t.size(); ++i)
+	{
+		if (0 != pthread_create(&t[i], NULL, &Walker::run, &walkers_[i]))
+			return 0;
+	}
+	ThreadsafeContainer::Base& c = rows_.container();
+	unsigned long long e = now() + seconds_ * 1000000000ULL, x = 0, n = 0;
+	timespec d;
+	clock_gettime(CLOCK_MONOTONIC, &d);
+	while (now() < e)
+	{
+		if (0 == rate_)
+		{
+			usleep(10000);
+			continue;
+		}
+		d.tv_nsec += 1000000000L / rate_;
+		if (1000000000L <= d.tv_nsec)
+		{
+			d.tv_nsec -= 1000000000L;
+			++d.tv_sec;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &d, NULL);
+		// NB. the way the table replaces a row, the tuple is kept.
+		row_type*& r = rows_.data[rand() % rows_.data.size()];
+		unsigned long long a = now();
+		row_type* y = new row_type(r->first, r->second);
+		c.remove(r);
+		c.dispose(r, &destroy);
+		c.insert(y);
+		r = y;
+		x += now() - a;
+		++n;
+	}
+	BOOST_FOREACH(Walker& w, walkers_)
+	{
+		__atomic_store_n(&w.stop, true, __ATOMIC_RELEASE);
+	}
+	BOOST_FOREACH(pthread_t& h, t)
+	{
+		pthread_join(h, NULL);
+	}
+	return 0 == n ? 0 : x / n;
+}
+
+int update(const Options& options_)
+{
+	Rows w(options_);
+	srand(1);
+	for (unsigned r = 0; r <= UPDATES; r += UPDATES)
+	{
+		std::vector<Walker> v(options_.threads, Walker(w.container()));
+		unsigned long long u = load(w, v, options_.rounds, r);
+		unsigned long long c = 0, k = 0, b = 0;
+		BOOST_FOREACH(Walker& x, v)
+		{
+			c += x.cells;
+			k += x.walks;
+			b += x.bad;
+		}
+		if (0 == c || 0 != b)
+		{
+			fprintf(stderr, "%llu varbinds out of order\n", b);
+			return 1;
+		}
+		printf("%u walkers of %zu rows on %s against %u updates/s: "
+			"%llu varbinds/s, %llu walks/s", options_.threads,
+			w.data.size(), w.backend(), r, c / options_.rounds,
+			k / options_.rounds);
+		if (0 < r)
+			printf(", update %llu ns", u);
+		printf("\n");
+	}
+	return 0;
+}
+
+// NB. ROWS * ROUNDS encodings of key_ both ways.
+template<class T>
+bool encode(const char* table_, const Table::Tuple::Key<T>& key_, const Options& options_)
+{
+	oid b[MAX_OID_LEN];
+	size_t l = 0, m = 0, n = options_.rows * options_.rounds;
+	unsigned long long a = Bench::allocations(), x = now();
+	for (size_t i = 0; i < n; ++i)
+	{
+		l = MAX_OID_LEN;
+		if (key_.extract(b, l))
+			return true;
+	}
+	unsigned long long c = Bench::allocations(), y = now();
+	for (size_t i = 0; i < n; ++i)
+	{
+		netsnmp_index k;
+		key_.extract(k);
+		m = k.len;
+		::free(k.oids);
+	}
+	unsigned long long d = Bench::allocations(), z = now();
+	netsnmp_index k;
+	key_.extract(k);
+	bool e = l != m || 0 != memcmp(b, k.oids, l * sizeof(oid));
+	::free(k.oids);
+	if (e)
+		return true;
+
+	printf("key of %s, %zu sub-identifiers: stack %llu ns, %.1f allocations, "
+		"build_oid %llu ns, %.1f allocations\n", table_, l, (y - x) / n,
+		double(c - a) / n, (z - y) / n, double(d - c) / n);
+	return false;
+}
+
+int key(const Options& options_)
+{
+	const char* u = "8a3c9e21-0000-4000-8000-00000000002a";
+	Oid_type o = Central::product();
+	Table::Tuple::Key<VE::TABLE> v;
+	v.put<VE::TABLE, VE::VEID>(u);
+	Table::Tuple::Key<VE::Counters::Linux::TABLE> f;
+	f.put<VE::TABLE, VE::VEID>(u);
+	Table::Tuple::Key<Disk::TABLE> d;
+	d.put<VE::TABLE, VE::VEID>(u);
+	d.put<Disk::HASH1>(2654435761U);
+	d.put<Disk::HASH2>(1);
+	Table::Tuple::Key<VE::Network::TABLE> n;
+	n.put<VE::TABLE, VE::VEID>(u);
+	n.put<VE::Network::NAME>("venet0");
+	Table::Tuple::Key<VE::CPU::TABLE> c;
+	c.put<VE::TABLE, VE::VEID>(u);
+	c.put<VE::CPU::ORDINAL>(3);
+	Table::Tuple::Key<Sink::TABLE> s;
+	s.put<Sink::TABLE, Sink::HOST>("192.168.10.1");
+	s.put<Sink::TABLE, Sink::PORT>(162);
+	Table::Tuple::Key<Metrix::TABLE> m;
+	m.put<Sink::TABLE, Sink::HOST>("192.168.10.1");
+	m.put<Sink::TABLE, Sink::PORT>(162);
+	m.put<Metrix::METRIC>(o);
+	if (encode("ve", v, options_) || encode("linux counters", f, options_) ||
+		encode("disk", d, options_) || encode("network", n, options_) ||
+		encode("vcpu", c, options_) || encode("sink", s, options_) ||
+		encode("metrix", m, options_))
+		return 1;
+
+	return 0;
+}
+
+// NB. makes a row for every key the way the table inserts one, frees them
+// all the way the table destroys one. returns the time of it.
+unsigned long long churn(const std::vector<table_type::key_type>& keys_,
+	bool slab_, unsigned long long& allocations_)
+{
+	Table::Slab<Disk::TABLE, row_type> s;
+	std::vector<row_type* > v(keys_.size());
+	unsigned long long a = Bench::allocations(), x = now();
+	for (size_t i = 0; i < keys_.size(); ++i)
+	{
+		if (slab_)
+		{
+			tupleSP_type t = table_type::make(keys_[i]);
+			v[i] = s.allocate(1);
+			s.construct(v[i], row_type(t->key(), t));
+		}
+		else
+		{
+			tupleSP_type t = boost::make_shared<tuple_type>(keys_[i]);
+			v[i] = new row_type(t->key(), t);
+		}
+	}
+	BOOST_FOREACH(row_type* r, v)
+	{
+		if (slab_)
+		{
+			s.destroy(r);
+			s.deallocate(r, 1);
+		}
+		else
+			delete r;
+	}
+	allocations_ += Bench::allocations() - a;
+	return now() - x;
+}
+
+int slab(const Options& options_)
+{
+	std::vector<table_type::key_type> k(options_.rows);
+	char b[64];
+	for (unsigned i = 0; i < options_.rows; ++i)
+	{
+		snprintf(b, sizeof(b), "%08x-0000-4000-8000-%012x", i / 4, i / 4);
+		k[i].put<VE::TABLE, VE::VEID>(b);
+		k[i].put<Disk::HASH1>(i % 4 * 2654435761U);
+		k[i].put<Disk::HASH2>(i % 4);
+	}
+	for (int h = 0; h < 2; ++h)
+	{
+		bool y = 0 == h;
+		unsigned long long a = 0, c = 0;
+		unsigned long long x = churn(k, y, a);
+		unsigned long long z = 0;
+		for (unsigned j = 1; j < options_.rounds; ++j)
+			z += churn(k, y, c);
+
+		printf("%u disk rows from the %s: first %llu ns, %.1f allocations, "
+			"then %llu ns, %.1f allocations a row\n", options_.rows,
+			y ? "slab" : "heap", x / options_.rows, double(a) / options_.rows,
+			1 < options_.rounds ? z / (options_.rows * (options_.rounds - 1)) : 0,
+			1 < options_.rounds ? double(c) / (options_.rows * (options_.rounds - 1)) : 0);
+	}
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	Options o;
+	if (o.parse(argc, argv))
+	{
+		fprintf(stderr, "usage: %s [-f] [-m walk|lookup|update|key|slab] [-n ROWS] "
+			"[-r ROUNDS] [-t THREADS]\n", argv[0]);
+		return 2;
+	}
+	if ("walk" == o.mode)
+		return walk(o);
+	if ("lookup" == o.mode)
+		return lookup(o);
+	if ("update" == o.mode)
+		return update(o);
+	if ("key" == o.mode)
+		return key(o);
+	if ("slab" == o.mode)
+		return slab(o);
+
+	fprintf(stderr, "unknown mode %s\n", o.mode.c_str());
+	return 2;
+}
@@ -25,12 +25,156 @@
 #define TABLE_H
 
 #include <list>
+#include <vector>
+#include <new>
+#include <boost/make_shared.hpp>
+#include <boost/pool/singleton_pool.hpp>
+#include <boost/container/small_vector.hpp>
 #include "details.h"
+#include "container.h"
 
 namespace Rmond
 {
 namespace Table
 {
+///////////////////////////////////////////////////////////////////////////////
+// struct Census
+// NB. counts the allocations of the table rows and tuples and of the trap
+// snapshots.
+
+struct Census
+{
+	enum KIND
+	{
+		// NB. blocks taken from the table slabs.
+		SLAB,
+		// NB. blocks returned to the table slabs.
+		RELEASE,
+		// NB. keys too long for the tuple and allocated on the heap.
+		HEAP,
+		// NB. trap buffers grown to fit a snapshot.
+		GROW,
+		// NB. provider trees built for the composites without an encoder.
+		TREE,
+		KINDS
+	};
+
+	static void count(KIND kind_)
+	{
+		__atomic_add_fetch(&s_data[kind_], 1, __ATOMIC_RELAXED);
+	}
+	// NB. logs the counts since the previous call.
+	static void report();
+private:
+	static unsigned long long s_data[KINDS];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Slab
+// NB. an allocator that takes the blocks for the table T from a pool of the
+// blocks of the same size. the blocks go back to the pool, not to the heap.
+
+template<class T, class U>
+struct Slab
+{
+	typedef U value_type;
+	typedef U* pointer;
+	typedef const U* const_pointer;
+	typedef U& reference;
+	typedef const U& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template<class V>
+	struct rebind
+	{
+		typedef Slab<T, V> other;
+	};
+
+	Slab()
+	{
+	}
+	template<class V>
+	Slab(const Slab<T, V>& )
+	{
+	}
+
+	pointer address(reference value_) const
+	{
+		return &value_;
+	}
+	const_pointer address(const_reference value_) const
+	{
+		return &value_;
+	}
+	pointer allocate(size_type size_, const void* = NULL)
+	{
+		void* output = 1 == size_ ? pool_type::malloc() :
+					pool_type::ordered_malloc(size_);
+		if (NULL == output)
+			throw std::bad_alloc();
+
+		Census::count(Census::SLAB);
+		return static_cast<pointer>(output);
+	}
+	void deallocate(pointer value_, size_type size_)
+	{
+		Census::count(Census::RELEASE);
+		if (1 == size_)
+			pool_type::free(value_);
+		else
+			pool_type::ordered_free(value_, size_);
+	}
+	void construct(pointer dst_, const_reference value_)
+	{
+		new(dst_) U(value_);
+	}
+	void destroy(pointer value_)
+	{
+		value_->~U();
+	}
+	size_type max_size() const
+	{
+		return size_type(-1) / sizeof(U);
+	}
+private:
+	typedef boost::singleton_pool<T, sizeof(U)> pool_type;
+};
+
+template<class T, class U, class V>
+bool operator==(const Slab<T, U>& , const Slab<T, V>& )
+{
+	return true;
+}
+
+template<class T, class U, class V>
+bool operator!=(const Slab<T, U>& , const Slab<T, V>& )
+{
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Generation
+// NB. bumps on every change of the rows or the column values of the table T.
+
+template<class T>
+struct Generation
+{
+	static unsigned long long get()
+	{
+		return __atomic_load_n(&s_value, __ATOMIC_ACQUIRE);
+	}
+	static void bump()
+	{
+		__atomic_add_fetch(&s_value, 1, __ATOMIC_RELEASE);
+	}
+private:
+	static unsigned long long s_value;
+};
+
+template<class T>
+unsigned long long Generation<T>::s_value = 1;
+
 namespace Tuple
 {
 ///////////////////////////////////////////////////////////////////////////////
@@ -68,7 +212,41 @@ class Key: public Details::Set<T, typename Details::Key<T>::type>
 		const Key* m_index;
 		netsnmp_variable_list** m_data;
 	};
+	struct Encode
+	{
+		Encode(const Key& index_, oid*& dst_, const oid* end_, bool& failed_):
+			m_index(&index_), m_dst(&dst_), m_end(end_), m_failed(&failed_)
+		{
+			*m_failed = false;
+		}
+
+		template<class U>
+		void operator()(U )
+		{
+			if (!*m_failed)
+			{
+				*m_failed = m_index->template
+					encode<typename U::value_type, U::value>(*m_dst, m_end);
+			}
+		}
+	private:
+		const Key* m_index;
+		oid** m_dst;
+		const oid* m_end;
+		bool* m_failed;
+	};
 public:
+	// NB. writes the index into the caller's buffer without any allocation.
+	// returns true if it does not fit.
+	bool extract(oid* dst_, size_t& len_) const
+	{
+		oid* x = dst_;
+		bool output;
+		mpl::for_each<typename Details::Key<T>::seq_type>(
+			Encode(*this, x, dst_ + len_, output));
+		len_ = x - dst_;
+		return output;
+	}
 	void extract(netsnmp_index& dst_) const
 	{
 		memset(&dst_, 0, sizeof(netsnmp_index));
@@ -101,13 +279,14 @@ class Access: public Details::Automat<Access<T, S, F>,
 	template<class U, U N>
 	struct Fire
 	{
-		static void do_(reference_type event_, netsnmp_variable_list* value_, mpl::true_)
+		static bool do_(reference_type event_, netsnmp_variable_list* value_, mpl::true_)
 		{
 			event_.template get<U, N>(*value_);
+			return false;
 		}
-		static void do_(reference_type event_, netsnmp_variable_list* value_, mpl::false_)
+		static bool do_(reference_type event_, netsnmp_variable_list* value_, mpl::false_)
 		{
-			event_.template put<N>(*value_);
+			return event_.template put<N>(*value_);
 		}
 	};
 	template<class U>
@@ -117,14 +296,16 @@ class Access: public Details::Automat<Access<T, S, F>,
 						&Access::template process<typename U::value_type, U::value> > type;
 	};
 public:
-	Access(netsnmp_variable_list& value_): m_result(false), m_value(&value_)
+	Access(netsnmp_variable_list& value_): m_result(false), m_changed(false),
+		m_value(&value_)
 	{
 	}
 
 	template<class U, U N>
 	void process(reference_type event_)
 	{
-		Fire<U, N>::do_(event_, m_value, typename boost::is_const<data_type>::type());
+		m_changed = Fire<U, N>::do_(event_, m_value,
+			typename boost::is_const<data_type>::type());
 	}
 	void unknown(int case_, reference_type event_)
 	{
@@ -134,10 +315,16 @@ public:
 	{
 		return m_result;
 	}
+	// NB. true if a put has changed the value.
+	bool changed() const
+	{
+		return m_changed;
+	}
 
 	typedef typename mpl::transform<S, Each<mpl::_1> >::type table_type;
 private:
 	bool m_result;
+	bool m_changed;
 	netsnmp_variable_list* m_value;
 };
 
@@ -174,7 +361,13 @@ class Unit: private netsnmp_index
 public:
 	explicit Unit(const Key<T>& index_)
 	{
-		index_.extract(*this);
+		len = KEY_SIZE;
+		oids = m_key;
+		if (index_.extract(m_key, len))
+		{
+			Census::count(Census::HEAP);
+			index_.extract(*this);
+		}
 		typedef typename mpl::copy_if<typename Details::Key<T>::seq_type,
 			mpl::quote1<Filter> >::type seq_type;
 		mpl::for_each<seq_type>(Assign(index_, *this));
@@ -188,7 +381,14 @@ public:
 			return;
 		}
 		len = request_->index_oid_len;
-		oids = snmp_duplicate_objid(request_->index_oid, len);
+		oids = m_key;
+		if (KEY_SIZE < len)
+		{
+			Census::count(Census::HEAP);
+			oids = snmp_duplicate_objid(request_->index_oid, len);
+		}
+		else
+			std::copy(request_->index_oid, request_->index_oid + len, m_key);
 		netsnmp_variable_list* x = request_->indexes;
 		mpl::for_each<typename Details::Key<T>::seq_type>(Details::Index::Patch<T>(x));
 		for (; x != NULL; x = x->next_variable)
@@ -200,7 +400,8 @@ public:
 	}
 	~Unit()
 	{
-		free(oids);
+		if (m_key != oids)
+			free(oids);
 	}
 
 	template<T N>
@@ -214,13 +415,26 @@ public:
 		u.do_(name_, m_data);
 		return u.result();
 	}
+	template<T N>
+	bool build(const oid* name_, size_t length_, u_char*& dst_, size_t& left_) const
+	{
+		return m_data.template build<T, N>(name_, length_, dst_, left_);
+	}
+	// NB. calls visitor_ with the value of the column in place.
+	template<T N, class F>
+	void read(F& visitor_) const
+	{
+		m_data.template read<T, N>(visitor_);
+	}
 
 	template<T N>
 	typename boost::enable_if<
 			mpl::contains<mutable_type, typename Details::Column<T, N>::type::declaration_type>
 		>::type put(const typename Details::Column<T, N>::type::value_type& value_)
 	{
-		m_data.template put<N>(value_);
+		// NB. the same value stored again must not bump the generation.
+		if (m_data.template put<N>(value_))
+			Generation<T>::bump();
 	}
 
 	bool put(int name_, netsnmp_variable_list value_)
@@ -228,6 +442,9 @@ public:
 		Access<T, typename Details::Names<T>::type,
 			mpl::identity<mpl::_1> > u(value_);
 		u.do_(name_, m_data);
+		if (u.changed())
+			Generation<T>::bump();
+
 		return u.result();
 	}
 
@@ -236,10 +453,18 @@ public:
 		return *this;
 	}
 private:
+	enum
+	{
+		// NB. fits the VEID string with the disk, the network or the CPU
+		// columns after it.
+		KEY_SIZE = 48
+	};
+
 	Unit(const Unit& );
 	Unit& operator=(const Unit& );
 
 	data_type m_data;
+	oid m_key[KEY_SIZE];
 };
 
 } // namespace Tuple
@@ -254,6 +479,9 @@ struct Unit
 	typedef Tuple::Unit<T> tuple_type;
 	typedef boost::shared_ptr<tuple_type> tupleSP_type;
 	typedef typename Details::Tuple<T>::schema_type schema_type;
+	// NB. the rows of a range. the pointers stay valid as long as the
+	// ThreadsafeContainer::Guard open around the range call.
+	typedef boost::container::small_vector<tuple_type* , 16> rows_type;
 
 	Unit();
 	~Unit();
@@ -263,19 +491,77 @@ struct Unit
 	tupleSP_type find(const key_type& key_) const;
 	tupleSP_type find(const netsnmp_index& key_) const;
 	tupleSP_type extract(netsnmp_request_info* request_) const;
+	// NB. the row the container_table helper found for the request
+	// without a copy of the pointer. it stays valid as long as the Guard
+	// of the request.
+	tuple_type* peek(netsnmp_request_info* request_) const;
 	bool erase(const tuple_type& tuple_);
 	bool insert(tupleSP_type tuple_);
-	std::list<tupleSP_type> range(Oid_type key_) const;
-	std::list<tupleSP_type> range(netsnmp_index key_) const;
+	// NB. the tuple, its key and the shared count are taken from the slab
+	// of the table in one block.
+	template<class A>
+	static tupleSP_type make(const A& arg_)
+	{
+		return boost::allocate_shared<tuple_type>(Slab<T, tuple_type>(), arg_);
+	}
+	std::vector<tupleSP_type> range(const Oid_type& key_) const;
+	std::vector<tupleSP_type> range(const netsnmp_index& key_) const;
+	void range(const netsnmp_index& key_, rows_type& dst_) const;
+	void range(const Oid_type& key_, rows_type& dst_) const
+	{
+		range(index(key_), dst_);
+	}
+	// NB. calls visitor_(tuple_type& ) for every row whose index starts
+	// with key_ until it returns true. the visitor must not call back into
+	// the table, use the rows_type variant to change it.
+	template<class V>
+	void for_each_in_range(const netsnmp_index& key_, V& visitor_) const;
+	template<class V>
+	void for_each_in_range(const Oid_type& key_, V& visitor_) const
+	{
+		for_each_in_range(index(key_), visitor_);
+	}
 private:
 	typedef std::pair<netsnmp_index, tupleSP_type> row_type;
+	struct Collect
+	{
+		bool operator()(tuple_type& tuple_)
+		{
+			output->push_back(&tuple_);
+			return false;
+		}
+
+		rows_type* output;
+	};
 
 	template<class H>
 	static int handle(netsnmp_mib_handler* , netsnmp_handler_registration* ,
 		netsnmp_agent_request_info* , netsnmp_request_info* );
+	// NB. keeps the rows found by the container_table helper alive till
+	// the request is handled.
+	static int guard(netsnmp_mib_handler* , netsnmp_handler_registration* ,
+		netsnmp_agent_request_info* , netsnmp_request_info* );
+	// NB. the cursor of the walk the request makes over the table, kept
+	// in the data list of the request.
+	static ThreadsafeContainer::Cursor* cursor(netsnmp_agent_request_info* info_);
+	static void destroy(void* row_);
+	void walk(const netsnmp_index& key_, ThreadsafeContainer::Visitor& visitor_) const;
+	static netsnmp_index index(const Oid_type& key_)
+	{
+		netsnmp_index output = {};
+		if (!key_.empty())
+		{
+			output.len = key_.size();
+			output.oids = const_cast<oid* >(&key_[0]);
+		}
+		return output;
+	}
+
+	typedef Details::Index::Group<T> group_type;
 
 	netsnmp_container* m_storage;
 	netsnmp_handler_registration* m_registration;
+	mutable ThreadsafeContainer::Groups m_groups;
 };
 
 template<class T>
@@ -283,7 +569,7 @@ Unit<T>::Unit(): m_storage(NULL), m_registration(NULL)
 {
 	std::string n = std::string(TOKEN_PREFIX)
 				.append(schema_type::name())
-				.append(":").append("threadsafe_array");
+				.append(":").append(ThreadsafeContainer::backend());
 	m_storage = netsnmp_container_find(n.c_str());
 	if (NULL == m_storage)
 	{
@@ -324,6 +610,15 @@ bool Unit<T>::attach(H* handler_)
 			netsnmp_handler_free(z);
 			snmp_log(LOG_ERR, LOG_PREFIX"error injecting container_table handler for %s\n", schema_type::name());
 		}
+		else if (NULL == (z = netsnmp_create_handler("rmond_epoch", &Unit<T>::guard)))
+		{
+			snmp_log(LOG_ERR, LOG_PREFIX"error allocating epoch handler for %s\n", schema_type::name());
+		}
+		else if (SNMPERR_SUCCESS != netsnmp_inject_handler(r, z))
+		{
+			netsnmp_handler_free(z);
+			snmp_log(LOG_ERR, LOG_PREFIX"error injecting epoch handler for %s\n", schema_type::name());
+		}
 		else
 		{
 			z = NULL;
@@ -361,9 +656,17 @@ typename Unit<T>::tupleSP_type Unit<T>::extract(netsnmp_request_info* request_)
 	return NULL == r ? tupleSP_type() : r->second;
 }
 
+template<class T>
+typename Unit<T>::tuple_type* Unit<T>::peek(netsnmp_request_info* request_) const
+{
+	row_type* r = (row_type* )netsnmp_container_table_extract_context(request_);
+	return NULL == r ? NULL : r->second.get();
+}
+
 template<class T>
 typename Unit<T>::tupleSP_type Unit<T>::find(const netsnmp_index& key_) const
 {
+	ThreadsafeContainer::Guard g;
 	void* r = CONTAINER_FIND(m_storage, &key_);
 	if (NULL == r)
 		return tupleSP_type();
@@ -374,7 +677,11 @@ typename Unit<T>::tupleSP_type Unit<T>::find(const netsnmp_index& key_) const
 template<class T>
 typename Unit<T>::tupleSP_type Unit<T>::find(const key_type& key_) const
 {
-	netsnmp_index k;
+	oid b[MAX_OID_LEN];
+	netsnmp_index k = {MAX_OID_LEN, b};
+	if (!key_.extract(b, k.len))
+		return find(k);
+
 	key_.extract(k);
 	tupleSP_type output = find(k);
 	free(k.oids);
@@ -384,13 +691,19 @@ typename Unit<T>::tupleSP_type Unit<T>::find(const key_type& key_) const
 template<class T>
 bool Unit<T>::insert(tupleSP_type tuple_)
 {
-	row_type* r = new row_type(tuple_->key(), tuple_);
+	Slab<T, row_type> a;
+	row_type* r = a.allocate(1);
+	a.construct(r, row_type(tuple_->key(), tuple_));
 	int e = CONTAINER_INSERT(m_storage, r);
 	if (0 != e)
 	{
-		delete r;
+		destroy(r);
 		return true;
 	}
+	if (group_type::ENABLED)
+		m_groups.insert(group_type::span(r->first), r);
+
+	Generation<T>::bump();
 	return false;
 }
 
@@ -403,38 +716,77 @@ bool Unit<T>::erase(const tuple_type& tuple_)
 		return true;
 	
 	CONTAINER_REMOVE(m_storage, &x);
-	delete r;
+	if (group_type::ENABLED)
+		m_groups.remove(group_type::span(r->first), r);
+
+	Generation<T>::bump();
+	// NB. a reader may still walk the row.
+	static_cast<ThreadsafeContainer::Base* >(m_storage->container_data)->dispose(r, &destroy);
 	return false;
 }
 
 template<class T>
-std::list<typename Unit<T>::tupleSP_type> Unit<T>::range(netsnmp_index key_) const
+std::vector<typename Unit<T>::tupleSP_type> Unit<T>::range(const netsnmp_index& key_) const
 {
-	netsnmp_void_array* a = CONTAINER_GET_SUBSET(m_storage, &key_);
-	std::list<tupleSP_type> output;
-	if (NULL != a)
+	struct Collect: ThreadsafeContainer::Visitor
 	{
-		for (size_t i = 0; i < a->size; ++i)
+		bool operator()(void* data_)
 		{
-			row_type* r = (row_type* )a->array[i];
-			output.push_back(r->second);
+			output.push_back(((row_type* )data_)->second);
+			return false;
 		}
-		free(a->array);
-		free(a);
-	}
-	return output;
+
+		std::vector<tupleSP_type> output;
+	} c;
+	walk(key_, c);
+	return c.output;
 }
 
 template<class T>
-std::list<typename Unit<T>::tupleSP_type> Unit<T>::range(Oid_type key_) const
+template<class V>
+void Unit<T>::for_each_in_range(const netsnmp_index& key_, V& visitor_) const
 {
-	netsnmp_index k = {};
-	if (!key_.empty())
+	struct Adapter: ThreadsafeContainer::Visitor
 	{
-		k.len = key_.size();
-		k.oids = &key_[0];
-	}
-	return range(k);
+		explicit Adapter(V& visitor_): m_visitor(&visitor_)
+		{
+		}
+
+		bool operator()(void* data_)
+		{
+			return (*m_visitor)(*((row_type* )data_)->second);
+		}
+	private:
+		V* m_visitor;
+	} a(visitor_);
+	walk(key_, a);
+}
+
+template<class T>
+void Unit<T>::walk(const netsnmp_index& key_, ThreadsafeContainer::Visitor& visitor_) const
+{
+	if (NULL == m_storage)
+		return;
+
+	ThreadsafeContainer::Guard g;
+	// NB. a prefix that is exactly a leading column value names a group.
+	if (group_type::ENABLED && 0 < key_.len && group_type::span(key_) == key_.len)
+		m_groups.visit(key_, visitor_);
+	else
+		static_cast<ThreadsafeContainer::Base* >(m_storage->container_data)->visit(key_, visitor_);
+}
+
+template<class T>
+void Unit<T>::range(const netsnmp_index& key_, rows_type& dst_) const
+{
+	Collect c = {&dst_};
+	for_each_in_range(key_, c);
+}
+
+template<class T>
+std::vector<typename Unit<T>::tupleSP_type> Unit<T>::range(const Oid_type& key_) const
+{
+	return range(index(key_));
 }
 
 template<class T>
@@ -443,20 +795,51 @@ int Unit<T>::handle(netsnmp_mib_handler* handler_, netsnmp_handler_registration*
 	netsnmp_agent_request_info* info_, netsnmp_request_info* requests_)
 {
 	DEBUGMSGTL((TOKEN_PREFIX"handle", "Processing request (%d)\n", info_->mode));
-	for (; NULL != requests_; requests_ = requests_->next)
-	{
-		if (0 != requests_->processed)
-			continue;
+	H* h = (H*)handler_->myvoid;
+	(*h)(info_->mode, requests_);
+	return SNMP_ERR_NOERROR;
+}
 
-		if (0 != requests_->status)
-		{
-			// already got an error.
-			break;
-		}
-		H* h = (H*)handler_->myvoid;
-		(*h)(info_->mode, requests_);
+template<class T>
+int Unit<T>::guard(netsnmp_mib_handler* handler_, netsnmp_handler_registration* reginfo_,
+	netsnmp_agent_request_info* info_, netsnmp_request_info* requests_)
+{
+	ThreadsafeContainer::Guard g;
+	ThreadsafeContainer::Cursor::Scope s(cursor(info_));
+	return netsnmp_call_next_handler(handler_, reginfo_, info_, requests_);
+}
+
+template<class T>
+ThreadsafeContainer::Cursor* Unit<T>::cursor(netsnmp_agent_request_info* info_)
+{
+	if (MODE_GETNEXT != info_->mode && MODE_GETBULK != info_->mode)
+		return NULL;
+
+	static const std::string n = std::string(TOKEN_PREFIX"cursor:")
+					.append(schema_type::name());
+	ThreadsafeContainer::Cursor* output = (ThreadsafeContainer::Cursor* )
+			netsnmp_agent_get_list_data(info_, n.c_str());
+	if (NULL != output)
+		return output;
+
+	output = new ThreadsafeContainer::Cursor;
+	netsnmp_data_list* d = netsnmp_create_data_list(n.c_str(), output,
+					&ThreadsafeContainer::Cursor::destroy);
+	if (NULL == d)
+	{
+		delete output;
+		return NULL;
 	}
-	return SNMP_ERR_NOERROR;
+	netsnmp_agent_add_list_data(info_, d);
+	return output;
+}
+
+template<class T>
+void Unit<T>::destroy(void* row_)
+{
+	Slab<T, row_type> a;
+	a.destroy((row_type* )row_);
+	a.deallocate((row_type* )row_, 1);
 }
 
 } // namespace Table
@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "feed.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+// NB. test_feed drives the streaming sink of the agent against the
+// rmond-feed receiver of the export and checks the frames as the receiver
+// decodes them: the framing, the changed columns, the gone rows, the
+// keyframe every DELTA informs, the informs dropped while the receiver
+// stalls and the new connection after the receiver is gone.
+//
+//	test_feed [RECEIVER]
+//
+// the sink dials a path, thus the receiver listens on a unix socket.
+
+namespace
+{
+using namespace Rmond;
+namespace CPU = VE::CPU;
+
+typedef Table::Unit<CPU::TABLE> cpu_type;
+
+enum
+{
+	// NB. milliseconds.
+	READ_TIMEOUT = 5000,
+	CONNECT_TRIES = 500,
+	// NB. the schema id of the vCPU rows in the feed.
+	CPU_SCHEMA = 4,
+	DELTA = 3,
+	// NB. the rows and the informs of the stall, enough to fill the
+	// backlog of the sink.
+	ROWS = 5000,
+	STALLED = 30,
+	DRAIN = 100
+};
+
+int s_failures = 0;
+
+void fail(const std::string& what_)
+{
+	fprintf(stderr, "%s\n", what_.c_str());
+	++s_failures;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Receiver
+// NB. an rmond-feed process that listens on a unix socket. the lines it
+// prints are read back without the stamps of the frames.
+
+struct Receiver: boost::noncopyable
+{
+	Receiver(const char* program_, const std::string& path_):
+		m_program(program_), m_path(path_), m_pid(-1), m_output(-1)
+	{
+	}
+	~Receiver()
+	{
+		stop();
+	}
+
+	bool start(bool quiet_);
+	void stop();
+	void pause()
+	{
+		kill(m_pid, SIGSTOP);
+	}
+	void resume()
+	{
+		kill(m_pid, SIGCONT);
+	}
+	// NB. empty if there is no line within READ_TIMEOUT.
+	std::string line();
+	void expect(const std::string& line_);
+	long long total();
+private:
+	const char* m_program;
+	std::string m_path;
+	pid_t m_pid;
+	int m_output;
+};
+
+bool Receiver::start(bool quiet_)
+{
+	int p[2];
+	if (0 != pipe(p))
+		return true;
+
+	std::string a = "unix:" + m_path;
+	m_pid = fork();
+	if (0 == m_pid)
+	{
+		dup2(p[1], 1);
+		close(p[0]);
+		close(p[1]);
+		if (quiet_)
+			execl(m_program, m_program, "-q", a.c_str(), (char* )NULL);
+		else
+			execl(m_program, m_program, a.c_str(), (char* )NULL);
+		_exit(127);
+	}
+	close(p[1]);
+	m_output = p[0];
+	if (0 > m_pid)
+		return true;
+
+	// NB. the receiver binds its socket after the start. a probe tells
+	// when it listens, the receiver reports the empty connection.
+	sockaddr_un u = {};
+	u.sun_family = AF_UNIX;
+	strncpy(u.sun_path, m_path.c_str(), sizeof(u.sun_path) - 1);
+	for (int i = 0; i < CONNECT_TRIES; ++i)
+	{
+		int s = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (0 > s)
+			return true;
+
+		int e = connect(s, (const sockaddr* )&u, sizeof(u));
+		close(s);
+		if (0 == e)
+			return "0 frames, 0 bytes" != line();
+
+		usleep(10000);
+	}
+	return true;
+}
+
+void Receiver::stop()
+{
+	if (0 < m_pid)
+	{
+		kill(m_pid, SIGKILL);
+		waitpid(m_pid, NULL, 0);
+	}
+	if (-1 != m_output)
+		close(m_output);
+
+	m_pid = -1;
+	m_output = -1;
+}
+
+std::string Receiver::line()
+{
+	std::string output;
+	for (char c; ; output += c)
+	{
+		pollfd p = {m_output, POLLIN, 0};
+		if (1 != poll(&p, 1, READ_TIMEOUT) || 1 != read(m_output, &c, 1))
+			return std::string();
+		if ('\n' == c)
+			break;
+	}
+	// NB. row STAMP schema ..., gone STAMP schema ...
+	size_t b = output.find(' ');
+	if (0 == output.compare(0, b, "row") || 0 == output.compare(0, b, "gone"))
+		output.erase(b, output.find(' ', b + 1) - b);
+
+	return output;
+}
+
+void Receiver::expect(const std::string& line_)
+{
+	std::string x = line();
+	if (x != line_)
+		fail("\"" + x + "\" instead of \"" + line_ + "\"");
+}
+
+// NB. the frames of the connection that is over, -1 if there are none.
+long long Receiver::total()
+{
+	unsigned long long f = 0, b = 0;
+	std::string x = line();
+	if (2 == sscanf(x.c_str(), "%llu frames, %llu bytes", &f, &b))
+		return f;
+
+	fail("no totals from the receiver: \"" + x + "\"");
+	return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Space
+// NB. the tables a streaming sink reads, the vCPUs of the VEs only.
+
+struct Space
+{
+	Space(): filter(new Value::Filter(Value::Metrix_type()))
+	{
+		host.get<0>().reset(new Host::tuple_type);
+		host.get<0>()->put<Host::LOCAL_VES>(3);
+		ves.get<0>().reset(new VE::table_type);
+		ves.get<1>().reset(new Table::Unit<VE::Disk::TABLE>);
+		ves.get<2>().reset(new Table::Unit<VE::Network::TABLE>);
+		ves.get<3>().reset(new cpu_type);
+		ves.get<4>().reset(new Table::Unit<VE::Counters::Linux::TABLE>);
+	}
+
+	cpu_type::tupleSP_type insert(const std::string& ve_, int ordinal_,
+		unsigned long long time_);
+	Sink::table_type::tupleSP_type sink(const std::string& path_, int delta_) const;
+
+	boost::shared_ptr<Value::Filter> filter;
+	Host::space_type host;
+	VE::space_type ves;
+};
+
+cpu_type::tupleSP_type Space::insert(const std::string& ve_, int ordinal_,
+	unsigned long long time_)
+{
+	cpu_type::key_type k;
+	k.put<VE::TABLE, VE::VEID>(ve_);
+	k.put<CPU::ORDINAL>(ordinal_);
+	cpu_type::tupleSP_type output = cpu_type::make(k);
+	output->put<CPU::TIME>(time_);
+	ves.get<3>()->insert(output);
+	return output;
+}
+
+Sink::table_type::tupleSP_type Space::sink(const std::string& path_, int delta_) const
+{
+	Sink::table_type::key_type k;
+	k.put<Sink::TABLE, Sink::HOST>(path_);
+	k.put<Sink::TABLE, Sink::PORT>(0);
+	Sink::table_type::tupleSP_type output = Sink::table_type::make(k);
+	output->put<Sink::TRANSPORT>(Sink::TRANSPORT_UNIX);
+	output->put<Sink::DELTA>(delta_);
+	return output;
+}
+
+// NB. the line of the receiver for a vCPU frame, the columns are the
+// ordinal and the time.
+std::string cpu(const char* kind_, const cpu_type::tuple_type& row_, const char* columns_)
+{
+	std::ostringstream output;
+	output << kind_ << " schema " << (int)CPU_SCHEMA << " key ";
+	const netsnmp_index& k = row_.key();
+	for (size_t i = 0; i < k.len; ++i)
+		output << "." << k.oids[i];
+
+	output << columns_;
+	return output.str();
+}
+
+// NB. all the host scalars, only the local VEs are set.
+std::string host()
+{
+	std::ostringstream output;
+	output << "row schema 0 key ";
+	for (int i = 0; i < Export::Sheet<Host::PROPERTY>::COLUMNS; ++i)
+		output << " " << i << "=" << (0 == i ? 3 : 0);
+
+	return output.str();
+}
+
+// NB. the first inform describes the tables and sends all the rows, the next
+// ones the changed columns and the gone rows only, every DELTA-th all the
+// rows again. the connection is over with the sink.
+void frames(Space& space_, Receiver& receiver_, const std::string& path_)
+{
+	std::auto_ptr<Feed::Unit> u(new Feed::Unit);
+	Sink::table_type::tupleSP_type s = space_.sink(path_, DELTA);
+	cpu_type::tupleSP_type a = space_.insert("101", 1, 100);
+	cpu_type::tupleSP_type b = space_.insert("101", 2, 200);
+	cpu_type::tupleSP_type c = space_.insert("101", 3, 300);
+	u->push(*s, space_.filter, space_.host, space_.ves);
+	receiver_.expect("schema of 6 tables");
+	receiver_.expect(host());
+	receiver_.expect(cpu("row", *a, " 0=1 1=100"));
+	receiver_.expect(cpu("row", *b, " 0=2 1=200"));
+	receiver_.expect(cpu("row", *c, " 0=3 1=300"));
+
+	b->put<CPU::TIME>(250);
+	u->push(*s, space_.filter, space_.host, space_.ves);
+	receiver_.expect(cpu("row", *b, " 1=250"));
+
+	space_.ves.get<3>()->erase(*c);
+	u->push(*s, space_.filter, space_.host, space_.ves);
+	receiver_.expect(cpu("gone", *c, ""));
+
+	// NB. nothing has changed, the keyframe sends it all anyway. the
+	// inform after it sends nothing, the one after that the change only.
+	u->push(*s, space_.filter, space_.host, space_.ves);
+	receiver_.expect(host());
+	receiver_.expect(cpu("row", *a, " 0=1 1=100"));
+	receiver_.expect(cpu("row", *b, " 0=2 1=250"));
+	u->push(*s, space_.filter, space_.host, space_.ves);
+	a->put<CPU::TIME>(150);
+	u->push(*s, space_.filter, space_.host, space_.ves);
+	receiver_.expect(cpu("row", *a, " 1=150"));
+	u.reset();
+	if (11 != receiver_.total())
+		fail("the frames of the connection do not add up");
+
+	space_.ves.get<3>()->erase(*a);
+	space_.ves.get<3>()->erase(*b);
+}
+
+// NB. the receiver is gone, the sink fails to write and connects again
+// after the backoff. the new connection starts over with the schema and
+// all the rows.
+void reconnect(Space& space_, Receiver& receiver_, const std::string& path_)
+{
+	Feed::Unit u;
+	Sink::table_type::tupleSP_type s = space_.sink(path_, DELTA);
+	cpu_type::tupleSP_type a = space_.insert("101", 1, 100);
+	u.push(*s, space_.filter, space_.host, space_.ves);
+	receiver_.expect("schema of 6 tables");
+	receiver_.expect(host());
+	receiver_.expect(cpu("row", *a, " 0=1 1=100"));
+
+	receiver_.stop();
+	a->put<CPU::TIME>(175);
+	u.push(*s, space_.filter, space_.host, space_.ves);
+	if (receiver_.start(false))
+	{
+		fail("cannot start the receiver again");
+		return;
+	}
+	// NB. the first backoff is a second.
+	sleep(2);
+	u.push(*s, space_.filter, space_.host, space_.ves);
+	receiver_.expect("schema of 6 tables");
+	receiver_.expect(host());
+	receiver_.expect(cpu("row", *a, " 0=1 1=175"));
+	space_.ves.get<3>()->erase(*a);
+}
+
+// NB. a stalled receiver fills the backlog, the informs are dropped till it
+// drains. an inform goes whole or not at all, thus the receiver gets whole
+// keyframes only.
+void backlog(Space& space_, Receiver& receiver_, const std::string& path_)
+{
+	std::vector<cpu_type::tupleSP_type> r;
+	for (int i = 0; i < ROWS; ++i)
+		r.push_back(space_.insert("102", i + 1, i));
+
+	{
+		Feed::Unit u;
+		Sink::table_type::tupleSP_type s = space_.sink(path_, 1);
+		u.push(*s, space_.filter, space_.host, space_.ves);
+		receiver_.pause();
+		for (int i = 0; i < STALLED; ++i)
+			u.push(*s, space_.filter, space_.host, space_.ves);
+
+		receiver_.resume();
+		// NB. no more keyframes, the informs flush the backlog only.
+		s->put<Sink::DELTA>(1 << 30);
+		for (int i = 0; i < DRAIN; ++i)
+		{
+			u.push(*s, space_.filter, space_.host, space_.ves);
+			usleep(10000);
+		}
+	}
+	long long f = receiver_.total();
+	if (0 > f)
+		return;
+
+	// NB. the schema, then the host and the rows of every inform that went.
+	long long k = ROWS + 1, n = (f - 1) / k;
+	if (0 != (f - 1) % k || n < 2 || n > STALLED)
+	{
+		std::ostringstream y;
+		y << f << " frames, " << n << " informs of " << 1 + STALLED << " went";
+		fail(y.str());
+	}
+	BOOST_FOREACH(cpu_type::tupleSP_type t, r)
+	{
+		space_.ves.get<3>()->erase(*t);
+	}
+}
+
+} // namespace
+
+int main(int argc_, char** argv_)
+{
+	const char* p = argc_ > 1 ? argv_[1] : "../export/rmond-feed";
+	signal(SIGPIPE, SIG_IGN);
+	char d[] = "/tmp/test_feed.XXXXXX";
+	if (NULL == mkdtemp(d))
+	{
+		perror(d);
+		return 1;
+	}
+	std::string a = std::string(d) + "/a", b = std::string(d) + "/b";
+	netsnmp_container_init_list();
+	ThreadsafeContainer::inject();
+	{
+		Space s;
+		Receiver x(p, a), y(p, b);
+		if (x.start(false) || y.start(true))
+		{
+			fprintf(stderr, "cannot start %s\n", p);
+			return 1;
+		}
+		frames(s, x, a);
+		reconnect(s, x, a);
+		backlog(s, y, b);
+	}
+	unlink(a.c_str());
+	unlink(b.c_str());
+	rmdir(d);
+	if (0 != s_failures)
+	{
+		fprintf(stderr, "%d checks failed\n", s_failures);
+		return 1;
+	}
+	printf("feed: ok\n");
+	return 0;
+}
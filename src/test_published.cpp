@@ -0,0 +1,170 @@
+#include "published.h"
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+ * Stresses the published values: writers keep storing values that carry
+ * their own checksum, readers copy them out or look at them in place and
+ * fail on any torn one.
+ *
+ *	test_published [SECONDS]
+ */
+#define WRITERS 2
+#define READERS 6
+
+namespace
+{
+typedef Rmond::Published<std::string> string_type;
+typedef Rmond::Published<std::vector<unsigned long> > vector_type;
+
+string_type s_string;
+vector_type s_vector;
+int s_stop = 0;
+int s_failures = 0;
+
+// NB. a value of length n is made of n times the same digit n % 10.
+std::string make(unsigned n_)
+{
+	return std::string(n_, '0' + n_ % 10);
+}
+
+bool valid(const std::string& value_)
+{
+	return value_.find_first_not_of('0' + value_.size() % 10) == std::string::npos;
+}
+
+// NB. every element is the size of the vector.
+bool valid(const std::vector<unsigned long>& value_)
+{
+	for (size_t i = 0; i < value_.size(); ++i)
+	{
+		if (value_[i] != value_.size())
+			return false;
+	}
+	return true;
+}
+
+// NB. stores a new value while the current one is read: a writer that
+// waited for the readers would never return.
+struct Overwrite
+{
+	explicit Overwrite(string_type& value_): output(false), m_value(&value_)
+	{
+	}
+
+	void operator()(const std::string& value_)
+	{
+		m_value->store(value_ + "x");
+		m_value->store(value_ + "y");
+		output = value_ == "b" && m_value->load() == "by";
+	}
+
+	bool output;
+private:
+	string_type* m_value;
+};
+
+struct Check
+{
+	Check(): output(true)
+	{
+	}
+
+	template<class T>
+	void operator()(const T& value_)
+	{
+		output = valid(value_);
+	}
+
+	bool output;
+};
+
+void* write(void* seed_)
+{
+	unsigned r = (unsigned)(size_t)seed_;
+	unsigned long n = 0;
+	while (!__atomic_load_n(&s_stop, __ATOMIC_RELAXED))
+	{
+		// NB. both short and heap sized strings.
+		s_string.store(make(rand_r(&r) % 200));
+		unsigned k = rand_r(&r) % 64;
+		s_vector.store(std::vector<unsigned long>(k, k));
+		++n;
+	}
+	return (void* )n;
+}
+
+void* read(void* )
+{
+	unsigned long n = 0;
+	while (!__atomic_load_n(&s_stop, __ATOMIC_RELAXED))
+	{
+		Check c;
+		s_string.read(c);
+		bool x = c.output && valid(s_string.load());
+		s_vector.read(c);
+		x = x && c.output && valid(s_vector.load());
+		if (!x)
+			__atomic_add_fetch(&s_failures, 1, __ATOMIC_RELAXED);
+		++n;
+	}
+	return (void* )n;
+}
+
+} // namespace
+
+int main(int argc_, char** argv_)
+{
+	int s = argc_ > 1 ? atoi(argv_[1]) : 2;
+	if (s <= 0)
+	{
+		fprintf(stderr, "usage: %s [SECONDS]\n", argv_[0]);
+		return 2;
+	}
+	// NB. storing the same value again is no change.
+	string_type x;
+	if (!x.store("a") || x.store("a") || !x.store("b") || x.load() != "b")
+	{
+		fprintf(stderr, "store does not report the changes\n");
+		return 1;
+	}
+	Overwrite o(x);
+	x.read(o);
+	if (!o.output)
+	{
+		fprintf(stderr, "a store is held up by a reader\n");
+		return 1;
+	}
+	pthread_t w[WRITERS], r[READERS];
+	for (size_t i = 0; i < WRITERS; ++i)
+		pthread_create(&w[i], NULL, &write, (void* )(i + 1));
+	for (size_t i = 0; i < READERS; ++i)
+		pthread_create(&r[i], NULL, &read, NULL);
+
+	sleep(s);
+	__atomic_store_n(&s_stop, 1, __ATOMIC_RELAXED);
+	unsigned long stores = 0, reads = 0;
+	for (size_t i = 0; i < WRITERS; ++i)
+	{
+		void* n;
+		pthread_join(w[i], &n);
+		stores += (unsigned long)n;
+	}
+	for (size_t i = 0; i < READERS; ++i)
+	{
+		void* n;
+		pthread_join(r[i], &n);
+		reads += (unsigned long)n;
+	}
+	if (0 != s_failures || !valid(s_string.load()) || !valid(s_vector.load()))
+	{
+		fprintf(stderr, "%d torn reads of %lu\n", s_failures, reads);
+		return 1;
+	}
+	printf("published: ok, %lu stores, %lu reads in %d s\n", stores, reads, s);
+	return 0;
+}
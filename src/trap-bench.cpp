@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2016 Parallels IP Holdings GmbH
+ * Copyright (c) 2017-2019 Virtuozzo International GmbH. All rights reserved.
+ *
+ * This file is part of OpenVZ. OpenVZ is free software; you can redistribute
+ * it and/or modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the License,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * Our contact details: Virtuozzo IP Holdings GmbH, Vordergasse 59, 8200
+ * Schaffhausen, Switzerland.
+ */
+
+#include "mib.h"
+#include "value.h"
+#include "proxy.h"
+#include "datagram.h"
+#include "allocations.h"
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <net-snmp/agent/mib_modules.h>
+
+// NB. drs-trap-bench encodes the snapshots of a simulated host the way a
+// sink does, in the delta mode too, and sends the traps to a local UDP
+// receiver, so that the sink path can be measured without the agent.
+//
+//	drs-trap-bench [-1] [-p] [-n VARBINDS] [-w WIDTH] [-c CHANGED%] [-d DELTA]
+//		[-l LIMIT] [-b BYTES] [-r ROUNDS]
+//
+// -1 sends every trap with a sendto of its own instead of sendmmsg. LIMIT
+// and BYTES bound the composites and the varbind bytes of a trap. -p puts
+// the proxied scalar of the host in front of every snapshot, read directly
+// or, with RMOND_PROXY=agent, by a GET through an agent of the bench's own.
+// the heap allocations of the first round are counted apart from those of
+// the rounds after it, when the buffers have grown.
+
+extern netsnmp_session* main_session;
+
+namespace Rmond
+{
+// NB. the bench links neither the MIB nor the tables, the OIDs are those
+// of the agent.
+Oid_type Central::traps()
+{
+	static const Oid_type::value_type NAME[] = {SNMP_OID_ENTERPRISES, 26171, 3};
+	return Oid_type(NAME, NAME + sizeof(NAME)/sizeof(NAME[0]));
+}
+
+Oid_type Central::product()
+{
+	static const Oid_type::value_type NAME[] = {SNMP_OID_ENTERPRISES, 26171, 1, 2};
+	return Oid_type(NAME, NAME + sizeof(NAME)/sizeof(NAME[0]));
+}
+
+} // namespace Rmond
+
+namespace
+{
+using namespace Rmond;
+
+// NB. monotonic, nanoseconds.
+unsigned long long now()
+{
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Options
+
+struct Options
+{
+	Options(): single(false), proxy(false), varbinds(2000), width(10), changed(10),
+		delta(0), limit(1000000), budget(1200), rounds(1000)
+	{
+	}
+
+	bool parse(int argc_, char** argv_);
+
+	bool single;
+	bool proxy;
+	unsigned varbinds;
+	// NB. the varbinds of a composite, i.e. of a VE.
+	unsigned width;
+	// NB. the percentage of the values that change every round.
+	unsigned changed;
+	unsigned delta;
+	unsigned limit;
+	unsigned budget;
+	unsigned rounds;
+};
+
+bool Options::parse(int argc_, char** argv_)
+{
+	int c;
+	while (-1 != (c = getopt(argc_, argv_, "1pn:w:c:d:l:b:r:")))
+	{
+		switch (c)
+		{
+		case '1':
+			single = true;
+			break;
+		case 'p':
+			proxy = true;
+			break;
+		case 'n':
+			varbinds = atoi(optarg);
+			break;
+		case 'w':
+			width = atoi(optarg);
+			break;
+		case 'c':
+			changed = atoi(optarg);
+			break;
+		case 'd':
+			delta = atoi(optarg);
+			break;
+		case 'l':
+			limit = atoi(optarg);
+			break;
+		case 'b':
+			budget = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		default:
+			return true;
+		}
+	}
+	return optind != argc_ || 0 == varbinds || 0 == width || 100 < changed ||
+		0 == limit || 0 == rounds;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Counter
+
+struct Counter
+{
+	static bool do_(unsigned long long src_, const oid* name_, size_t length_,
+		u_char*& dst_, size_t& left_)
+	{
+		return Asn::Policy::Counter::build(src_, name_, length_, dst_, left_);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Receiver
+// NB. counts the datagrams that arrive at a local UDP port.
+
+struct Receiver
+{
+	Receiver(): datagrams(), bytes(), m_socket(-1), m_stop()
+	{
+	}
+
+	bool start(sockaddr_in& address_);
+	void stop();
+
+	unsigned long long datagrams;
+	unsigned long long bytes;
+private:
+	static void* run(void* this_);
+
+	int m_socket;
+	int m_stop;
+	pthread_t m_thread;
+};
+
+bool Receiver::start(sockaddr_in& address_)
+{
+	m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (0 > m_socket)
+		return true;
+
+	int z = 16 << 20;
+	setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &z, sizeof(z));
+	timeval t = {0, 100000};
+	setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t));
+	address_ = sockaddr_in();
+	address_.sin_family = AF_INET;
+	address_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t n = sizeof(address_);
+	if (0 != bind(m_socket, (sockaddr* )&address_, n) ||
+		0 != getsockname(m_socket, (sockaddr* )&address_, &n))
+		return true;
+
+	return 0 != pthread_create(&m_thread, NULL, &run, this);
+}
+
+void Receiver::stop()
+{
+	__atomic_store_n(&m_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(m_thread, NULL);
+	close(m_socket);
+}
+
+void* Receiver::run(void* this_)
+{
+	Receiver* r = (Receiver* )this_;
+	static char b[65536];
+	for (;;)
+	{
+		ssize_t n = recv(r->m_socket, b, sizeof(b), 0);
+		if (0 < n)
+		{
+			++r->datagrams;
+			r->bytes += n;
+		}
+		else if (__atomic_load_n(&r->m_stop, __ATOMIC_ACQUIRE))
+			break;
+	}
+	return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Sender
+// NB. sends the frames of a round through the Datagram of Sink::Batch or
+// with a sendto each.
+
+struct Sender
+{
+	Sender(bool single_, const sockaddr_in& peer_): calls(), failures(),
+		m_single(single_), m_peer(peer_)
+	{
+		m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	}
+	~Sender()
+	{
+		close(m_socket);
+	}
+
+	void send(std::vector<std::vector<u_char> >& frames_, size_t size_);
+
+	unsigned long long calls;
+	unsigned long long failures;
+private:
+	bool m_single;
+	int m_socket;
+	sockaddr_in m_peer;
+	Datagram m_datagram;
+};
+
+void Sender::send(std::vector<std::vector<u_char> >& frames_, size_t size_)
+{
+	if (!m_single)
+	{
+		failures += m_datagram.send(m_socket, m_peer, frames_, size_);
+		calls += m_datagram.calls();
+		return;
+	}
+	for (size_t i = 0; i < size_; ++i, ++calls)
+	{
+		if (0 > sendto(m_socket, &frames_[i][0], frames_[i].size(), 0,
+			(const sockaddr* )&m_peer, sizeof(m_peer)))
+			++failures;
+	}
+}
+
+// NB. CHANGED% of the VARBINDS counters differ from the previous round.
+void advance(const Options& options_, unsigned round_, std::vector<unsigned long long>& values_)
+{
+	for (unsigned i = 0; i < options_.varbinds; ++i)
+	{
+		if ((i * 2654435761U + round_) % 100 < options_.changed)
+			values_[i] += 1 + round_;
+	}
+}
+
+// NB. the MIB modules of net-snmp in the bench, UCD-SNMP-MIB among them, for
+// the GET of the proxy. no port is opened.
+bool agent()
+{
+	static netsnmp_session s;
+	netsnmp_ds_set_boolean(NETSNMP_DS_APPLICATION_ID, NETSNMP_DS_AGENT_ROLE, 0);
+	if (0 != init_agent("drs-trap-bench"))
+		return true;
+
+	init_mib_modules();
+	init_snmp("drs-trap-bench");
+	snmp_sess_init(&s);
+	main_session = &s;
+	return false;
+}
+
+// NB. a snapshot of the counters in composites of WIDTH after the value of
+// the proxy if any. returns the time the proxy took.
+unsigned long long snapshot(const Options& options_, const Host::Proxy* proxy_,
+	const std::vector<unsigned long long>& values_, Value::Stream& dst_)
+{
+	oid n[] = {SNMP_OID_ENTERPRISES, 26171, 1, 2, 55, 1, 0, 0};
+	size_t z = sizeof(n) / sizeof(n[0]);
+	unsigned long long output = 0;
+	dst_.clear();
+	if (NULL != proxy_)
+	{
+		static const Value::Filter f((Value::Metrix_type()));
+		output = now();
+		proxy_->stream(f, dst_);
+		output = now() - output;
+		dst_.mark();
+	}
+	for (unsigned i = 0; i < options_.varbinds; ++i)
+	{
+		n[z - 2] = i % options_.width + 1;
+		n[z - 1] = i / options_.width + 1;
+		dst_.put<Counter>(values_[i], n, z);
+		if (0 == (i + 1) % options_.width)
+			dst_.mark();
+	}
+	dst_.mark();
+	return output;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	Options o;
+	if (o.parse(argc, argv))
+	{
+		fprintf(stderr, "usage: %s [-1] [-p] [-n VARBINDS] [-w WIDTH] [-c CHANGED%%] "
+			"[-d DELTA] [-l LIMIT] [-b BYTES] [-r ROUNDS]\n", argv[0]);
+		return 2;
+	}
+	const char* j = getenv("RMOND_PROXY");
+	bool m = NULL != j && 0 == strcmp(j, "agent");
+	if (o.proxy && m && agent())
+	{
+		fprintf(stderr, "cannot start the agent\n");
+		return 1;
+	}
+	// NB. memTotalReal, the one the host proxies.
+	static const oid P[] = {1, 3, 6, 1, 4, 1, 2021, 4, 5, 0};
+	std::auto_ptr<Host::Proxy> t;
+	if (o.proxy)
+		t.reset(new Host::Proxy(Oid_type(P, P + sizeof(P) / sizeof(P[0]))));
+
+	sockaddr_in a;
+	Receiver r;
+	if (r.start(a))
+	{
+		perror("receiver");
+		return 1;
+	}
+	netsnmp_session x = {};
+	x.version = SNMP_VERSION_2c;
+	x.community = (u_char* )"public";
+	x.community_len = 6;
+
+	Sender s(o.single, a);
+	Value::Stream w, h, d;
+	// NB. the budget of the varbinds as the sink counts it.
+	size_t u = 0, g = 0;
+	if (Value::Trap::overhead(x, h, u))
+	{
+		fprintf(stderr, "cannot measure the overhead of a trap\n");
+		return 1;
+	}
+	if (0 < o.budget)
+		g = o.budget > u ? o.budget - u : 1;
+
+	Value::Delta y;
+	std::vector<unsigned long long> v(o.varbinds);
+	std::vector<std::vector<u_char> > f;
+	unsigned long long traps = 0, bytes = 0, encode = 0, send = 0, same = 0, over = 0;
+	unsigned long long first = 0, proxy = 0, warm = 0, heap = 0;
+	for (unsigned i = 0; i < o.rounds; ++i)
+	{
+		advance(o, i, v);
+		unsigned long long l = Bench::allocations(), b = now();
+		unsigned long long z = snapshot(o, t.get(), v, w);
+		if (0 == i)
+			first = z;
+		else
+			proxy += z;
+
+		const Value::Stream* q = &w;
+		if (0 < o.delta)
+		{
+			if (0 == i % o.delta)
+				y.clear();
+
+			d.clear();
+			d.append(w, y);
+			same += d.same();
+			q = &d;
+		}
+		size_t k = 0;
+		for (size_t p = 0, e = 0; p < q->size(); p = e, ++k)
+		{
+			e = q->cut(p, o.limit, g);
+			if (f.size() == k)
+				f.resize(k + 1);
+			if (Value::Trap::frame(x, h, q->data() + p, e - p, f[k]))
+			{
+				fprintf(stderr, "cannot frame a trap of %zu bytes\n", e - p);
+				return 1;
+			}
+			bytes += f[k].size();
+			if (0 < o.budget && o.budget < f[k].size())
+				++over;
+		}
+		unsigned long long c = now();
+		s.send(f, k);
+		send += now() - c;
+		encode += c - b;
+		traps += k;
+		(0 == i ? warm : heap) += Bench::allocations() - l;
+	}
+	r.stop();
+	printf("%s, %u varbinds, %u%% changed, delta %u: %llu traps, %llu bytes a round\n",
+		o.single ? "sendto" : "sendmmsg", o.varbinds, o.changed, o.delta,
+		traps / o.rounds, bytes / o.rounds);
+	printf("encode %llu ns, send %llu ns in %llu calls a round, %llu varbinds "
+		"unchanged a round\n", encode / o.rounds, send / o.rounds,
+		s.calls / o.rounds, same / o.rounds);
+	printf("received %llu of %llu datagrams, %llu send failures, %llu traps "
+		"over %u bytes\n", r.datagrams, traps, s.failures, over, o.budget);
+	printf("allocations: %llu the first round, %.2f a round after\n", warm,
+		1 < o.rounds ? (double)heap / (o.rounds - 1) : 0.0);
+	if (o.proxy)
+	{
+		printf("proxy %s: first value %llu ns, then %llu ns a trap\n",
+			m ? "through the agent" : "direct", first,
+			1 < o.rounds ? proxy / (o.rounds - 1) : 0);
+	}
+	return 0 != s.failures;
+}
@@ -23,6 +23,7 @@
 
 #include "asn.h"
 #include "value.h"
+#include <algorithm>
 #include <boost/foreach.hpp>
 
 extern oid snmptrap_oid[];
@@ -49,101 +50,447 @@ netsnmp_variable_list* Provider::make() const
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// struct Uptime
+// struct TrapAddress
 
-struct Uptime: Provider
+struct TrapAddress: Provider
 {
 	netsnmp_variable_list* make() const;
 };
 
-netsnmp_variable_list* Uptime::make() const
+netsnmp_variable_list* TrapAddress::make() const
 {
 	netsnmp_variable_list* output = Provider::make();
 	if (NULL == output)
 		return NULL;
 
-	Asn::Policy::Integer<ASN_TIMETICKS>::get(netsnmp_get_agent_uptime(), *output);
+	Asn::Policy::IP::get(ntohl(get_myaddr()), *output);
 	return output;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// struct TrapAddress
-
-struct TrapAddress: Provider
-{
-	netsnmp_variable_list* make() const;
-};
+// struct Trap
 
-netsnmp_variable_list* TrapAddress::make() const
+netsnmp_variable_list* Trap::make() const
 {
 	netsnmp_variable_list* output = Provider::make();
 	if (NULL == output)
 		return NULL;
 
-	Asn::Policy::IP::get(ntohl(get_myaddr()), *output);
+	Oid_type n = Central::traps();
+	n.push_back(0);
+	n.push_back(51);
+	Asn::Policy::ObjectId::get(n, *output);
 	return output;
 }
 
+namespace
+{
+enum
+{
+	// NB. asn_build_sequence always writes the 2 bytes long form.
+	SEQUENCE_HEADER = 4,
+	// NB. the widest BER integer asn_build_int writes for a long.
+	INTEGER_MAX = 2 + sizeof(long) + 1,
+	MAX_MESSAGE = 0xffff
+};
+
 ///////////////////////////////////////////////////////////////////////////////
-// struct Trap
+// struct Fixed
+// NB. the snmpTrapOID and the agentAddr varbinds are the same in every trap
+// and are encoded once.
 
-netsnmp_pdu* Trap::pdu(netsnmp_variable_list* data_)
+struct Fixed: Stream
 {
-	if (NULL == data_)
-		return NULL;
+	Fixed()
+	{
+		put(Named(snmptrap_oid, snmptrap_oid_len, new Trap));
+		put(Named(agentaddr_oid, agentaddr_oid_len, new TrapAddress));
+	}
+};
+
+} // namespace
 
-	netsnmp_pdu* u = snmp_pdu_create(SNMP_MSG_TRAP2);
-	while (NULL != u)
+bool Trap::frame(const netsnmp_session& session_, const Stream& head_,
+	const u_char* data_, size_t size_, std::vector<u_char>& dst_)
+{
+	static const Fixed f;
+
+	u_char a[64];
+	u_char* u = a;
+	size_t n = sizeof(a);
+	if (Asn::Policy::Integer<ASN_TIMETICKS>::build(netsnmp_get_agent_uptime(),
+		sysuptime_oid, sysuptime_oid_len, u, n))
+		return true;
+
+	// NB. request-id, error-status and error-index.
+	u_char b[3 * INTEGER_MAX];
+	u_char* r = b;
+	n = sizeof(b);
+	long x = snmp_get_next_reqid(), y = 0;
+	r = asn_build_int(r, &n, ASN_INTEGER, &x, sizeof(x));
+	if (NULL != r)
+		r = asn_build_int(r, &n, ASN_INTEGER, &y, sizeof(y));
+	if (NULL != r)
+		r = asn_build_int(r, &n, ASN_INTEGER, &y, sizeof(y));
+	if (NULL == r)
+		return true;
+
+	size_t v = (u - a) + f.size() + head_.size() + size_;
+	size_t p = (r - b) + SEQUENCE_HEADER + v;
+	dst_.resize(SEQUENCE_HEADER + INTEGER_MAX + SEQUENCE_HEADER +
+		session_.community_len + SEQUENCE_HEADER + p);
+	if (MAX_MESSAGE < dst_.size())
+		return true;
+
+	u_char* o = &dst_[0] + SEQUENCE_HEADER;
+	n = dst_.size() - SEQUENCE_HEADER;
+	x = session_.version;
+	o = asn_build_int(o, &n, ASN_INTEGER, &x, sizeof(x));
+	if (NULL != o)
 	{
-		netsnmp_variable_list* h = Named(sysuptime_oid, sysuptime_oid_len,
-							new Uptime).make();
-		if (NULL == h)
-			break;
+		o = asn_build_string(o, &n, ASN_OCTET_STR, session_.community,
+			session_.community_len);
+	}
+	if (NULL != o)
+		o = asn_build_sequence(o, &n, SNMP_MSG_TRAP2, p);
+	if (NULL == o)
+		return true;
+
+	o = std::copy(b, r, o);
+	n -= r - b;
+	o = asn_build_sequence(o, &n, ASN_SEQUENCE | ASN_CONSTRUCTOR, v);
+	if (NULL == o)
+		return true;
+
+	o = std::copy(a, u, o);
+	o = std::copy(f.data(), f.data() + f.size(), o);
+	o = std::copy(head_.data(), head_.data() + head_.size(), o);
+	o = std::copy(data_, data_ + size_, o);
+	dst_.resize(o - &dst_[0]);
+	n = SEQUENCE_HEADER;
+	return NULL == asn_build_sequence(&dst_[0], &n, ASN_SEQUENCE | ASN_CONSTRUCTOR,
+			dst_.size() - SEQUENCE_HEADER);
+}
 
-		u->variables = h;
-		h->next_variable = Named(snmptrap_oid, snmptrap_oid_len,
-						new Trap).make();
-		h = h->next_variable;
-		if (NULL == h)
-			break;
+bool Trap::overhead(const netsnmp_session& session_, const Stream& head_, size_t& dst_)
+{
+	static const Fixed f;
+
+	// NB. the sysUpTime of 0 takes 3 bytes of its value, the room for the
+	// widest one is reserved instead, as for the request-id.
+	u_char a[64];
+	u_char* u = a;
+	size_t n = sizeof(a);
+	if (Asn::Policy::Integer<ASN_TIMETICKS>::build(0, sysuptime_oid,
+		sysuptime_oid_len, u, n))
+		return true;
+
+	// NB. the error-status and the error-index are always 0.
+	u_char b[2 * INTEGER_MAX];
+	u_char* r = b;
+	n = sizeof(b);
+	long y = 0;
+	r = asn_build_int(r, &n, ASN_INTEGER, &y, sizeof(y));
+	if (NULL != r)
+		r = asn_build_int(r, &n, ASN_INTEGER, &y, sizeof(y));
+	if (NULL == r)
+		return true;
+
+	dst_ = SEQUENCE_HEADER + INTEGER_MAX + SEQUENCE_HEADER +
+		session_.community_len + SEQUENCE_HEADER + INTEGER_MAX + (r - b) +
+		SEQUENCE_HEADER + (u - a) + INTEGER_MAX - 3 + f.size() + head_.size();
+	return false;
+}
+
+namespace
+{
+// NB. the size of the BER TLV at data_ and the size of its header, 0 if it
+// is malformed or does not fit.
+size_t span(const u_char* data_, size_t size_, size_t& header_)
+{
+	if (2 > size_)
+		return 0;
+
+	size_t n = data_[1];
+	header_ = 2;
+	if (0x80 & n)
+	{
+		size_t k = n & 0x7f;
+		if (sizeof(size_t) < k || size_ - 2 < k)
+			return 0;
+
+		n = 0;
+		for (size_t i = 0; i < k; ++i)
+			n = (n << 8) | data_[2 + i];
+
+		header_ += k;
+	}
+	return size_ - header_ < n ? 0 : header_ + n;
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Filter
+
+Filter::Filter(const Metrix_type& metrix_): m_metrix(metrix_), m_trie(1)
+{
+	std::fill(m_plan, m_plan + MAX_SLOTS, (u_char)UNKNOWN);
+	BOOST_FOREACH(const Oid_type& m, m_metrix)
+	{
+		size_t n = 0;
+		BOOST_FOREACH(oid x, m)
+		{
+			std::map<oid, size_t>::iterator p = m_trie[n].next.find(x);
+			if (m_trie[n].next.end() != p)
+			{
+				n = p->second;
+				continue;
+			}
+			m_trie[n].next[x] = m_trie.size();
+			n = m_trie.size();
+			m_trie.push_back(Node());
+		}
+		m_trie[n].leaf = true;
+	}
+}
+
+bool Filter::match(const Oid_type& name_) const
+{
+	if (m_metrix.empty())
+		return true;
+
+	size_t n = 0;
+	BOOST_FOREACH(oid x, name_)
+	{
+		if (m_trie[n].leaf)
+			return true;
+
+		std::map<oid, size_t>::const_iterator p = m_trie[n].next.find(x);
+		if (m_trie[n].next.end() == p)
+			return false;
+
+		n = p->second;
+	}
+	return m_trie[n].leaf;
+}
+
+bool Filter::select(size_t slot_, uuid_type uuid_) const
+{
+	if (m_metrix.empty())
+		return true;
+	if (MAX_SLOTS <= slot_)
+		return match(uuid_());
+
+	// NB. the threads that race here make the same decision.
+	u_char x = __atomic_load_n(&m_plan[slot_], __ATOMIC_RELAXED);
+	if (UNKNOWN == x)
+	{
+		x = match(uuid_()) ? SELECTED : REJECTED;
+		__atomic_store_n(&m_plan[slot_], x, __ATOMIC_RELAXED);
+	}
+	return SELECTED == x;
+}
+
+size_t Filter::slot()
+{
+	static size_t s_slots = 0;
+	return __atomic_fetch_add(&s_slots, 1, __ATOMIC_RELAXED);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Delta
 
-		h->next_variable = Named(agentaddr_oid, snmptrap_oid_len,
-						new TrapAddress).make();
-		h = h->next_variable;
-		if (NULL == h)
+size_t Delta::Hash::operator()(const key_type& key_) const
+{
+	return boost::hash_range(key_.begin(), key_.end());
+}
+
+size_t Delta::Hash::operator()(const Range& key_) const
+{
+	return boost::hash_range(key_.data, key_.data + key_.size);
+}
+
+bool Delta::Equal::operator()(const Range& rhs_, const key_type& lhs_) const
+{
+	return rhs_.size == lhs_.size() &&
+		std::equal(rhs_.data, rhs_.data + rhs_.size, lhs_.begin());
+}
+
+bool Delta::same(const u_char* data_, size_t size_)
+{
+	// NB. the name is the first TLV inside the varbind sequence.
+	size_t h = 0, t = 0;
+	if (0 == span(data_, size_, h))
+		return false;
+
+	Range k = {data_ + h, 0};
+	k.size = span(k.data, size_ - h, t);
+	map_type::iterator p = m_map.find(k, Hash(), Equal());
+	if (m_map.end() == p)
+	{
+		// NB. the node is filled in place, the varbind is not copied twice.
+		Entry& e = m_map[key_type(k.data, k.data + k.size)];
+		e.epoch = m_epoch;
+		e.varbind.assign(data_, data_ + size_);
+		return false;
+	}
+	Entry& e = p->second;
+	if (e.epoch == m_epoch && e.varbind.size() == size_ &&
+		std::equal(data_, data_ + size_, e.varbind.begin()))
+		return true;
+
+	// NB. assign keeps the room of the previous value when it fits.
+	e.epoch = m_epoch;
+	e.varbind.assign(data_, data_ + size_);
+	return false;
+}
+
+void Delta::clear()
+{
+	// NB. the names not sent since the previous clear are gone for good.
+	for (map_type::iterator p = m_map.begin(); p != m_map.end();)
+	{
+		if (p->second.epoch == m_epoch)
+			++p;
+		else
+			p = m_map.erase(p);
+	}
+	++m_epoch;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Stream
+
+struct Stream::Varbind
+{
+	static bool do_(const netsnmp_variable_list& src_, const oid* name_,
+		size_t length_, u_char*& dst_, size_t& left_)
+	{
+		return Asn::Policy::varbind(src_.type, src_.val.string, src_.val_len,
+				name_, length_, dst_, left_);
+	}
+};
+
+Stream::Stream(): m_size(), m_same()
+{
+}
+
+void Stream::clear()
+{
+	m_size = 0;
+	m_same = 0;
+	m_marks.clear();
+}
+
+void Stream::mark()
+{
+	if (m_marks.empty() ? 0 < m_size : m_marks.back() < m_size)
+		m_marks.push_back(m_size);
+}
+
+bool Stream::grow()
+{
+	if (MAX_SIZE <= m_buffer.size())
+		return true;
+
+	m_buffer.resize(m_buffer.empty() ? (size_t)MIN_SIZE : 2 * m_buffer.size());
+	Table::Census::count(Table::Census::GROW);
+	return false;
+}
+
+size_t Stream::cut(size_t begin_, size_t count_, size_t budget_) const
+{
+	markList_type::const_iterator b = std::upper_bound(m_marks.begin(),
+						m_marks.end(), begin_);
+	if (m_marks.end() == b)
+		return m_size;
+
+	markList_type::const_iterator e = b + std::min<size_t>(count_ - 1,
+						m_marks.end() - b - 1);
+	if (0 == budget_ || *e - begin_ <= budget_)
+		return *e;
+
+	markList_type::const_iterator x = std::upper_bound(b, e, begin_ + budget_);
+	if (b != x)
+		return *(x - 1);
+
+	size_t output = begin_, h = 0;
+	while (output < *b)
+	{
+		size_t n = span(data() + output, *b - output, h);
+		if (0 == n)
+			return *b;
+		if (output != begin_ && output + n - begin_ > budget_)
 			break;
 
-		h->next_variable = data_;
-#if 0
-		for (h = u->variables; h != NULL; h = h->next_variable)
+		output += n;
+	}
+	return output;
+}
+
+void Stream::append(const Stream& src_)
+{
+	if (0 == src_.m_size)
+		return;
+
+	while (m_buffer.size() - m_size < src_.m_size)
+	{
+		if (grow())
+			return;
+	}
+	std::copy(src_.data(), src_.data() + src_.m_size, &m_buffer[0] + m_size);
+	BOOST_FOREACH(size_t e, src_.m_marks)
+	{
+		m_marks.push_back(m_size + e);
+	}
+	m_size += src_.m_size;
+}
+
+void Stream::append(const Stream& src_, Delta& delta_)
+{
+	size_t b = 0;
+	BOOST_FOREACH(size_t e, src_.m_marks)
+	{
+		size_t h = 0, n = 0;
+		for (; b < e; b += n)
 		{
-			std::ostringstream o;
-			for (size_t i = 0; i < h->name_length; ++i)
+			const u_char* x = src_.data() + b;
+			n = span(x, e - b, h);
+			if (0 == n)
+				break;
+			if (delta_.same(x, n))
 			{
-				o << "." << h->name[i];
+				++m_same;
+				continue;
 			}
-			snmp_log(LOG_ERR, LOG_PREFIX"varbind int the trap %s\n", o.str().c_str());
+			while (m_buffer.size() - m_size < n)
+			{
+				if (grow())
+					return;
+			}
+			std::copy(x, x + n, &m_buffer[0] + m_size);
+			m_size += n;
 		}
-		snmp_log(LOG_ERR, LOG_PREFIX"\n\n");
-#endif // 0
-		u->version = SNMP_VERSION_2c;
-		return u;
+		b = e;
+		mark();
 	}
-	snmp_free_pdu(u);
-	snmp_free_varbind(data_);
-	return NULL;
 }
 
-netsnmp_variable_list* Trap::make() const
+bool Stream::put(const netsnmp_variable_list& value_)
 {
-	netsnmp_variable_list* output = Provider::make();
-	if (NULL == output)
-		return NULL;
+	return put<Varbind>(value_, value_.name, value_.name_length);
+}
 
-	Oid_type n = Central::traps();
-	n.push_back(0);
-	n.push_back(51);
-	Asn::Policy::ObjectId::get(n, *output);
+bool Stream::put(const Provider& value_)
+{
+	netsnmp_variable_list* v = value_.make();
+	bool output = false;
+	for (netsnmp_variable_list* x = v; x != NULL && !output; x = x->next_variable)
+	{
+		output = put(*x);
+	}
+	snmp_free_varbind(v);
 	return output;
 }
 
@@ -229,6 +576,16 @@ Base::~Base()
 {
 }
 
+void Base::stream(const Filter& filter_, Stream& dst_) const
+{
+	std::auto_ptr<Provider> x(snapshot(filter_.metrix()));
+	if (NULL == x.get())
+		return;
+
+	Table::Census::count(Table::Census::TREE);
+	dst_.put(*x);
+}
+
 } // namespace Composite
 } // namespace Value
 } // namespace Rmond
@@ -29,6 +29,8 @@
 #include "table.h"
 #include <memory>
 #include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
 #include <boost/ptr_container/ptr_list.hpp>
 
 namespace Rmond
@@ -46,6 +48,181 @@ struct Provider
 	virtual netsnmp_variable_list* make() const = 0;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// struct Filter
+// NB. a metric set compiled once for the snapshots of a sink. a metric
+// selects every column and scalar in its subtree, an empty set selects all
+// of them. a column is looked up in the trie once, the answer is kept in
+// the plan at the slot of the column. the plan is atomic, thus several
+// threads may share a filter.
+
+struct Filter
+{
+	typedef Oid_type (*uuid_type)();
+
+	explicit Filter(const Metrix_type& metrix_);
+
+	const Metrix_type& metrix() const
+	{
+		return m_metrix;
+	}
+	bool match(const Oid_type& name_) const;
+	bool select(size_t slot_, uuid_type uuid_) const;
+	// NB. a new slot for a column or a scalar.
+	static size_t slot();
+private:
+	struct Node
+	{
+		Node(): leaf()
+		{
+		}
+
+		bool leaf;
+		std::map<oid, size_t> next;
+	};
+
+	enum
+	{
+		UNKNOWN,
+		REJECTED,
+		SELECTED,
+		MAX_SLOTS = 512
+	};
+
+	Metrix_type m_metrix;
+	std::vector<Node> m_trie;
+	mutable u_char m_plan[MAX_SLOTS];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Delta
+// NB. the last encoded varbind a sink has sent under every name. a varbind
+// that is the same byte for byte as the last time it was sent is not sent
+// again. a clear forgets the values but keeps the room of the names seen
+// since the previous one, so that a keyframe allocates nothing for them.
+
+struct Delta
+{
+	Delta(): m_epoch(1)
+	{
+	}
+
+	// NB. returns true if the encoded varbind has not changed, remembers
+	// it otherwise.
+	bool same(const u_char* data_, size_t size_);
+	void clear();
+private:
+	typedef std::vector<u_char> key_type;
+	struct Range
+	{
+		const u_char* data;
+		size_t size;
+	};
+	struct Hash
+	{
+		size_t operator()(const key_type& key_) const;
+		size_t operator()(const Range& key_) const;
+	};
+	struct Equal
+	{
+		bool operator()(const key_type& rhs_, const key_type& lhs_) const
+		{
+			return rhs_ == lhs_;
+		}
+		bool operator()(const Range& rhs_, const key_type& lhs_) const;
+		bool operator()(const key_type& rhs_, const Range& lhs_) const
+		{
+			return (*this)(lhs_, rhs_);
+		}
+	};
+	struct Entry
+	{
+		// NB. the value is valid only when sent during the current epoch.
+		unsigned epoch;
+		std::vector<u_char> varbind;
+	};
+	typedef boost::unordered_map<key_type, Entry, Hash, Equal> map_type;
+
+	map_type m_map;
+	unsigned m_epoch;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Stream
+// NB. the varbinds of the traps BER encoded back to back into a buffer that
+// lives as long as the sink does, so it grows a few times and then stays.
+// a mark ends the varbinds of a composite, the unit the sink limit counts.
+
+struct Stream
+{
+	typedef std::vector<size_t> markList_type;
+
+	Stream();
+
+	void clear();
+	void mark();
+	// NB. the end of a trap that starts at the begin_ varbind. the trap
+	// ends at a mark after count_ marks or earlier to fit budget_ bytes.
+	// a composite is split only if it cannot fit alone, a varbind never.
+	size_t cut(size_t begin_, size_t count_, size_t budget_) const;
+	// NB. copies all the varbinds and the marks of the src_.
+	void append(const Stream& src_);
+	// NB. copies the varbinds of the src_ the delta_ has not seen yet,
+	// the marks too.
+	void append(const Stream& src_, Delta& delta_);
+	// NB. return true if the buffer cannot grow any more.
+	bool put(const Provider& value_);
+	bool put(const netsnmp_variable_list& value_);
+	template<class F, class D>
+	bool put(const D& data_, const oid* name_, size_t length_)
+	{
+		if (m_buffer.empty() && grow())
+			return true;
+		do
+		{
+			size_t n = m_buffer.size() - m_size;
+			u_char* x = &m_buffer[0] + m_size;
+			if (!F::do_(data_, name_, length_, x, n))
+			{
+				m_size = x - &m_buffer[0];
+				return false;
+			}
+		} while (!grow());
+		return true;
+	}
+	size_t size() const
+	{
+		return m_size;
+	}
+	// NB. the number of the varbinds dropped as unchanged.
+	unsigned same() const
+	{
+		return m_same;
+	}
+	const u_char* data() const
+	{
+		return m_buffer.empty() ? NULL : &m_buffer[0];
+	}
+	const markList_type& marks() const
+	{
+		return m_marks;
+	}
+private:
+	enum
+	{
+		MIN_SIZE = 4096,
+		MAX_SIZE = 16 << 20
+	};
+	struct Varbind;
+
+	bool grow();
+
+	size_t m_size;
+	unsigned m_same;
+	markList_type m_marks;
+	std::vector<u_char> m_buffer;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Trap
 
@@ -53,6 +230,14 @@ struct Trap: Provider
 {
 	netsnmp_variable_list* make() const;
 	static netsnmp_pdu* pdu(netsnmp_variable_list* );
+	// NB. a whole SNMPv2-Trap message of the session around the encoded
+	// varbinds, the sysUpTime, snmpTrapOID and agentAddr ones go first.
+	static bool frame(const netsnmp_session& session_, const Stream& head_,
+		const u_char* data_, size_t size_, std::vector<u_char>& dst_);
+	// NB. the most bytes a frame adds around the varbinds, no request-id
+	// is taken.
+	static bool overhead(const netsnmp_session& session_, const Stream& head_,
+		size_t& dst_);
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -102,6 +287,11 @@ struct Make<T, typename Table::Unit<typename T::value_type>::tuple_type>
 	{
 		src_.get(T::value, dst_);
 	}
+	static bool do_(const data_type& src_, const oid* name_, size_t length_,
+		u_char*& dst_, size_t& left_)
+	{
+		return src_.template build<T::value>(name_, length_, dst_, left_);
+	}
 };
 
 template<class T>
@@ -113,6 +303,12 @@ struct Make<T, Table::Tuple::Data<typename T::value_type> >
 	{
 		src_.template get<typename T::value_type, T::value>(dst_);
 	}
+	static bool do_(const data_type& src_, const oid* name_, size_t length_,
+		u_char*& dst_, size_t& left_)
+	{
+		return src_.template build<typename T::value_type, T::value>(
+				name_, length_, dst_, left_);
+	}
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -150,8 +346,8 @@ private:
 template<class T, T N>
 struct Unit: Provider
 {
-	typedef Value<mpl::integral_c<T, N>, typename Table::Unit<T>::tuple_type>
-			value_type;
+	typedef typename Table::Unit<T>::tuple_type data_type;
+	typedef Value<mpl::integral_c<T, N>, data_type> value_type;
 
 	explicit Unit(typename value_type::dataSP_type data_): m_data(data_)
 	{
@@ -184,6 +380,21 @@ struct Unit: Provider
 		output.push_back(N);
 		return output;
 	}
+	// NB. encodes the cell right from the row, allocates nothing once the
+	// stream has grown.
+	static bool write(const data_type& data_, Stream& dst_)
+	{
+		static const Oid_type u = prefix();
+		const netsnmp_index& k = data_.key();
+		oid n[MAX_OID_LEN];
+		if (MAX_OID_LEN < u.size() + k.len)
+			return true;
+
+		std::copy(u.begin(), u.end(), n);
+		std::copy(k.oids, k.oids + k.len, n + u.size());
+		return dst_.template put<Make<mpl::integral_c<T, N>, data_type> >(
+				data_, n, u.size() + k.len);
+	}
 private:
 	typename value_type::dataWP_type m_data;
 };
@@ -207,13 +418,23 @@ namespace Details
 template<class T>
 struct Tuple
 {
-	typedef typename Table::Unit<T>::tupleSP_type tupleSP_type;
-	typedef std::list<tupleSP_type> data_type;
+	typedef Table::Unit<T> table_type;
+	typedef typename table_type::tupleSP_type tupleSP_type;
+	typedef std::vector<tupleSP_type> data_type;
+
+	// NB. the rows are valid within a read section only.
+	struct View
+	{
+		boost::shared_ptr<table_type> table;
+		typename table_type::rows_type rows;
+	};
+	typedef View view_type;
 	
 	template<class U>
 	struct Policy
 	{
 		typedef Cell::Unit<typename U::value_type, U::value> cell_type;
+		typedef Cell::Make<U, typename table_type::tuple_type> make_type;
 
 		static Oid_type uuid()
 		{
@@ -228,6 +449,25 @@ struct Tuple
 				dst_.push_back(new cell_type(*p));
 			}
 		}
+		static void write(const view_type& view_, Stream& dst_)
+		{
+			// NB. the name prefix of a column never changes.
+			static const Oid_type u = uuid();
+			oid n[MAX_OID_LEN];
+			std::copy(u.begin(), u.end(), n);
+			typename table_type::rows_type::const_iterator e = view_.rows.end();
+			typename table_type::rows_type::const_iterator p = view_.rows.begin();
+			for (; p != e; ++p)
+			{
+				const netsnmp_index& k = (*p)->key();
+				if (MAX_OID_LEN - u.size() < k.len)
+					continue;
+
+				std::copy(k.oids, k.oids + k.len, n + u.size());
+				if (dst_.template put<make_type>(**p, n, u.size() + k.len))
+					break;
+			}
+		}
 	};
 };
 
@@ -239,6 +479,7 @@ struct Scalar
 {
 	typedef Table::Tuple::Data<T> tuple_type;
 	typedef boost::shared_ptr<tuple_type> data_type;
+	typedef data_type view_type;
 	
 	template<class U>
 	struct Policy
@@ -247,13 +488,27 @@ struct Scalar
 		{
 			return Schema<void>::uuid(U::value);
 		}
+		static Oid_type name()
+		{
+			Oid_type output = uuid();
+			output.push_back(0);
+			return output;
+		}
 		static void copy(const data_type& data_, List& dst_)
 		{
-			Oid_type u = uuid();
-			u.push_back(0);
-			dst_.push_back(new Value::Named(u,
+			dst_.push_back(new Value::Named(name(),
 				new Value::Cell::Value<U, tuple_type>(data_)));
 		}
+		static void write(const view_type& view_, Stream& dst_)
+		{
+			if (NULL == view_.get())
+				return;
+
+			static const Oid_type u = name();
+			oid n[MAX_OID_LEN];
+			std::copy(u.begin(), u.end(), n);
+			dst_.template put<Cell::Make<U, tuple_type> >(*view_, n, u.size());
+		}
 	};
 };
 
@@ -263,8 +518,9 @@ struct Scalar
 template<class T>
 struct Visitor
 {
-	Visitor(typename T::data_type data_, const Metrix_type& metrix_, List& result_):
-		m_result(&result_), m_metrix(&metrix_), m_data(data_)
+	// NB. data_ is not copied, it must outlive the visitor.
+	Visitor(const typename T::data_type& data_, const Metrix_type& metrix_, List& result_):
+		m_result(&result_), m_metrix(&metrix_), m_data(&data_)
 	{
 	}
 
@@ -273,12 +529,38 @@ struct Visitor
 	{
 		typedef typename T::template Policy<U> policy_type;
 		if (m_metrix->empty() || m_metrix->count(policy_type::uuid()) > 0)
-			policy_type::copy(m_data, *m_result);
+			policy_type::copy(*m_data, *m_result);
 	}
 private:
 	List* m_result;
 	const Metrix_type* m_metrix;
-	typename T::data_type m_data;
+	const typename T::data_type* m_data;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// struct Writer
+
+template<class T>
+struct Writer
+{
+	// NB. view_ is not copied, it must outlive the writer.
+	Writer(const typename T::view_type& view_, const Filter& filter_, Stream& result_):
+		m_result(&result_), m_filter(&filter_), m_view(&view_)
+	{
+	}
+
+	template<class U>
+	void operator()(U )
+	{
+		typedef typename T::template Policy<U> policy_type;
+		static const size_t s = Filter::slot();
+		if (m_filter->select(s, &policy_type::uuid))
+			policy_type::write(*m_view, *m_result);
+	}
+private:
+	Stream* m_result;
+	const Filter* m_filter;
+	const typename T::view_type* m_view;
 };
 
 } // namespace Details
@@ -301,6 +583,9 @@ struct Base
 {
 	virtual ~Base();
 	virtual Provider* snapshot(const Metrix_type& metrix_) const = 0;
+	// NB. encodes the varbinds the snapshot would make straight into the
+	// stream. the default goes through the snapshot.
+	virtual void stream(const Filter& filter_, Stream& dst_) const;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -317,6 +602,14 @@ struct Tuple: Base
 			Details::Visitor<V>(u.data(), metrix_, *output));
 		return output;
 	}
+	void stream(const Filter& filter_, Stream& dst_) const
+	{
+		ThreadsafeContainer::Guard g;
+		typename V::view_type v;
+		static_cast<const U& >(*this).view(v);
+		mpl::for_each<typename Rmond::Details::Names<T>::type>(
+			Details::Writer<V>(v, filter_, dst_));
+	}
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -342,6 +635,12 @@ struct Range: Tuple<T, Range<T>, Details::Tuple<T> >
 
 		return t->range(m_key);
 	}
+	void view(typename Details::Tuple<T>::view_type& dst_) const
+	{
+		dst_.table = m_table.lock();
+		if (NULL != dst_.table.get())
+			dst_.table->range(m_key, dst_.rows);
+	}
 private:
 	Oid_type m_key;
 	tableWP_type m_table;
@@ -363,6 +662,10 @@ struct Scalar: Tuple<T, Scalar<T>, Details::Scalar<T> >
 	{
 		return m_data;
 	}
+	void view(data_type& dst_) const
+	{
+		dst_ = m_data;
+	}
 private:
 	data_type m_data;
 };
@@ -22,6 +22,7 @@
  */
 
 #include "ve.h"
+#include "guest.h"
 #include "system.h"
 #include "handler.h"
 #include <cstring>
@@ -36,6 +37,7 @@
 #include <boost/functional/hash/hash.hpp>
 #include <boost/iterator/iterator_facade.hpp>
 #include <fstream>
+#include <fcntl.h>
 
 namespace
 {
@@ -184,10 +186,7 @@ netsnmp_handler_registration*
 
 namespace VE
 {
-typedef boost::unordered_map<std::string, struct ConnectionToVM*> uuidConnectionMap;
-uuidConnectionMap uuid2Connection;
-
-struct ConnectionToVM {
+struct ConnectionToVM: Guest::Channel {
 private:
 	PRL_HANDLE hLogin;
 	PRL_HANDLE hResult;
@@ -198,20 +197,18 @@ private:
 	PRL_HANDLE hExecJob;
 	int vmPipe[2];
 	PRL_HANDLE m_veHandle;
-	const static int readSize = 1024;
-	const static int bufferSize = 4*readSize;
-	int readBytes;
-	char buffer[bufferSize];
-	const static int maxFaults = 3;
-	int errors;
+	Guest::Session m_session;
 public:
 	ConnectionToVM(const char *cmd, PRL_HANDLE veHandle);
 	~ConnectionToVM();
 	int *getVmPipe() {return vmPipe;};
-	int getErrors() {return errors;};
+	int getErrors() {return m_session.errors();};
 	int jobAlive() {return PrlJob_Wait(hExecJob, 0) == PRL_ERR_TIMEOUT;};
-	int lostSignal() {return getErrors() == maxFaults;};
-	char *getLastLine();
+	int lostSignal() {return m_session.lost();};
+	bool pull() {return m_session.pull();};
+	const Guest::Sample& sample() const {return m_session.sample();};
+	int fd() const {return vmPipe[0];};
+	bool alive() {return jobAlive();};
 };
 
 ConnectionToVM::ConnectionToVM(const char *cmd, PRL_HANDLE veHandle):
@@ -222,13 +219,12 @@ ConnectionToVM::ConnectionToVM(const char *cmd, PRL_HANDLE veHandle):
 		hArgs(PRL_INVALID_HANDLE),
 		hEnvs(PRL_INVALID_HANDLE),
 		hExecJob(PRL_INVALID_HANDLE),
-		m_veHandle(veHandle)
+		m_veHandle(veHandle),
+		m_session(*this)
 {
 	int ret;
 	PRL_UINT32 nFlags = PFD_STDOUT | PRPM_RUN_PROGRAM_ENTER;
 	vmPipe[0] = vmPipe[1] = -1;
-	errors = 0;
-	readBytes = 0;
 	hLogin = PrlVm_LoginInGuest(m_veHandle, PRL_PRIVILEGED_GUEST_OS_SESSION, 0, 0);
 	if (hLogin == PRL_INVALID_HANDLE)
 	{
@@ -266,6 +262,12 @@ ConnectionToVM::ConnectionToVM(const char *cmd, PRL_HANDLE veHandle):
 		snmp_log(LOG_ERR, LOG_PREFIX"PrlApi_CreateStringsList error %d\n", ret);
 		throw std::exception();
 	}
+	// NB. an old drs-transport ignores the option and keeps on talking text.
+	if ((ret = PrlStrList_AddItem(hArgs, PROTOCOL_OPTION)) != PRL_ERR_SUCCESS)
+	{
+		snmp_log(LOG_ERR, LOG_PREFIX"PrlStrList_AddItem error %d\n", ret);
+		throw std::exception();
+	}
 	if ((ret = PrlApi_CreateStringsList(&hEnvs)) != PRL_ERR_SUCCESS)
 	{
 		snmp_log(LOG_ERR, LOG_PREFIX"PrlApi_CreateStringsList error %d\n", ret);
@@ -277,6 +279,11 @@ ConnectionToVM::ConnectionToVM(const char *cmd, PRL_HANDLE veHandle):
 		snmp_log(LOG_ERR, LOG_PREFIX"pipe error %s\n", strerror(errno));
 		throw std::exception();
 	}
+	if (fcntl(vmPipe[0], F_SETFL, O_NONBLOCK) != 0)
+	{
+		snmp_log(LOG_ERR, LOG_PREFIX"fcntl error %s\n", strerror(errno));
+		throw std::exception();
+	}
 
 	hExecJob = PrlVmGuest_RunProgram(hVmGuest, cmd, hArgs, hEnvs, nFlags,
 						PRL_INVALID_FILE_DESCRIPTOR,
@@ -288,6 +295,8 @@ ConnectionToVM::ConnectionToVM(const char *cmd, PRL_HANDLE veHandle):
 		snmp_log(LOG_ERR, LOG_PREFIX"PrlVmGuest_RunProgram error\n");
 		throw std::exception();
 	}
+	// NB. the connection may outlive the VE unit that has started it.
+	PrlHandle_AddRef(m_veHandle);
 //	ret = PrlJob_Wait(hExecJob, 1000); //1sec timeout
 /*	if ((ret = PrlJob_Wait(hExecJob, 1000)) != PRL_ERR_SUCCESS) //1sec timeout
 	{
@@ -302,9 +311,9 @@ ConnectionToVM::~ConnectionToVM()
 	PrlVm_Disconnect(m_veHandle);
 	PrlHandle_Free(PrlVmGuest_Logout(hVmGuest, 0));
 	PrlHandle_Free(hExecJob);
-	if (!vmPipe[0])
+	if (0 <= vmPipe[0])
 		close(vmPipe[0]);
-	if (!vmPipe[1])
+	if (0 <= vmPipe[1])
 		close(vmPipe[1]);
 	PrlHandle_Free(hEnvs);
 	PrlHandle_Free(hArgs);
@@ -312,54 +321,232 @@ ConnectionToVM::~ConnectionToVM()
 	PrlHandle_Free(hVmGuest);
 	PrlHandle_Free(hResult);
 	PrlHandle_Free(hLogin);
+	PrlHandle_Free(m_veHandle);
 }
 
-char *ConnectionToVM::getLastLine()
+///////////////////////////////////////////////////////////////////////////////
+// struct Pool
+
+struct Pool
 {
-	int faults = 0;
+	typedef boost::shared_ptr<ConnectionToVM> connectionSP_type;
 
-	while (faults != maxFaults)
+	Pool();
+
+	// NB. returns the established connection to the VM. otherwise starts
+	// the connection setup in the background and returns nothing.
+	connectionSP_type acquire(const std::string& uuid_, PRL_HANDLE ve_);
+	void drop(const std::string& uuid_, bool reconnect_);
+	// NB. starts no more setups, waits for the running ones and closes
+	// the connections. the SDK is still up.
+	void fini();
+private:
+	enum
 	{
-		assert(readBytes < bufferSize - readSize);
-		int n = read(vmPipe[0], buffer + readBytes, readSize);
-		if (n == -1)
-		{
-			snmp_log(LOG_ERR, LOG_PREFIX"read error %s\n", strerror(errno));
-			errors++;
-			return NULL;
-		}
-		readBytes += n;
-		buffer[readBytes] = '\0';
-		char *last = strrchr(buffer, '\n');
-		if (!last)
-		{
-			// unlikely case of incomplete string
-incomplete:
-			sleep(0);
-			faults++;
-			continue;
-		}
-		if (last[1] != '\0')
+		MAX_SESSIONS = 64,
+		MAX_IDLE = 300
+	};
+	struct Entry
+	{
+		Entry(): used(0), token(0), pending(true)
 		{
-			memmove(buffer, last + 1, buffer + readBytes - last - 1);
-			readBytes = buffer + readBytes - last - 1;
-			goto incomplete;
 		}
 
-		*last = '\0';
-		char * before = strrchr(buffer, '\n');
+		connectionSP_type connection;
+		time_t used;
+		// NB. the setup the entry waits for. a setup of an entry that
+		// has been dropped since then finishes to no avail.
+		unsigned token;
+		bool pending;
+	};
+	struct Setup
+	{
+		Pool* pool;
+		std::string uuid;
+		PRL_HANDLE ve;
+		unsigned token;
+		timespec start;
+	};
+	typedef boost::unordered_map<std::string, Entry> map_type;
+
+	static void* setup(void* argv_);
+	void done(const Setup& setup_, ConnectionToVM* connection_);
+	void evict(time_t now_, std::list<connectionSP_type>& dst_);
+	void report() const;
+
+	pthread_mutex_t m_mutex;
+	ConditionalVariable m_idle;
+	map_type m_map;
+	// NB. the setups of the dropped entries still count against the
+	// sessions till they are done.
+	unsigned m_stray;
+	unsigned m_running;
+	bool m_stopped;
+	unsigned m_token;
+	unsigned m_reconnects;
+	unsigned m_setups;
+	unsigned long long m_setupTotal;
+	unsigned long long m_setupMax;
+};
+
+Pool::Pool(): m_stray(0), m_running(0), m_stopped(false), m_token(0),
+	m_reconnects(0), m_setups(0), m_setupTotal(0), m_setupMax(0)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+}
+
+Pool::connectionSP_type Pool::acquire(const std::string& uuid_, PRL_HANDLE ve_)
+{
+	std::list<connectionSP_type> g;
+	Lock l(m_mutex);
+	time_t n = time(NULL);
+	map_type::iterator p = m_map.find(uuid_);
+	if (m_map.end() != p)
+	{
+		p->second.used = n;
+		return p->second.connection;
+	}
+	evict(n, g);
+	if (m_stopped)
+		return connectionSP_type();
+	if (MAX_SESSIONS <= m_map.size() + m_stray)
+	{
+		DEBUGMSGTL((TOKEN_PREFIX"pool", "no room for %s\n", uuid_.c_str()));
+		return connectionSP_type();
+	}
+	std::auto_ptr<Setup> s(new Setup);
+	s->pool = this;
+	s->uuid = uuid_;
+	s->ve = ve_;
+	// NB. the thread owns the setup once started.
+	unsigned k = ++m_token;
+	s->token = k;
+	clock_gettime(CLOCK_MONOTONIC, &s->start);
+	pthread_t t;
+	pthread_attr_t a;
+	pthread_attr_init(&a);
+	pthread_attr_setdetachstate(&a, PTHREAD_CREATE_DETACHED);
+	PrlHandle_AddRef(ve_);
+	int e = pthread_create(&t, &a, &setup, s.get());
+	pthread_attr_destroy(&a);
+	if (0 != e)
+	{
+		PrlHandle_Free(ve_);
+		snmp_log(LOG_ERR, LOG_PREFIX"cannot start the guest setup: 0x%x\n", e);
+		return connectionSP_type();
+	}
+	s.release();
+	++m_running;
+	Entry& x = m_map[uuid_];
+	x.used = n;
+	x.token = k;
+	return connectionSP_type();
+}
+
+void Pool::drop(const std::string& uuid_, bool reconnect_)
+{
+	connectionSP_type c;
+	Lock g(m_mutex);
+	map_type::iterator p = m_map.find(uuid_);
+	if (m_map.end() == p)
+		return;
+
+	// NB. the connection is closed out of the critical section.
+	c = p->second.connection;
+	if (p->second.pending)
+		++m_stray;
+	m_map.erase(p);
+	if (reconnect_)
+		++m_reconnects;
+	report();
+}
 
-		if (before)
-			memmove(buffer, before + 1, buffer + readBytes - before);
-		errors = 0;
-		readBytes = 0;
-		return buffer;
+void* Pool::setup(void* argv_)
+{
+	std::auto_ptr<Setup> s(static_cast<Setup* >(argv_));
+	ConnectionToVM* c = NULL;
+	try
+	{
+		c = new ConnectionToVM("/usr/bin/drs-transport", s->ve);
 	}
-	snmp_log(LOG_ERR, LOG_PREFIX"could not read whole line\n");
-	errors++;
+	catch(...)
+	{
+		;
+	}
+	// NB. the pool stops waiting for the setup once it is done.
+	PrlHandle_Free(s->ve);
+	s->pool->done(*s, c);
 	return NULL;
 }
 
+void Pool::done(const Setup& setup_, ConnectionToVM* connection_)
+{
+	connectionSP_type c(connection_);
+	timespec n;
+	clock_gettime(CLOCK_MONOTONIC, &n);
+	unsigned long long t = (n.tv_sec - setup_.start.tv_sec) * 1000ULL +
+		n.tv_nsec / 1000000 - setup_.start.tv_nsec / 1000000;
+
+	Lock g(m_mutex);
+	++m_setups;
+	m_setupTotal += t;
+	m_setupMax = std::max(m_setupMax, t);
+	if (0 == --m_running)
+		m_idle.signal();
+	map_type::iterator p = m_map.find(setup_.uuid);
+	if (m_map.end() == p || !p->second.pending || p->second.token != setup_.token)
+	{
+		--m_stray;
+		return;
+	}
+	if (NULL == c.get())
+		m_map.erase(p);
+	else
+	{
+		p->second.connection = c;
+		p->second.pending = false;
+	}
+	report();
+}
+
+void Pool::fini()
+{
+	map_type x;
+	Lock g(m_mutex);
+	m_stopped = true;
+	while (0 < m_running)
+		m_idle.wait(m_mutex);
+
+	// NB. the connections are closed out of the critical section.
+	x.swap(m_map);
+	g.leave();
+}
+
+void Pool::evict(time_t now_, std::list<connectionSP_type>& dst_)
+{
+	map_type::iterator p = m_map.begin();
+	while (m_map.end() != p)
+	{
+		if (p->second.pending || now_ - p->second.used < MAX_IDLE)
+			++p;
+		else
+		{
+			dst_.push_back(p->second.connection);
+			p = m_map.erase(p);
+		}
+	}
+}
+
+void Pool::report() const
+{
+	DEBUGMSGTL((TOKEN_PREFIX"pool", "sessions %u, reconnects %u, setups %u, "
+		"setup latency avg %llu ms max %llu ms\n", (unsigned)m_map.size(),
+		m_reconnects, m_setups, m_setups ? m_setupTotal / m_setups : 0ULL,
+		m_setupMax));
+}
+
+Pool g_pool;
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Name
 
@@ -641,7 +828,10 @@ void Perspective<T>::merge(F flavor_, PRL_HANDLE update_)
 		return;
 
 	flavor_.fill(m_uuid, update_);
-	BOOST_FOREACH(typename table_type::tupleSP_type d, z->range(m_parent))
+	ThreadsafeContainer::Guard g;
+	typename table_type::rows_type v;
+	z->range(m_parent, v);
+	BOOST_FOREACH(typename table_type::tuple_type* d, v)
 	{
 		if (flavor_.apply(*d))
 			z->erase(*d);
@@ -740,6 +930,42 @@ typedef boost::shared_ptr<table_type> tableSP_type;
 typedef table_type::tupleSP_type tupleSP_type;
 typedef boost::weak_ptr<table_type::tuple_type> tupleWP_type;
 
+void put(table_type::tuple_type& dst_, Guest::COUNTER counter_, int value_)
+{
+	switch (counter_)
+	{
+	case Guest::LOADAVG_15:
+		return dst_.put<LOADAVG_15>(value_);
+	case Guest::LOADAVG_CURRENT_EXISTING:
+		return dst_.put<LOADAVG_CURRENT_EXISTING>(value_);
+	case Guest::DISKSTATS_IOS_IN_PROCESS:
+		return dst_.put<DISKSTATS_IOS_IN_PROCESS>(value_);
+	case Guest::DISKSTATS_MS_WRITING:
+		return dst_.put<DISKSTATS_MS_WRITING>(value_);
+	case Guest::MEMINFO_PAGETABLES:
+		return dst_.put<MEMINFO_PAGETABLES>(value_);
+	case Guest::MEMINFO_MAPPED:
+		return dst_.put<MEMINFO_MAPPED>(value_);
+	case Guest::MEMINFO_DIRTY:
+		return dst_.put<MEMINFO_DIRTY>(value_);
+	case Guest::MEMINFO_SUNRECLAIM:
+		return dst_.put<MEMINFO_SUNRECLAIM>(value_);
+	case Guest::MEMINFO_WRITEBACK:
+		return dst_.put<MEMINFO_WRITEBACK>(value_);
+	case Guest::COUNTERS:
+		return;
+	}
+}
+
+void put(table_type::tuple_type& dst_, const Guest::Sample& src_)
+{
+	for (int i = 0; i < Guest::COUNTERS; ++i)
+	{
+		if (src_.known.test(i))
+			put(dst_, (Guest::COUNTER)i, src_.values[i]);
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // struct Flavor
 
@@ -822,62 +1048,23 @@ tupleSP_type Flavor::dataFromCT(const tupleSP_type output,
 tupleSP_type Flavor::dataFromLinVM(const tupleSP_type output,
 		const std::string& uuid) const
 {
-	struct ConnectionToVM *connection;
-	if (uuid2Connection.find(uuid) == uuid2Connection.end())
-	{
-		connect:
-		try
-		{
-			connection = new ConnectionToVM("/usr/bin/drs-transport", m_veHandle);
-			uuid2Connection[uuid] = connection;
-		}
-		catch(...)
-		{
-			;
-		}
+	Pool::connectionSP_type c = g_pool.acquire(uuid, m_veHandle);
+	if (NULL == c.get())
 		return output;
-	}
-	else
-		connection = uuid2Connection.at(uuid);
-	char *b = connection->getLastLine();
-	if (!b && (!connection->jobAlive() || connection->lostSignal()))
+	if (c->pull())
+		put(*output, c->sample());
+	else if (c->lostSignal())
 	{
 		snmp_log(LOG_ERR, LOG_PREFIX"reconnecting to %s\n", uuid.c_str());
-		delete uuid2Connection.at(uuid);
-		uuid2Connection.erase(uuid);
-		goto connect;
-	}
-	while (b)
-	{
-		#define READ_TO_PROPERTY(string, property) { \
-			if (boost::starts_with(b, string)) { \
-				char *temp = strchr(b, ':'); \
-				if (temp) \
-					output->put<property>(strtoul(temp + 1, NULL, 10)); \
-			} \
-		}
-		READ_TO_PROPERTY("loadavg_15",LOADAVG_15);
-		READ_TO_PROPERTY("loadavg_currExisting",LOADAVG_CURRENT_EXISTING);
-		READ_TO_PROPERTY("diskstats_ios_in_process",DISKSTATS_IOS_IN_PROCESS);
-		READ_TO_PROPERTY("diskstats_ms_writing",DISKSTATS_MS_WRITING);
-		READ_TO_PROPERTY("meminfo_PageTables",MEMINFO_PAGETABLES);
-		READ_TO_PROPERTY("meminfo_Mapped",MEMINFO_MAPPED);
-		READ_TO_PROPERTY("meminfo_Dirty",MEMINFO_DIRTY);
-		READ_TO_PROPERTY("meminfo_SUnreclaim",MEMINFO_SUNRECLAIM);
-		READ_TO_PROPERTY("meminfo_Writeback",MEMINFO_WRITEBACK);
-		b = strchr(b, ' ');
-		if (b)
-			b += 1;
-		else
-			break;
-		#undef READ_TO_PROPERTY
+		g_pool.drop(uuid, true);
+		g_pool.acquire(uuid, m_veHandle);
 	}
 	return output;
 }
 
 tupleSP_type Flavor::tuple(const table_type::key_type& uuid_) const
 {
-	tupleSP_type output(new table_type::tuple_type(uuid_));
+	tupleSP_type output = table_type::make(uuid_);
 	VE::tupleSP_type x = m_ve.lock();
 
 	if (x->get<TYPE>() == PVT_CT && x->get<STATE>() == VMS_RUNNING)
@@ -885,6 +1072,8 @@ tupleSP_type Flavor::tuple(const table_type::key_type& uuid_) const
 	if (x->get<TYPE>() == PVT_VM && x->get<STATE>() == VMS_RUNNING
 			&& x->get<OS_TYPE>() == PVS_GUEST_TYPE_LINUX)
 		dataFromLinVM(output, x->get<UUID>());
+	else if (x->get<TYPE>() == PVT_VM)
+		g_pool.drop(x->get<UUID>(), false);
 	return output;
 }
 
@@ -1072,7 +1261,7 @@ private:
 
 tupleSP_type Flavor::tuple(const table_type::key_type& uuid_) const
 {
-	return tupleSP_type(new table_type::tuple_type(key(uuid_)));
+	return table_type::make(key(uuid_));
 }
 
 table_type::key_type Flavor::key(const table_type::key_type& uuid_) const
@@ -1461,7 +1650,7 @@ private:
 tupleSP_type Flavor::tuple(const table_type::key_type& uuid_) const
 {
 	table_type::key_type k = key(uuid_);
-	tupleSP_type output(new table_type::tuple_type(k));
+	tupleSP_type output = table_type::make(k);
 	output->put<NAME>(m_name);
 	return output;
 }
@@ -1834,7 +2023,7 @@ private:
 tupleSP_type Flavor::tuple(const table_type::key_type& uuid_) const
 {
 	table_type::key_type k = key(uuid_);
-	tupleSP_type output(new table_type::tuple_type(k));
+	tupleSP_type output = table_type::make(k);
 	output->put<MAC>(m_device->mac());
 	return output;
 }
@@ -1986,7 +2175,7 @@ private:
 // struct Unit
 
 Unit::Unit(PRL_HANDLE ve_, const table_type::key_type& key_, const space_type& space_):
-	Environment(ve_), m_state(NULL), m_tuple(new table_type::tuple_type(key_)),
+	Environment(ve_), m_state(NULL), m_tuple(table_type::make(key_)),
 	m_table(space_.get<0>())
 {
 	tableSP_type t = m_table.lock();
@@ -2034,6 +2223,9 @@ Unit::~Unit()
 	PRL_RESULT e = PrlJob_Wait(j, UINT_MAX);
 	(void)e;
 	PrlHandle_Free(j);
+	std::string u;
+	if (!uuid(u))
+		g_pool.drop(u, false);
 	tableSP_type t = m_table.lock();
 	if (NULL != t.get() && m_tuple.get() != NULL)
 		t->erase(*m_tuple);
@@ -2075,6 +2267,11 @@ void Unit::state(PRL_HANDLE event_)
 		m_state->extract(event_);
 }
 
+void Unit::fini()
+{
+	g_pool.fini();
+}
+
 bool Unit::inject(space_type& dst_)
 {
 	typedef Table::Handler::ReadOnly<TABLE> handler_type;
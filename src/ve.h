@@ -268,6 +268,8 @@ struct Unit: Environment
 	bool uuid(std::string& dst_) const;
 
 	static bool inject(space_type& dst_);
+	// NB. before the SDK is deinitialized.
+	static void fini();
 private:
 	State* m_state;
 	tupleSP_type m_tuple;